@@ -0,0 +1,743 @@
+#include "bench.hpp"
+
+#include "marching_cubes.hpp"
+#include "capsule_set.hpp"
+#include "parallel.hpp"
+#include "deform.hpp"
+
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+/*
+  The helix of capsules of the viewer, as a density for marching cubes.
+*/
+struct BenchDensity {
+
+    CapsuleSet capsules;
+
+    BenchDensity() {
+	glm::vec3 prev;
+
+	for(float s = 0; s < 16.0f; s +=1.0f) {
+	    glm::vec3 p(
+		cos(s / sqrt(2) ),
+		sin(s / sqrt(2) ),
+		s / sqrt(2)
+		);
+
+	    if(s > 0.0f)
+		capsules.Add(prev, p, 0.5f);
+	    prev = p;
+	}
+
+	capsules.Build();
+    }
+
+    float eval(float x, float y, float z) const{
+	return capsules.Eval(x,y,z);
+    }
+
+    void evalBatch(const float* xs, const float* ys, const float* zs, float* out, size_t n) const {
+	capsules.EvalBatch(xs, ys, zs, out, n);
+    }
+
+    glm::vec3 gradient(float x, float y, float z) const {
+	return capsules.Gradient(x,y,z);
+    }
+};
+
+// the bounding box of the helix, with some space around it.
+static const float BENCH_BOUNDS[2][3] = {
+    { -2.0f, -2.0f, -1.0f },
+    { +2.0f, +2.0f, 12.0f }
+};
+
+static double Now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// the thread counts to measure: 1, 2, 4, ... up to numThreads.
+static std::vector<int> ThreadCounts(int numThreads) {
+    std::vector<int> counts;
+
+    for(int t = 1; t < NumThreads(numThreads); t *= 2) {
+	counts.push_back(t);
+    }
+    counts.push_back(NumThreads(numThreads));
+
+    return counts;
+}
+
+static bool SameMesh(const Mesh& a, const Mesh& b) {
+    return
+	a.vertices.size() == b.vertices.size() &&
+	a.faces.size() == b.faces.size() &&
+	!memcmp(a.vertices.data(), b.vertices.data(), a.vertices.size() * sizeof(glm::vec3)) &&
+	!memcmp(a.faces.data(), b.faces.data(), a.faces.size() * sizeof(Tri));
+}
+
+/*
+  Marching cubes with 1, 2, 4, ... threads, with the density evaluation and the
+  meshing timed separately. Every grid point is evaluated, so that the amount
+  of work does not depend on how the grid is split up. Then the evaluation that
+  skips the empty space, for how many evaluations that saves.
+*/
+static void BenchMcThreads(const BenchOptions& options) {
+
+    BenchDensity density;
+
+    const int resolution = options.resolution;
+
+    float cellSizes[3];
+    for(int i = 0; i < 3; ++i) {
+	cellSizes[i] = (BENCH_BOUNDS[1][i] - BENCH_BOUNDS[0][i]) / (float)(resolution-1);
+    }
+
+    McBrickLayout layout(resolution);
+    std::vector<float> densityValues(layout.Size());
+
+    Mesh serial;
+    double serialTime = 0.0;
+
+    printf("marching cubes, %d^3 grid\n", resolution);
+    printf("%8s %12s %12s %12s %8s %10s\n", "threads", "eval(s)", "mesh(s)", "total(s)", "speedup", "same mesh");
+
+    for(int numThreads : ThreadCounts(options.numThreads)) {
+
+	double start = Now();
+	McEvalDensity(density, resolution, BENCH_BOUNDS, cellSizes, numThreads, 0.0f, layout, densityValues.data());
+	double evalTime = Now() - start;
+
+	start = Now();
+	McDensityGrid<BenchDensity> grid = { density, layout, densityValues.data(), resolution, BENCH_BOUNDS, cellSizes };
+	Mesh mesh = McMeshSlabs(grid, resolution, BENCH_BOUNDS, cellSizes, numThreads);
+	double meshTime = Now() - start;
+
+	if(numThreads == 1) {
+	    serial = mesh;
+	    serialTime = evalTime + meshTime;
+	}
+
+	printf("%8d %12.4f %12.4f %12.4f %8.2f %10s\n",
+	       numThreads, evalTime, meshTime, evalTime + meshTime,
+	       serialTime / (evalTime + meshTime),
+	       SameMesh(mesh, serial) ? "yes" : "NO");
+    }
+
+    // the helix is a true distance field, so the empty space far from it can be skipped.
+    double start = Now();
+    long numEvals = McEvalDensity(density, resolution, BENCH_BOUNDS, cellSizes, options.numThreads, 1.0f, layout, densityValues.data());
+    double evalTime = Now() - start;
+
+    printf("skipping the empty space: %.4f seconds, %ld of %ld density evaluations\n",
+	   evalTime, numEvals, (long)resolution*resolution*resolution);
+}
+
+/*
+  The helix, but without the gradient, so that marching cubes finds the normals
+  from the grid, and reads the neighbours of the grid points too.
+*/
+struct BenchGridNormalDensity {
+
+    BenchDensity helix;
+
+    float eval(float x, float y, float z) const{
+	return helix.eval(x,y,z);
+    }
+
+    void evalBatch(const float* xs, const float* ys, const float* zs, float* out, size_t n) const {
+	helix.evalBatch(xs, ys, zs, out, n);
+    }
+};
+
+/*
+  Marching cubes of the helix, with the density grid in layout L. The best
+  times of three runs, of the evaluation of the whole grid, and of the meshing,
+  which reads the grid for the signs, the vertices and the normals.
+*/
+template<typename L>
+static Mesh BenchLayout(const char* name, int resolution, int numThreads) {
+
+    BenchGridNormalDensity density;
+
+    float cellSizes[3];
+    for(int i = 0; i < 3; ++i) {
+	cellSizes[i] = (BENCH_BOUNDS[1][i] - BENCH_BOUNDS[0][i]) / (float)(resolution-1);
+    }
+
+    L layout(resolution);
+    std::vector<float> densityValues(layout.Size());
+
+    double evalTime = DBL_MAX;
+    double meshTime = DBL_MAX;
+    Mesh mesh;
+
+    for(int run = 0; run < 3; ++run) {
+	double start = Now();
+	McEvalDensity(density, resolution, BENCH_BOUNDS, cellSizes, numThreads, 0.0f, layout, densityValues.data());
+	evalTime = std::min(evalTime, Now() - start);
+
+	start = Now();
+	McDensityGrid<BenchGridNormalDensity, L> grid = { density, layout, densityValues.data(), resolution, BENCH_BOUNDS, cellSizes };
+	mesh = McMeshSlabs(grid, resolution, BENCH_BOUNDS, cellSizes, numThreads);
+	meshTime = std::min(meshTime, Now() - start);
+    }
+
+    printf("%-8s %12.4f %12.4f %12.4f\n", name, evalTime, meshTime, evalTime + meshTime);
+
+    return mesh;
+}
+
+/*
+  The brick layout of the density grid against the linear one. Only the times
+  are compared here, run it under perf stat for the cache misses.
+*/
+static void BenchLayouts(const BenchOptions& options) {
+
+    printf("marching cubes, %d^3 grid, %d threads\n", options.resolution, NumThreads(options.numThreads));
+    printf("%-8s %12s %12s %12s\n", "layout", "eval(s)", "mesh(s)", "total(s)");
+
+    Mesh linear = BenchLayout<McLinearLayout>("linear", options.resolution, options.numThreads);
+    Mesh brick = BenchLayout<McBrickLayout>("brick", options.resolution, options.numThreads);
+
+    printf("same mesh: %s\n", SameMesh(linear, brick) ? "yes" : "NO");
+}
+
+/*
+  The union of n capsules, evaluated with the BVH of CapsuleSet, and with a
+  linear scan over all the capsules, like Density::eval used to do. The
+  capsules are random walks of strokes, in a box that grows with n, so that
+  the capsules are about as crowded for every n. The points are short rows
+  of a 256^3 grid over the box, at random places, since that is what the batch
+  evaluation is for.
+*/
+static void BenchCapsules(const BenchOptions& /* options */) {
+
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+    printf("%9s %14s %14s %14s %9s %6s\n", "capsules", "linear(ns)", "bvh(ns)", "bvh batch(ns)", "speedup", "same");
+
+    for(int numCapsules : { 10, 100, 1000, 10000 }) {
+
+	// one stroke every 20 capsules.
+	const float size = 4.0f * cbrtf((float)numCapsules);
+
+	std::vector<glm::vec3> p0s;
+	std::vector<glm::vec3> p1s;
+	std::vector<float> rs;
+
+	glm::vec3 p;
+
+	for(int i = 0; i < numCapsules; ++i) {
+	    if(i % 20 == 0) {
+		p = size * glm::vec3(uniform(random), uniform(random), uniform(random));
+	    }
+
+	    glm::vec3 step = glm::vec3(uniform(random), uniform(random), uniform(random)) - glm::vec3(0.5f);
+	    glm::vec3 q = glm::clamp(p + step, glm::vec3(0.0f), glm::vec3(size));
+
+	    p0s.push_back(p);
+	    p1s.push_back(q);
+	    rs.push_back(0.2f + 0.4f * uniform(random));
+
+	    p = q;
+	}
+
+	CapsuleSet capsules;
+	for(int i = 0; i < numCapsules; ++i) {
+	    capsules.Add(p0s[i], p1s[i], rs[i]);
+	}
+	capsules.Build();
+
+	// the linear scan gets fewer points, so that it doesn't take all day.
+	const size_t numPoints = 1 << 18;
+	const size_t numLinearPoints = std::min(numPoints, (size_t)(1 << 26) / numCapsules);
+
+	const int ROW_LENGTH = 64;
+	const float spacing = size / 256.0f;
+
+	std::vector<float> xs(numPoints), ys(numPoints), zs(numPoints);
+	for(size_t i = 0; i < numPoints; i += ROW_LENGTH) {
+	    glm::vec3 start = (size - ROW_LENGTH * spacing) * glm::vec3(uniform(random), uniform(random), uniform(random));
+
+	    for(int j = 0; j < ROW_LENGTH; ++j) {
+		xs[i+j] = start.x;
+		ys[i+j] = start.y;
+		zs[i+j] = start.z + j * spacing;
+	    }
+	}
+
+	std::vector<float> linear(numLinearPoints);
+	std::vector<float> bvh(numPoints);
+	std::vector<float> batch(numPoints);
+
+	double start = Now();
+	for(size_t i = 0; i < numLinearPoints; ++i) {
+	    float v = FLT_MAX;
+	    for(int j = 0; j < numCapsules; ++j) {
+		v = Union(v, Capsule(xs[i], ys[i], zs[i], p0s[j], p1s[j], rs[j]));
+	    }
+	    linear[i] = v;
+	}
+	double linearTime = (Now() - start) / numLinearPoints;
+
+	start = Now();
+	for(size_t i = 0; i < numPoints; ++i) {
+	    bvh[i] = capsules.Eval(xs[i], ys[i], zs[i]);
+	}
+	double bvhTime = (Now() - start) / numPoints;
+
+	start = Now();
+	capsules.EvalBatch(xs.data(), ys.data(), zs.data(), batch.data(), numPoints);
+	double batchTime = (Now() - start) / numPoints;
+
+	bool same = batch == bvh && std::equal(linear.begin(), linear.end(), bvh.begin());
+
+	printf("%9d %14.1f %14.1f %14.1f %9.1f %6s\n",
+	       numCapsules, 1e9 * linearTime, 1e9 * bvhTime, 1e9 * batchTime,
+	       linearTime / bvhTime, same ? "yes" : "NO");
+    }
+}
+
+static bool SameConnectivity(const HalfEdgeMesh& a, const HalfEdgeMesh& b) {
+    if(a.NumHalfEdges() != b.NumHalfEdges() || a.NumEdges() != b.NumEdges() || a.NumVertices() != b.NumVertices())
+	return false;
+
+    for(HalfEdgeHandle h = 0; h < (HalfEdgeHandle)a.NumHalfEdges(); ++h) {
+	const HalfEdge& ha = a.GetHalfEdge(h);
+	const HalfEdge& hb = b.GetHalfEdge(h);
+
+	if(ha.twin != hb.twin || ha.next != hb.next || ha.vertex != hb.vertex || ha.face != hb.face || ha.edge != hb.edge)
+	    return false;
+    }
+
+    return true;
+}
+
+/*
+  Building a HalfEdgeMesh from the marching cubes mesh of the helix, with 1, 2,
+  4, ... threads. The time of marching cubes itself is printed for comparison.
+*/
+static void BenchHalfEdge(const BenchOptions& options) {
+
+    BenchDensity density;
+
+    double start = Now();
+    Mesh mesh = MarchingCubes(density, options.resolution,
+			      BENCH_BOUNDS[0][0], BENCH_BOUNDS[1][0],
+			      BENCH_BOUNDS[0][1], BENCH_BOUNDS[1][1],
+			      BENCH_BOUNDS[0][2], BENCH_BOUNDS[1][2],
+			      options.numThreads, 1.0f);
+    double meshTime = Now() - start;
+
+    printf("marching cubes, %d^3 grid: %f seconds, %zu triangles\n", options.resolution, meshTime, mesh.faces.size());
+    printf("%8s %12s %18s %8s %18s\n", "threads", "build(s)", "triangles/s", "speedup", "same connectivity");
+
+    HalfEdgeMesh serial(mesh, 1);
+    double serialTime = 0.0;
+
+    for(int numThreads : ThreadCounts(options.numThreads)) {
+
+	// the best of three, since a single build is quick.
+	double buildTime = DBL_MAX;
+	bool same = true;
+
+	for(int run = 0; run < 3; ++run) {
+	    start = Now();
+	    HalfEdgeMesh halfEdgeMesh(mesh, numThreads);
+	    buildTime = std::min(buildTime, Now() - start);
+
+	    same = same && SameConnectivity(halfEdgeMesh, serial);
+	}
+
+	if(numThreads == 1) {
+	    serialTime = buildTime;
+	}
+
+	printf("%8d %12.4f %18.0f %8.2f %18s\n",
+	       numThreads, buildTime, mesh.faces.size() / buildTime, serialTime / buildTime,
+	       same ? "yes" : "NO");
+    }
+}
+
+// the best time of five runs of f, which returns a sum of what it walked over, in sum.
+template<typename F>
+static double BestOfFive(const F& f, unsigned long long& sum) {
+    double best = DBL_MAX;
+
+    for(int run = 0; run < 5; ++run) {
+	double start = Now();
+	sum = f();
+	best = std::min(best, Now() - start);
+    }
+
+    return best;
+}
+
+/*
+  The circulators of HalfEdgeMesh against the twin and next walks written out by
+  hand, around every inner vertex, and every face, of the marching cubes mesh
+  of the helix. Both sum up the handles they walk over, so that the walks are
+  not optimized away, and must give the same sums.
+*/
+static void BenchCirculators(const BenchOptions& options) {
+
+    BenchDensity density;
+
+    Mesh triangles = MarchingCubes(density, options.resolution,
+				   BENCH_BOUNDS[0][0], BENCH_BOUNDS[1][0],
+				   BENCH_BOUNDS[0][1], BENCH_BOUNDS[1][1],
+				   BENCH_BOUNDS[0][2], BENCH_BOUNDS[1][2],
+				   options.numThreads, 1.0f);
+    HalfEdgeMesh mesh(triangles, options.numThreads);
+
+    // the walk around a vertex assumes an inner vertex.
+    std::vector<VertexHandle> vertices;
+    for(VertexIter it = mesh.beginVertices(); it != mesh.endVertices(); ++it) {
+	if(!mesh.IsBoundary(*it))
+	    vertices.push_back(*it);
+    }
+
+    std::vector<FaceHandle> faces;
+    for(FaceIter it = mesh.beginFaces(); it != mesh.endFaces(); ++it) {
+	faces.push_back(*it);
+    }
+
+    printf("marching cubes, %d^3 grid: %zu inner vertices, %zu faces\n", options.resolution, vertices.size(), faces.size());
+    printf("%-14s %14s %14s %8s %9s\n", "walk", "circulator(s)", "by hand(s)", "ratio", "same sum");
+
+    auto Print = [&](const char* walk, double circulatorTime, unsigned long long circulatorSum,
+		     double handTime, unsigned long long handSum) {
+	printf("%-14s %14.5f %14.5f %8.2f %9s\n",
+	       walk, circulatorTime, handTime, circulatorTime / handTime, circulatorSum == handSum ? "yes" : "NO");
+    };
+
+    unsigned long long circulatorSum;
+    unsigned long long handSum;
+
+    double circulatorTime = BestOfFive([&]() {
+	    unsigned long long sum = 0;
+	    for(VertexHandle v : vertices) {
+		for(HalfEdgeHandle h : mesh.Outgoing(v)) {
+		    sum += h;
+		}
+	    }
+	    return sum;
+	}, circulatorSum);
+
+    double handTime = BestOfFive([&]() {
+	    unsigned long long sum = 0;
+	    for(VertexHandle v : vertices) {
+		HalfEdgeHandle start = mesh.GetVertex(v).halfEdge;
+		HalfEdgeHandle h = start;
+		do {
+		    sum += h;
+		    h = mesh.GetHalfEdge(mesh.GetHalfEdge(h).twin).next;
+		} while(h != start);
+	    }
+	    return sum;
+	}, handSum);
+
+    Print("outgoing", circulatorTime, circulatorSum, handTime, handSum);
+
+    circulatorTime = BestOfFive([&]() {
+	    unsigned long long sum = 0;
+	    for(VertexHandle v : vertices) {
+		for(VertexHandle neighbour : mesh.Neighbours(v)) {
+		    sum += neighbour;
+		}
+	    }
+	    return sum;
+	}, circulatorSum);
+
+    handTime = BestOfFive([&]() {
+	    unsigned long long sum = 0;
+	    for(VertexHandle v : vertices) {
+		HalfEdgeHandle start = mesh.GetVertex(v).halfEdge;
+		HalfEdgeHandle h = start;
+		do {
+		    const HalfEdge& halfEdge = mesh.GetHalfEdge(h);
+		    sum += mesh.GetHalfEdge(halfEdge.next).vertex;
+		    h = mesh.GetHalfEdge(halfEdge.twin).next;
+		} while(h != start);
+	    }
+	    return sum;
+	}, handSum);
+
+    Print("neighbours", circulatorTime, circulatorSum, handTime, handSum);
+
+    circulatorTime = BestOfFive([&]() {
+	    unsigned long long sum = 0;
+	    for(VertexHandle v : vertices) {
+		for(FaceHandle f : mesh.FacesAround(v)) {
+		    sum += f;
+		}
+	    }
+	    return sum;
+	}, circulatorSum);
+
+    handTime = BestOfFive([&]() {
+	    unsigned long long sum = 0;
+	    for(VertexHandle v : vertices) {
+		HalfEdgeHandle start = mesh.GetVertex(v).halfEdge;
+		HalfEdgeHandle h = start;
+		do {
+		    const HalfEdge& halfEdge = mesh.GetHalfEdge(h);
+		    sum += halfEdge.face;
+		    h = mesh.GetHalfEdge(halfEdge.twin).next;
+		} while(h != start);
+	    }
+	    return sum;
+	}, handSum);
+
+    Print("faces around", circulatorTime, circulatorSum, handTime, handSum);
+
+    circulatorTime = BestOfFive([&]() {
+	    unsigned long long sum = 0;
+	    for(FaceHandle f : faces) {
+		for(HalfEdgeHandle h : mesh.FaceHalfEdges(f)) {
+		    sum += mesh.GetHalfEdge(h).vertex;
+		}
+	    }
+	    return sum;
+	}, circulatorSum);
+
+    handTime = BestOfFive([&]() {
+	    unsigned long long sum = 0;
+	    for(FaceHandle f : faces) {
+		HalfEdgeHandle start = mesh.GetFace(f).halfEdge;
+		HalfEdgeHandle h = start;
+		do {
+		    const HalfEdge& halfEdge = mesh.GetHalfEdge(h);
+		    sum += halfEdge.vertex;
+		    h = halfEdge.next;
+		} while(h != start);
+	    }
+	    return sum;
+	}, handSum);
+
+    Print("face edges", circulatorTime, circulatorSum, handTime, handSum);
+}
+
+/*
+  The unit sphere, which the sweep tool starts at the top of.
+*/
+struct SphereDensity {
+    float eval(float x, float y, float z) const{
+	return std::sqrt(x*x + y*y + z*z) - 1.0f;
+    }
+};
+
+// the marching cubes mesh of the unit sphere.
+static Mesh SphereMesh(int resolution, int numThreads) {
+    SphereDensity density;
+
+    double start = Now();
+    Mesh mesh = MarchingCubes(density, resolution, -1.2f, 1.2f, -1.2f, 1.2f, -1.2f, 1.2f, numThreads, 1.0f);
+
+    printf("sphere, %d^3 grid: %zu vertices, %f seconds\n", resolution, mesh.vertices.size(), Now() - start);
+
+    return mesh;
+}
+
+// the largest distance between the vertices of a and b.
+static float MaxDistance(const Mesh& a, const Mesh& b) {
+    float distance = 0.0f;
+    for(size_t i = 0; i < a.vertices.size(); ++i) {
+	distance = std::max(distance, glm::length(a.vertices[i] - b.vertices[i]));
+    }
+    return distance;
+}
+
+/*
+  The sweep of SweepHelper(), step-major on one thread, and vertex-major with
+  1, 2, 4, ... threads, on the sphere.
+*/
+static void BenchSweepOrder(const BenchOptions& options) {
+
+    const Mesh sphere = SphereMesh(options.resolution, options.numThreads);
+
+    Mesh stepMajor = sphere;
+
+    double start = Now();
+    SweepHelper(stepMajor, SWEEP_STEP_MAJOR, 1);
+    double stepMajorTime = Now() - start;
+
+    size_t moved = 0;
+    for(size_t i = 0; i < sphere.vertices.size(); ++i) {
+	moved += sphere.vertices[i] != stepMajor.vertices[i];
+    }
+    printf("%zu vertices are moved\n", moved);
+
+    printf("%-13s %8s %12s %8s %18s %16s\n", "order", "threads", "time(s)", "speedup", "max difference", "same as 1 thread");
+    printf("%-13s %8d %12.4f %8.2f %18s %16s\n", "step-major", 1, stepMajorTime, 1.0, "-", "-");
+
+    Mesh serial;
+
+    for(int numThreads : ThreadCounts(options.numThreads)) {
+
+	Mesh vertexMajor = sphere;
+
+	start = Now();
+	SweepHelper(vertexMajor, SWEEP_VERTEX_MAJOR, numThreads);
+	double time = Now() - start;
+
+	if(numThreads == 1) {
+	    serial = vertexMajor;
+	}
+
+	printf("%-13s %8d %12.4f %8.2f %18g %16s\n",
+	       "vertex-major", numThreads, time, stepMajorTime / time,
+	       MaxDistance(vertexMajor, stepMajor),
+	       SameMesh(vertexMajor, serial) ? "yes" : "NO");
+    }
+}
+
+/*
+  The sweep of Sweep(), which remeshes around the tool, on the sphere with 1,
+  2, 4, ... threads. Sweep() prints as it goes, so the table comes at the end.
+*/
+static void BenchSweepRemesh(const BenchOptions& options) {
+
+    const Mesh sphere = SphereMesh(options.resolution, options.numThreads);
+
+    std::vector<int> threadCounts = ThreadCounts(options.numThreads);
+    std::vector<double> times;
+    std::vector<bool> same;
+
+    Mesh serial;
+
+    for(int numThreads : threadCounts) {
+
+	SweepOptions sweepOptions;
+	sweepOptions.numThreads = numThreads;
+
+	Mesh mesh = sphere;
+
+	double start = Now();
+	Sweep(mesh, sweepOptions);
+	times.push_back(Now() - start);
+
+	if(numThreads == 1) {
+	    serial = mesh;
+	}
+	same.push_back(SameMesh(mesh, serial));
+    }
+
+    printf("%8s %12s %8s %16s\n", "threads", "time(s)", "speedup", "same as 1 thread");
+
+    for(size_t i = 0; i < threadCounts.size(); ++i) {
+	printf("%8d %12.4f %8.2f %16s\n", threadCounts[i], times[i], times[0] / times[i], same[i] ? "yes" : "NO");
+    }
+}
+
+/*
+  The fixed Euler steps of SweepHelper() against the adaptive Runge-Kutta steps
+  of SweepHelperAdaptive() at a few tolerances, on the sphere. The error is the
+  largest distance to an adaptive sweep with a much tighter tolerance. For
+  every tolerance, the number of Euler steps is picked to give about the same
+  error, so that the two are timed at the same accuracy. The error of Euler
+  falls like 1 / steps, so that number is estimated from the error of the
+  usual steps, and then corrected once by the error it gets.
+*/
+static void BenchSweepIntegrator(const BenchOptions& options) {
+
+    // more Euler steps than this take too long, and the round-off of the positions takes over anyway.
+    const int MAX_EULER_STEPS = 100000;
+
+    const Mesh sphere = SphereMesh(options.resolution, options.numThreads);
+
+    Mesh reference = sphere;
+    SweepHelperAdaptive(reference, 1e-7f, options.numThreads);
+
+    // the error of Euler with numSteps steps, and how long it took.
+    auto euler = [&](int numSteps, double& time) {
+	Mesh mesh = sphere;
+	double start = Now();
+	SweepHelper(mesh, SWEEP_VERTEX_MAJOR, options.numThreads, numSteps);
+	time = Now() - start;
+	return MaxDistance(mesh, reference);
+    };
+
+    // about the usual steps of SweepHelper(), where the search for the number of Euler steps starts.
+    const int fixedSteps = 100;
+    double fixedTime = 0.0;
+    float fixedError = euler(fixedSteps, fixedTime);
+
+    printf("euler with %d steps: %.4f seconds, max error %g\n", fixedSteps, fixedTime, fixedError);
+    printf("%10s | %12s %12s %12s | %12s %12s %12s\n", "tolerance",
+	   "rk45 steps", "time(s)", "max error", "euler steps", "time(s)", "max error");
+
+    for(float tolerance : { 1e-2f, 1e-3f, 1e-4f, 1e-5f }) {
+	Mesh adaptive = sphere;
+
+	double start = Now();
+	AdaptiveSweepStats stats;
+	SweepHelperAdaptive(adaptive, tolerance, options.numThreads, &stats);
+	double time = Now() - start;
+	float error = MaxDistance(adaptive, reference);
+
+	// the steps of a vertex, on average.
+	double steps = stats.vertices > 0 ? stats.steps / (double)stats.vertices : 0.0;
+
+	double eulerTime = 0.0;
+	int eulerSteps = fixedSteps;
+	float eulerError = fixedError;
+
+	for(int pass = 0; pass < 2 && eulerError > error && eulerSteps < MAX_EULER_STEPS; ++pass) {
+	    double wanted = ceil(eulerSteps * (double)eulerError / std::max(error, 1e-12f));
+	    eulerSteps = (int)std::min(wanted, (double)MAX_EULER_STEPS);
+	    eulerError = euler(eulerSteps, eulerTime);
+	}
+
+	if(eulerSteps == fixedSteps) {
+	    eulerTime = fixedTime;
+	}
+
+	printf("%10g | %12.2f %12.4f %12g | %12d %12.4f %12g%s\n", tolerance,
+	       steps, time, error, eulerSteps, eulerTime, eulerError,
+	       eulerError > 1.5f * error ? " (error not reached)" : "");
+    }
+}
+
+struct Benchmark {
+    const char* name;
+    const char* description;
+    void (*run)(const BenchOptions& options);
+};
+
+static const Benchmark BENCHMARKS[] = {
+    { "mc-threads", "marching cubes with 1, 2, 4, ... threads", BenchMcThreads },
+    { "layout", "marching cubes with the brick layout of the density grid against the linear one", BenchLayouts },
+    { "capsules", "the BVH of CapsuleSet against a linear scan, for 10 to 10k capsules", BenchCapsules },
+    { "half-edge", "building a HalfEdgeMesh from the marching cubes mesh, with 1, 2, 4, ... threads", BenchHalfEdge },
+    { "circulators", "the circulators of HalfEdgeMesh against the same walks written out by hand", BenchCirculators },
+    { "sweep-order", "the sweep of a sphere, step-major against vertex-major with 1, 2, 4, ... threads", BenchSweepOrder },
+    { "sweep-remesh", "the sweep of a sphere with remeshing around the tool, with 1, 2, 4, ... threads", BenchSweepRemesh },
+    { "sweep-integrator", "the sweep of a sphere, fixed Euler steps against adaptive Runge-Kutta steps", BenchSweepIntegrator },
+};
+
+bool RunBenchmark(const char* name, const BenchOptions& options) {
+    for(const Benchmark& benchmark : BENCHMARKS) {
+	if(!strcmp(benchmark.name, name)) {
+	    benchmark.run(options);
+	    return true;
+	}
+    }
+
+    printf("there is no benchmark called %s\n", name);
+    ListBenchmarks();
+    return false;
+}
+
+void ListBenchmarks() {
+    printf("benchmarks:\n");
+    for(const Benchmark& benchmark : BENCHMARKS) {
+	printf("  %-18s %s\n", benchmark.name, benchmark.description);
+    }
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+/*
+  The benchmarks of sculpt-cli, that are run with --bench NAME instead of a
+  job. Every benchmark prints a table of timings, and checks that the fast path
+  it measures gives the same result as the path it is compared to.
+
+  resolution and numThreads are the -r and -t options. A benchmark that
+  measures the scaling with the number of threads goes up to numThreads, or up
+  to one per core for 0.
+*/
+struct BenchOptions {
+    int resolution;
+    int numThreads;
+};
+
+// run the benchmark called name. Returns false if there is no such benchmark.
+bool RunBenchmark(const char* name, const BenchOptions& options);
+
+// print the names of the benchmarks, and what they measure.
+void ListBenchmarks();
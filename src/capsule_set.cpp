@@ -0,0 +1,247 @@
+#include "capsule_set.hpp"
+
+#include <cfloat>
+
+// the maximum number of capsules in a leaf of the BVH.
+const int LEAF_SIZE = 4;
+
+// the maximum depth of the BVH that we can traverse. The BVH is split at the median, so
+// this is plenty.
+const int MAX_DEPTH = 64;
+
+// how many points of a batch that are evaluated together.
+const size_t CHUNK_SIZE = 16;
+
+void CapsuleSet::Add(const glm::vec3& p0, const glm::vec3& p1, float r) {
+    Primitive primitive;
+    primitive.p0 = p0;
+    primitive.p1 = p1;
+    primitive.r = r;
+
+    m_primitives.push_back(primitive);
+}
+
+void CapsuleSet::Build() {
+
+    m_nodes.clear();
+
+    if(m_primitives.empty())
+	return;
+
+    m_nodes.push_back(Node());
+    BuildNode(0, 0, (int)m_primitives.size());
+}
+
+void CapsuleSet::BuildNode(int nodeIndex, int first, int count) {
+
+    Node node;
+
+    node.boxMin = glm::vec3(+FLT_MAX);
+    node.boxMax = glm::vec3(-FLT_MAX);
+    node.maxRadius = 0.0f;
+
+    glm::vec3 centroidMin(+FLT_MAX);
+    glm::vec3 centroidMax(-FLT_MAX);
+
+    for(int i = first; i < first + count; ++i) {
+	const Primitive& primitive = m_primitives[i];
+
+	node.boxMin = glm::min(node.boxMin, glm::min(primitive.p0, primitive.p1) - glm::vec3(primitive.r));
+	node.boxMax = glm::max(node.boxMax, glm::max(primitive.p0, primitive.p1) + glm::vec3(primitive.r));
+	node.maxRadius = std::max(node.maxRadius, primitive.r);
+
+	glm::vec3 centroid = 0.5f * (primitive.p0 + primitive.p1);
+	centroidMin = glm::min(centroidMin, centroid);
+	centroidMax = glm::max(centroidMax, centroid);
+    }
+
+    if(count <= LEAF_SIZE) {
+	node.first = first;
+	node.count = count;
+	m_nodes[nodeIndex] = node;
+	return;
+    }
+
+    // split at the median, along the axis where the centroids are the most spread out.
+    glm::vec3 extent = centroidMax - centroidMin;
+    int axis = 0;
+    if(extent[1] > extent[axis]) axis = 1;
+    if(extent[2] > extent[axis]) axis = 2;
+
+    int mid = first + count / 2;
+
+    std::nth_element(
+	m_primitives.begin() + first,
+	m_primitives.begin() + mid,
+	m_primitives.begin() + first + count,
+	[axis](const Primitive& a, const Primitive& b) {
+	    return (a.p0[axis] + a.p1[axis]) < (b.p0[axis] + b.p1[axis]);
+	});
+
+    int children = (int)m_nodes.size();
+    m_nodes.push_back(Node());
+    m_nodes.push_back(Node());
+
+    node.first = children;
+    node.count = 0;
+    m_nodes[nodeIndex] = node;
+
+    BuildNode(children + 0, first, mid - first);
+    BuildNode(children + 1, mid, first + count - mid);
+}
+
+float CapsuleSet::LowerBound(const Node& node, const glm::vec3& boxMin, const glm::vec3& boxMax)const {
+
+    glm::vec3 gap = glm::max(glm::vec3(0.0f), glm::max(node.boxMin - boxMax, boxMin - node.boxMax));
+    float d = glm::length(gap);
+
+    /*
+      Outside of the bounding box of a capsule, the distance to the capsule is at least the
+      distance to the box. Inside of it, the distance can't go below minus the radius.
+    */
+    return d > 0.0f ? d : -node.maxRadius;
+}
+
+float CapsuleSet::Nearest(const glm::vec3& p, int& nearest)const {
+
+    float v = FLT_MAX;
+    nearest = -1;
+
+    if(m_nodes.empty())
+	return v;
+
+    int stack[MAX_DEPTH];
+    int top = 0;
+    stack[top++] = 0;
+
+    while(top > 0) {
+
+	const Node& node = m_nodes[stack[--top]];
+
+	if(LowerBound(node, p, p) >= v)
+	    continue; // nothing in here can be closer.
+
+	if(node.count > 0) {
+	    for(int i = node.first; i < node.first + node.count; ++i) {
+		const Primitive& primitive = m_primitives[i];
+		float d = Capsule(p.x,p.y,p.z, primitive.p0, primitive.p1, primitive.r);
+
+		// the same as Union(), but remembers which capsule it was.
+		if(d < v) {
+		    v = d;
+		    nearest = i;
+		}
+	    }
+	    continue;
+	}
+
+	// visit the closer child first, so that we can skip as much as possible of the other one.
+	float d0 = LowerBound(m_nodes[node.first + 0], p, p);
+	float d1 = LowerBound(m_nodes[node.first + 1], p, p);
+
+	if(d0 < d1) {
+	    stack[top++] = node.first + 1;
+	    stack[top++] = node.first + 0;
+	} else {
+	    stack[top++] = node.first + 0;
+	    stack[top++] = node.first + 1;
+	}
+    }
+
+    return v;
+}
+
+float CapsuleSet::Eval(float x, float y, float z)const {
+    int nearest;
+    return Nearest(glm::vec3(x,y,z), nearest);
+}
+
+glm::vec3 CapsuleSet::Gradient(float x, float y, float z)const {
+
+    int nearest;
+    Nearest(glm::vec3(x,y,z), nearest);
+
+    if(nearest == -1)
+	return glm::vec3(0.0f);
+
+    const Primitive& primitive = m_primitives[nearest];
+    return CapsuleGradient(x,y,z, primitive.p0, primitive.p1);
+}
+
+void CapsuleSet::FindCandidates(
+    const glm::vec3& boxMin, const glm::vec3& boxMax, float upper,
+    std::vector<int>& candidates)const {
+
+    candidates.clear();
+
+    if(m_nodes.empty())
+	return;
+
+    int stack[MAX_DEPTH];
+    int top = 0;
+    stack[top++] = 0;
+
+    while(top > 0) {
+
+	const Node& node = m_nodes[stack[--top]];
+
+	if(LowerBound(node, boxMin, boxMax) > upper)
+	    continue;
+
+	if(node.count > 0) {
+	    for(int i = node.first; i < node.first + node.count; ++i) {
+		candidates.push_back(i);
+	    }
+	} else {
+	    stack[top++] = node.first + 0;
+	    stack[top++] = node.first + 1;
+	}
+    }
+}
+
+void CapsuleSet::EvalBatch(const float* xs, const float* ys, const float* zs, float* out, size_t n)const {
+
+    std::vector<int> candidates;
+    float v[CHUNK_SIZE];
+
+    /*
+      The points are handled in small chunks. For every chunk, we find the capsules that can
+      be the closest one to some point of the chunk, and only evaluate those.
+    */
+    for(size_t begin = 0; begin < n; begin += CHUNK_SIZE) {
+
+	size_t m = std::min(CHUNK_SIZE, n - begin);
+
+	const float* x = xs + begin;
+	const float* y = ys + begin;
+	const float* z = zs + begin;
+
+	glm::vec3 boxMin(+FLT_MAX);
+	glm::vec3 boxMax(-FLT_MAX);
+
+	for(size_t i = 0; i < m; ++i) {
+	    boxMin = glm::min(boxMin, glm::vec3(x[i], y[i], z[i]));
+	    boxMax = glm::max(boxMax, glm::vec3(x[i], y[i], z[i]));
+	}
+
+	glm::vec3 center = 0.5f * (boxMin + boxMax);
+	float halfDiagonal = 0.5f * glm::length(boxMax - boxMin);
+
+	/*
+	  The distance function is 1-Lipschitz, so nowhere in the box is the union further
+	  away than this. We add a little slack for rounding errors.
+	*/
+	float upper = Eval(center.x, center.y, center.z) + halfDiagonal * 1.001f + 1e-6f;
+
+	FindCandidates(boxMin, boxMax, upper, candidates);
+
+	std::fill(out + begin, out + begin + m, FLT_MAX);
+
+	for(int i : candidates) {
+	    const Primitive& primitive = m_primitives[i];
+
+	    CapsuleBatch(x, y, z, v, m, primitive.p0, primitive.p1, primitive.r);
+	    UnionBatch(out + begin, v, m);
+	}
+    }
+}
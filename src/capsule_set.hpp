@@ -0,0 +1,74 @@
+#pragma once
+
+#include "sdf.hpp"
+
+#include <vector>
+
+/*
+  The union of a set of capsules, as a signed distance function.
+
+  Evaluating the union naively means evaluating every single capsule, so the
+  cost grows with the number of capsules. Instead, the capsules are put in a
+  bounding volume hierarchy(BVH), and we only evaluate the capsules that can
+  possibly be the closest one. That way the cost per sample stays about the same,
+  no matter how many capsules there are.
+
+  The result is exactly the same as taking the Union() of all the capsules.
+*/
+class CapsuleSet {
+
+private:
+
+    struct Primitive {
+	glm::vec3 p0;
+	glm::vec3 p1;
+	float r;
+    };
+
+    struct Node {
+	// the bounding box of the capsules in the node.
+	glm::vec3 boxMin;
+	glm::vec3 boxMax;
+
+	// the largest radius of the capsules in the node.
+	float maxRadius;
+
+	// for an inner node, the children are at index first and first+1.
+	// for a leaf, the capsules are [first, first+count).
+	int first;
+	int count;
+    };
+
+    std::vector<Primitive> m_primitives;
+    std::vector<Node> m_nodes;
+
+    void BuildNode(int node, int first, int count);
+
+    // a lower bound of the distance function of the capsules in the node, over the box [boxMin, boxMax].
+    float LowerBound(const Node& node, const glm::vec3& boxMin, const glm::vec3& boxMax)const;
+
+    // the value at p, and the capsule that it comes from, or -1 if there are no capsules.
+    float Nearest(const glm::vec3& p, int& nearest)const;
+
+    // find all the capsules whose distance function can go below upper somewhere in the box [boxMin, boxMax].
+    void FindCandidates(
+	const glm::vec3& boxMin, const glm::vec3& boxMax, float upper,
+	std::vector<int>& candidates)const;
+
+public:
+
+    void Add(const glm::vec3& p0, const glm::vec3& p1, float r);
+
+    // build the BVH. Must be called after the capsules have been added, and before evaluating.
+    void Build();
+
+    float Eval(float x, float y, float z)const;
+
+    // the gradient of Eval(), which is that of the closest capsule.
+    glm::vec3 Gradient(float x, float y, float z)const;
+
+    // evaluate for n points at once.
+    void EvalBatch(const float* xs, const float* ys, const float* zs, float* out, size_t n)const;
+
+    size_t Size()const { return m_primitives.size(); }
+};
@@ -0,0 +1,443 @@
+/*
+  sculpt-cli: runs a sculpting job without a window, or OpenGL:
+
+    density -> marching cubes -> sweep -> remesh -> decimate -> .obj
+
+  The density is a union of capsules, read from a file with one capsule per line,
+
+    x0 y0 z0  x1 y1 z1  radius
+
+  where lines starting with # are skipped. Without a file, it is the helix of
+  capsules that the viewer shows. Every stage prints how long it took.
+*/
+
+#include "marching_cubes.hpp"
+#include "capsule_set.hpp"
+#include "deform.hpp"
+#include "remesh.hpp"
+#include "decimate.hpp"
+#include "normals.hpp"
+#include "bench.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+struct Job {
+    const char* capsulesPath = nullptr;
+    const char* outputPath = nullptr;
+
+    // run this benchmark instead of the job.
+    const char* bench = nullptr;
+
+    int resolution = 100;
+    int numThreads = 0; // one per core.
+
+    // write the marching cubes mesh to the output as it is created, see MarchingCubesStreaming().
+    bool stream = false;
+
+    bool sweep = false;
+    SweepOptions sweepOptions;
+
+    // 0 means no remeshing, and a negative length means the mean edge length of the marching cubes mesh.
+    float remeshLength = 0.0f;
+    int remeshIterations = 5;
+
+    size_t decimateFaces = 0;
+    float decimateError = FLT_MAX;
+    bool decimateRough = false;
+};
+
+struct Density {
+
+    CapsuleSet capsules;
+
+    // the bounding box of the capsules.
+    glm::vec3 boxMin = glm::vec3(+FLT_MAX);
+    glm::vec3 boxMax = glm::vec3(-FLT_MAX);
+
+    void Add(const glm::vec3& p0, const glm::vec3& p1, float r) {
+	capsules.Add(p0, p1, r);
+
+	boxMin = glm::min(boxMin, glm::min(p0, p1) - glm::vec3(r));
+	boxMax = glm::max(boxMax, glm::max(p0, p1) + glm::vec3(r));
+    }
+
+    float eval(float x, float y, float z) const{
+	return capsules.Eval(x,y,z);
+    }
+
+    void evalBatch(const float* xs, const float* ys, const float* zs, float* out, size_t n) const {
+	capsules.EvalBatch(xs, ys, zs, out, n);
+    }
+
+    // marching cubes takes the normals from this, instead of from the grid.
+    glm::vec3 gradient(float x, float y, float z) const {
+	return capsules.Gradient(x,y,z);
+    }
+};
+
+// the same helix as in main.cpp.
+static void AddHelix(Density& density) {
+    glm::vec3 prev;
+
+    for(float s = 0; s < 16.0f; s +=1.0f) {
+	glm::vec3 p(
+	    cos(s / sqrt(2) ),
+	    sin(s / sqrt(2) ),
+	    s / sqrt(2)
+	    );
+
+	if(s > 0.0f)
+	    density.Add(prev, p, 0.5f);
+	prev = p;
+    }
+}
+
+static bool ReadCapsules(const char* path, Density& density) {
+    FILE* file = fopen(path, "r");
+    if(!file) {
+	printf("could not open %s\n", path);
+	return false;
+    }
+
+    char line[1024];
+    int lineNumber = 0;
+
+    while(fgets(line, sizeof(line), file)) {
+	++lineNumber;
+
+	char* p = line;
+	while(*p == ' ' || *p == '\t')
+	    ++p;
+
+	if(*p == '#' || *p == '\n' || *p == '\r' || *p == '\0')
+	    continue;
+
+	glm::vec3 p0;
+	glm::vec3 p1;
+	float r;
+
+	if(sscanf(p, "%f %f %f %f %f %f %f", &p0.x, &p0.y, &p0.z, &p1.x, &p1.y, &p1.z, &r) != 7) {
+	    printf("%s:%d: expected x0 y0 z0 x1 y1 z1 radius\n", path, lineNumber);
+	    fclose(file);
+	    return false;
+	}
+
+	density.Add(p0, p1, r);
+    }
+
+    fclose(file);
+    return true;
+}
+
+static bool WriteObj(const char* path, const Mesh& mesh) {
+    FILE* file = fopen(path, "w");
+    if(!file) {
+	printf("could not open %s\n", path);
+	return false;
+    }
+
+    for(const glm::vec3& v : mesh.vertices) {
+	fprintf(file, "v %f %f %f\n", v.x, v.y, v.z);
+    }
+
+    for(const glm::vec3& n : mesh.normals) {
+	fprintf(file, "vn %f %f %f\n", n.x, n.y, n.z);
+    }
+
+    for(const Tri& tri : mesh.faces) {
+	fprintf(file, "f %u//%u %u//%u %u//%u\n",
+		tri.i[0] + 1, tri.i[0] + 1,
+		tri.i[1] + 1, tri.i[1] + 1,
+		tri.i[2] + 1, tri.i[2] + 1);
+    }
+
+    fclose(file);
+    return true;
+}
+
+static void Usage() {
+    printf(
+	"usage: sculpt-cli [options]\n"
+	"  -c, --capsules FILE    the capsules of the density, one 'x0 y0 z0 x1 y1 z1 radius' per line\n"
+	"  -r, --resolution N     grid points per axis for marching cubes (100)\n"
+	"  -t, --threads N        number of threads, 0 means one per core (0)\n"
+	"      --stream           mesh a slice of the grid at a time, and write it straight to -o,\n"
+	"                         so that the grid never has to fit in memory. No other stages are run\n"
+	"      --sweep            deform the mesh with the sweep tool\n"
+	"      --sweep-edge LENGTH  remesh around the sweep tool to this edge length, 0 only moves the vertices (0.125)\n"
+	"      --sweep-order ORDER  without remeshing, move the vertices 'vertex' or 'step' major (vertex)\n"
+	"      --sweep-tolerance E  without remeshing, move the vertices with adaptive Runge-Kutta steps,\n"
+	"                         to an error of E per step, instead of with fixed steps\n"
+	"      --remesh LENGTH    isotropic remeshing to this edge length, 'mean' for the mean edge length\n"
+	"      --iterations N     remeshing iterations (5)\n"
+	"      --decimate FACES   decimate to at most this many triangles\n"
+	"      --max-error E      do not decimate further than this distance from the surface\n"
+	"      --rough-order      decimate in the order of the errors only roughly, which is faster\n"
+	"  -o, --output FILE      write the mesh to this .obj file\n"
+	"      --bench NAME       run a benchmark instead, with the resolution and threads of -r and -t\n");
+
+    ListBenchmarks();
+}
+
+static bool ParseArgs(int argc, char** argv, Job& job) {
+    for(int i = 1; i < argc; ++i) {
+	const char* arg = argv[i];
+
+	// the options that take a value.
+	const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+	bool hasValue = true;
+
+	if(!strcmp(arg, "-c") || !strcmp(arg, "--capsules")) {
+	    job.capsulesPath = value;
+	} else if(!strcmp(arg, "-r") || !strcmp(arg, "--resolution")) {
+	    job.resolution = value ? atoi(value) : 0;
+	} else if(!strcmp(arg, "-t") || !strcmp(arg, "--threads")) {
+	    job.numThreads = value ? atoi(value) : 0;
+	} else if(!strcmp(arg, "--remesh")) {
+	    job.remeshLength = (value && strcmp(value, "mean")) ? (float)atof(value) : -1.0f;
+	} else if(!strcmp(arg, "--iterations")) {
+	    job.remeshIterations = value ? atoi(value) : 0;
+	} else if(!strcmp(arg, "--decimate")) {
+	    job.decimateFaces = value ? (size_t)atol(value) : 0;
+	} else if(!strcmp(arg, "--max-error")) {
+	    job.decimateError = value ? (float)atof(value) : FLT_MAX;
+	} else if(!strcmp(arg, "-o") || !strcmp(arg, "--output")) {
+	    job.outputPath = value;
+	} else if(!strcmp(arg, "--bench")) {
+	    job.bench = value;
+	} else if(!strcmp(arg, "--stream")) {
+	    job.stream = true;
+	    hasValue = false;
+	} else if(!strcmp(arg, "--sweep-edge")) {
+	    job.sweep = true;
+	    job.sweepOptions.edgeLength = value ? (float)atof(value) : 0.0f;
+	} else if(!strcmp(arg, "--sweep-order")) {
+	    job.sweep = true;
+	    if(value && !strcmp(value, "step")) {
+		job.sweepOptions.order = SWEEP_STEP_MAJOR;
+	    } else if(value && !strcmp(value, "vertex")) {
+		job.sweepOptions.order = SWEEP_VERTEX_MAJOR;
+	    } else if(value) {
+		printf("the sweep order is 'vertex' or 'step'\n");
+		return false;
+	    }
+	} else if(!strcmp(arg, "--sweep-tolerance")) {
+	    job.sweep = true;
+	    job.sweepOptions.tolerance = value ? (float)atof(value) : 0.0f;
+	    if(value && !(job.sweepOptions.tolerance > 0.0f)) {
+		printf("the sweep tolerance must be positive\n");
+		return false;
+	    }
+	} else if(!strcmp(arg, "--rough-order")) {
+	    job.decimateRough = true;
+	    hasValue = false;
+	} else if(!strcmp(arg, "--sweep")) {
+	    job.sweep = true;
+	    hasValue = false;
+	} else if(!strcmp(arg, "-h") || !strcmp(arg, "--help")) {
+	    return false;
+	} else {
+	    printf("unknown option %s\n", arg);
+	    return false;
+	}
+
+	if(hasValue) {
+	    if(!value) {
+		printf("%s needs a value\n", arg);
+		return false;
+	    }
+	    ++i;
+	}
+    }
+
+    if(job.resolution < 4) {
+	printf("the resolution must be at least 4\n");
+	return false;
+    }
+
+    if(job.sweepOptions.tolerance > 0.0f && job.sweepOptions.edgeLength > 0.0f) {
+	printf("--sweep-tolerance needs --sweep-edge 0, the remeshed sweep only has fixed steps\n");
+	return false;
+    }
+
+    if(job.stream) {
+	if(!job.outputPath) {
+	    printf("--stream needs an output file\n");
+	    return false;
+	}
+
+	if(job.sweep || job.remeshLength != 0.0f || job.decimateFaces > 0 || job.decimateError < FLT_MAX) {
+	    printf("--stream only runs marching cubes\n");
+	    return false;
+	}
+    }
+
+    return true;
+}
+
+/*
+  Times the stages of the job.
+*/
+class StageTimer {
+
+private:
+
+    std::chrono::steady_clock::time_point m_jobStart;
+    std::chrono::steady_clock::time_point m_stageStart;
+
+    static double Seconds(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+public:
+
+    StageTimer() {
+	m_jobStart = m_stageStart = std::chrono::steady_clock::now();
+    }
+
+    void Start() {
+	m_stageStart = std::chrono::steady_clock::now();
+    }
+
+    void End(const char* stage, size_t numVertices, size_t numFaces) {
+	printf("[%-15s] %10.4f seconds, %9zu vertices, %9zu triangles\n",
+	       stage, Seconds(m_stageStart), numVertices, numFaces);
+    }
+
+    void End(const char* stage, const Mesh& mesh) {
+	End(stage, mesh.vertices.size(), mesh.faces.size());
+    }
+
+    void End(const char* stage, const HalfEdgeMesh& mesh) {
+	End(stage, mesh.NumVertices(), mesh.NumFaces());
+    }
+
+    void Total() {
+	printf("[%-15s] %10.4f seconds\n", "total", Seconds(m_jobStart));
+    }
+};
+
+int main(int argc, char** argv) {
+
+    Job job;
+
+    if(!ParseArgs(argc, argv, job)) {
+	Usage();
+	return EXIT_FAILURE;
+    }
+
+    if(job.bench) {
+	BenchOptions options;
+	options.resolution = job.resolution;
+	options.numThreads = job.numThreads;
+
+	return RunBenchmark(job.bench, options) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    StageTimer timer;
+
+    Density density;
+
+    if(job.capsulesPath) {
+	if(!ReadCapsules(job.capsulesPath, density))
+	    return EXIT_FAILURE;
+    } else {
+	AddHelix(density);
+    }
+
+    if(density.capsules.Size() == 0) {
+	printf("there are no capsules\n");
+	return EXIT_FAILURE;
+    }
+
+    density.capsules.Build();
+
+    // leave a cell of empty space around the surface, so that it is closed.
+    glm::vec3 margin = (density.boxMax - density.boxMin) / (float)(job.resolution - 3);
+    glm::vec3 boxMin = density.boxMin - margin;
+    glm::vec3 boxMax = density.boxMax + margin;
+
+    if(job.stream) {
+	timer.Start();
+
+	McObjFileSink sink(job.outputPath);
+	if(!sink.IsOpen()) {
+	    printf("could not open %s\n", job.outputPath);
+	    return EXIT_FAILURE;
+	}
+
+	MarchingCubesStreaming(density,
+			       job.resolution,
+			       boxMin.x, boxMax.x,
+			       boxMin.y, boxMax.y,
+			       boxMin.z, boxMax.z,
+			       sink,
+			       job.numThreads);
+
+	if(!sink.Close()) {
+	    printf("could not write %s\n", job.outputPath);
+	    return EXIT_FAILURE;
+	}
+
+	timer.End("streaming mc", sink.NumVertices(), sink.NumFaces());
+	timer.Total();
+
+	return EXIT_SUCCESS;
+    }
+
+    timer.Start();
+    HalfEdgeMesh halfEdgeMesh = MarchingCubesHalfEdge(density,
+						      job.resolution,
+						      boxMin.x, boxMax.x,
+						      boxMin.y, boxMax.y,
+						      boxMin.z, boxMax.z,
+						      job.numThreads,
+						      1.0f // the capsules make up a true distance field.
+	);
+    timer.End("marching cubes", halfEdgeMesh);
+
+    Mesh mesh;
+
+    if(job.sweep) {
+	timer.Start();
+	mesh = halfEdgeMesh.ToMesh();
+	job.sweepOptions.numThreads = job.numThreads;
+	Sweep(mesh, job.sweepOptions);
+	halfEdgeMesh = HalfEdgeMesh(mesh, job.numThreads);
+	timer.End("sweep", halfEdgeMesh);
+    }
+
+    if(job.remeshLength != 0.0f) {
+	timer.Start();
+	float length = job.remeshLength > 0.0f ? job.remeshLength : MeanEdgeLength(halfEdgeMesh);
+	RemeshStats stats = IsotropicRemesh(halfEdgeMesh, length, job.remeshIterations, job.numThreads);
+	timer.End("remesh", halfEdgeMesh);
+	printf("remeshing: %d splits, %d collapses, %d flips\n", stats.numSplits, stats.numCollapses, stats.numFlips);
+    }
+
+    if(job.decimateFaces > 0 || job.decimateError < FLT_MAX) {
+	timer.Start();
+	Decimate(halfEdgeMesh, job.decimateFaces, job.decimateError, job.decimateRough, job.numThreads);
+	timer.End("decimate", halfEdgeMesh);
+    }
+
+    timer.Start();
+    mesh = halfEdgeMesh.ToMesh();
+    ComputeNormals(mesh, job.numThreads);
+    timer.End("normals", mesh);
+
+    if(job.outputPath) {
+	timer.Start();
+	if(!WriteObj(job.outputPath, mesh))
+	    return EXIT_FAILURE;
+	timer.End("export", mesh);
+    }
+
+    timer.Total();
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,358 @@
+#include "decimate.hpp"
+#include "remesh.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <utility>
+
+// the number of items that a thread grabs at a time.
+const size_t DECIMATE_BLOCK_SIZE = 1 << 12;
+
+/*
+  The quadric of the plane dot(n, x) + d = 0 is the symmetric matrix (n, d)(n, d)^T.
+  Only its upper triangle is stored, and weight is the number of planes that were
+  added up.
+*/
+struct Quadric {
+
+    // xx xy xz xw yy yz yw zz zw ww
+    double q[10];
+    double weight;
+
+    Quadric() {
+	for(int i = 0; i < 10; ++i) {
+	    q[i] = 0.0;
+	}
+	weight = 0.0;
+    }
+
+    Quadric(const glm::dvec3& n, double d) {
+	q[0] = n.x * n.x; q[1] = n.x * n.y; q[2] = n.x * n.z; q[3] = n.x * d;
+	q[4] = n.y * n.y; q[5] = n.y * n.z; q[6] = n.y * d;
+	q[7] = n.z * n.z; q[8] = n.z * d;
+	q[9] = d * d;
+	weight = 1.0;
+    }
+
+    Quadric& operator+=(const Quadric& that) {
+	for(int i = 0; i < 10; ++i) {
+	    q[i] += that.q[i];
+	}
+	weight += that.weight;
+	return *this;
+    }
+
+    // the sum of the squared distances from p to the planes.
+    double Error(const glm::dvec3& p)const {
+	double x = p.x;
+	double y = p.y;
+	double z = p.z;
+
+	double sum =
+	    q[0] * x * x + 2.0 * q[1] * x * y + 2.0 * q[2] * x * z + 2.0 * q[3] * x +
+	    q[4] * y * y + 2.0 * q[5] * y * z + 2.0 * q[6] * y +
+	    q[7] * z * z + 2.0 * q[8] * z +
+	    q[9];
+
+	return std::max(sum, 0.0);
+    }
+
+    // the mean of the squared distances from p to the planes.
+    double MeanError(const glm::dvec3& p)const {
+	return weight > 0.0 ? Error(p) / weight : 0.0;
+    }
+
+    // the point where the error is smallest, if there is just one such point.
+    bool Minimum(glm::dvec3& p)const {
+	glm::dmat3 a(
+	    q[0], q[1], q[2],
+	    q[1], q[4], q[5],
+	    q[2], q[5], q[7]);
+
+	/*
+	  On a flat or a cylindrical part of the surface, the minimum is a plane or
+	  a line, and the solution goes anywhere along it.
+	*/
+	double trace = q[0] + q[4] + q[7];
+	double det = glm::determinant(a);
+
+	if(!(std::abs(det) > 1e-6 * trace * trace * trace))
+	    return false;
+
+	p = glm::inverse(a) * -glm::dvec3(q[3], q[6], q[8]);
+	return true;
+    }
+};
+
+// add up the planes of the triangles around an inner vertex.
+static Quadric VertexQuadric(const HalfEdgeMesh& mesh, VertexHandle v) {
+
+    Quadric quadric;
+
+    for(HalfEdgeHandle h : mesh.Outgoing(v)) {
+	const HalfEdge& next = mesh.GetHalfEdge(mesh.GetHalfEdge(h).next);
+
+	glm::dvec3 a = glm::dvec3(mesh.GetVertex(v).p);
+	glm::dvec3 b = glm::dvec3(mesh.GetVertex(next.vertex).p);
+	glm::dvec3 c = glm::dvec3(mesh.GetVertex(mesh.GetHalfEdge(next.next).vertex).p);
+
+	glm::dvec3 n = glm::cross(b - a, c - a);
+	double length = glm::length(n);
+
+	// the slivers of marching cubes have no plane.
+	if(length > 0.0) {
+	    n /= length;
+	    quadric += Quadric(n, -glm::dot(n, a));
+	}
+    }
+
+    return quadric;
+}
+
+struct DecimateCandidate {
+    // the error, see Decimator::Priority().
+    GLuint priority;
+    EdgeHandle edge;
+    GLuint version; // the candidate is stale if the version of the edge has changed since.
+
+    // so that the priority queue has the smallest error on top, and among equal errors, the smallest edge handle.
+    bool operator<(const DecimateCandidate& that)const {
+	return priority != that.priority ? priority > that.priority : edge > that.edge;
+    }
+};
+
+class Decimator {
+
+private:
+
+    HalfEdgeMesh& m_mesh;
+
+    std::vector<Quadric> m_quadrics;
+
+    // by edge: the point to collapse into, and its version.
+    std::vector<glm::vec3> m_targets;
+    std::vector<GLuint> m_versions;
+    // whether the edge has a candidate in the queue, that is not stale.
+    std::vector<char> m_queued;
+    /*
+      Whether the error of the candidate in the queue is too small, because a
+      vertex of the edge has been merged with another one since. Adding planes
+      to a quadric never makes its error smaller, so such a candidate is only
+      evaluated again when it gets to the top of the queue.
+    */
+    std::vector<char> m_dirty;
+
+    std::vector<char> m_boundary;
+
+    std::priority_queue<DecimateCandidate> m_queue;
+
+    // the bits of the error that Priority() keeps.
+    GLuint m_priorityMask;
+
+    /*
+      The bits of the error, that order like it, since it is never negative. With
+      roughOrder, only the sign and the exponent are kept, so errors within about
+      a factor of four count as the same, and among those the smallest edge handle
+      goes first. Marching cubes creates the elements in the order of the grid,
+      so collapses that follow each other are then also near each other in the
+      mesh, and find its elements in the cache.
+    */
+    GLuint Priority(float error)const {
+	error = std::max(error, 0.0f);
+
+	GLuint bits;
+	memcpy(&bits, &error, sizeof(bits));
+	return bits & m_priorityMask;
+    }
+
+    // whether the edge can ever be collapsed. The boundary never changes.
+    bool Collapsible(EdgeHandle e)const {
+	const HalfEdge& h0 = m_mesh.GetHalfEdge(m_mesh.GetEdge(e).halfEdge);
+
+	return
+	    h0.twin != INVALID_HANDLE &&
+	    !m_boundary[h0.vertex] &&
+	    !m_boundary[m_mesh.GetHalfEdge(h0.twin).vertex];
+    }
+
+    /*
+      Find the point to collapse the edge into, and return its error. If the
+      minimum of the quadric is not unique, or is far away, the best of the ends
+      and the midpoint is used instead.
+    */
+    float Evaluate(EdgeHandle e) {
+	m_dirty[e] = 0;
+
+	const HalfEdge& h0 = m_mesh.GetHalfEdge(m_mesh.GetEdge(e).halfEdge);
+	VertexHandle a = h0.vertex;
+	VertexHandle b = m_mesh.GetHalfEdge(h0.twin).vertex;
+
+	Quadric quadric = m_quadrics[a];
+	quadric += m_quadrics[b];
+
+	glm::dvec3 pa = glm::dvec3(m_mesh.GetVertex(a).p);
+	glm::dvec3 pb = glm::dvec3(m_mesh.GetVertex(b).p);
+	glm::dvec3 m = (pa + pb) * 0.5;
+
+	glm::dvec3 p;
+	if(!quadric.Minimum(p) || glm::length(p - m) > glm::length(pb - pa)) {
+	    p = m;
+	    if(quadric.Error(pa) < quadric.Error(p))
+		p = pa;
+	    if(quadric.Error(pb) < quadric.Error(p))
+		p = pb;
+	}
+
+	m_targets[e] = glm::vec3(p);
+	return (float)quadric.Error(p);
+    }
+
+    void Push(EdgeHandle e) {
+	DecimateCandidate candidate;
+	candidate.priority = Priority(Evaluate(e));
+	candidate.edge = e;
+	candidate.version = ++m_versions[e];
+
+	m_queue.push(candidate);
+	m_queued[e] = 1;
+    }
+
+public:
+
+    Decimator(HalfEdgeMesh& mesh, bool roughOrder, int numThreads):
+	m_mesh(mesh), m_priorityMask(roughOrder ? 0xff000000 : 0xffffffff) {
+
+	const GLuint numVertices = mesh.NumVertexHandles();
+	const GLuint numEdges = mesh.NumEdgeHandles();
+
+	m_quadrics.resize(numVertices);
+	m_boundary.resize(numVertices);
+
+	ParallelForBlocks(0, numVertices, DECIMATE_BLOCK_SIZE, numThreads, [&](size_t begin, size_t end) {
+		for(size_t v = begin; v < end; ++v) {
+		    if(mesh.GetVertex((VertexHandle)v).Removed())
+			continue;
+
+		    m_boundary[v] = mesh.IsBoundary((VertexHandle)v);
+
+		    if(!m_boundary[v])
+			m_quadrics[v] = VertexQuadric(mesh, (VertexHandle)v);
+		}
+	    });
+
+	m_targets.resize(numEdges);
+	m_versions.resize(numEdges, 0);
+	m_queued.resize(numEdges, 0);
+	m_dirty.resize(numEdges, 0);
+
+	std::vector<std::vector<DecimateCandidate> > blockCandidates((numEdges + DECIMATE_BLOCK_SIZE - 1) / DECIMATE_BLOCK_SIZE);
+
+	ParallelForBlocks(0, numEdges, DECIMATE_BLOCK_SIZE, numThreads, [&](size_t begin, size_t end) {
+		std::vector<DecimateCandidate>& candidates = blockCandidates[begin / DECIMATE_BLOCK_SIZE];
+
+		for(size_t e = begin; e < end; ++e) {
+		    if(mesh.GetEdge((EdgeHandle)e).Removed() || !Collapsible((EdgeHandle)e))
+			continue;
+
+		    DecimateCandidate candidate;
+		    candidate.priority = Priority(Evaluate((EdgeHandle)e));
+		    candidate.edge = (EdgeHandle)e;
+		    candidate.version = m_versions[e];
+		    m_queued[e] = 1;
+
+		    candidates.push_back(candidate);
+		}
+	    });
+
+	std::vector<DecimateCandidate> candidates;
+	for(const std::vector<DecimateCandidate>& block : blockCandidates) {
+	    candidates.insert(candidates.end(), block.begin(), block.end());
+	}
+
+	// builds the heap in linear time.
+	m_queue = std::priority_queue<DecimateCandidate>(std::less<DecimateCandidate>(), std::move(candidates));
+    }
+
+    int Run(size_t maxFaces, float maxError) {
+
+	const double maxSquaredError = maxError < FLT_MAX ? (double)maxError * maxError : DBL_MAX;
+	int numCollapses = 0;
+
+	while(!m_queue.empty() && m_mesh.NumFaces() > maxFaces) {
+
+	    DecimateCandidate candidate = m_queue.top();
+	    m_queue.pop();
+
+	    EdgeHandle e = candidate.edge;
+
+	    if(m_mesh.GetEdge(e).Removed() || candidate.version != m_versions[e])
+		continue;
+
+	    /*
+	      The error has grown since the candidate was queued. If it is still
+	      the smallest, the edge can go ahead, otherwise it is queued again.
+	    */
+	    if(m_dirty[e]) {
+		DecimateCandidate again = { Priority(Evaluate(e)), e, ++m_versions[e] };
+
+		if(!m_queue.empty() && again < m_queue.top()) {
+		    m_queue.push(again);
+		    continue;
+		}
+	    }
+
+	    /*
+	      If the collapse is not possible now, the edge leaves the queue. It
+	      comes back when something around it changes.
+	    */
+	    m_queued[e] = 0;
+
+	    const HalfEdge& h0 = m_mesh.GetHalfEdge(m_mesh.GetEdge(e).halfEdge);
+	    VertexHandle a = h0.vertex;
+	    VertexHandle b = m_mesh.GetHalfEdge(h0.twin).vertex;
+
+	    Quadric quadric = m_quadrics[a];
+	    quadric += m_quadrics[b];
+
+	    if(quadric.MeanError(glm::dvec3(m_targets[e])) > maxSquaredError)
+		continue;
+
+	    if(!m_mesh.CanCollapse(e) || !GoodCollapse(m_mesh, e, m_targets[e]))
+		continue;
+
+	    VertexHandle v = m_mesh.Collapse(e, m_targets[e]);
+	    m_quadrics[v] = quadric;
+	    ++numCollapses;
+
+	    /*
+	      The edges of v have a new quadric. They, and the other edges of the
+	      triangles around v, are put back in the queue if they left it.
+	    */
+	    for(HalfEdgeHandle h : m_mesh.Outgoing(v)) {
+		const HalfEdge& halfEdge = m_mesh.GetHalfEdge(h);
+		EdgeHandle edge = halfEdge.edge;
+		EdgeHandle opposite = m_mesh.GetHalfEdge(halfEdge.next).edge;
+
+		if(m_queued[edge])
+		    m_dirty[edge] = 1;
+		else if(Collapsible(edge))
+		    Push(edge);
+
+		if(!m_queued[opposite] && Collapsible(opposite))
+		    Push(opposite);
+	    }
+	}
+
+	return numCollapses;
+    }
+};
+
+int Decimate(HalfEdgeMesh& mesh, size_t maxFaces, float maxError, bool roughOrder, int numThreads) {
+
+    Decimator decimator(mesh, roughOrder, numThreads);
+    return decimator.Run(maxFaces, maxError);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "half_edge_mesh.hpp"
+
+#include <cfloat>
+
+/*
+  Simplification with quadric error metrics, like in
+
+  Garland and Heckbert, "Surface Simplification Using Quadric Error Metrics"
+
+  Every vertex has a quadric, that measures the sum of the squared distances
+  from a point to the planes of the triangles that were merged into the vertex.
+  The edges are collapsed roughly in the order of how much that sum grows, into
+  the point that minimizes it. Collapses that would make the mesh non-manifold, or
+  turn triangles around, are skipped. Edges on the boundary of the mesh are left
+  as they are.
+
+  It stops when the mesh has no more than maxFaces triangles. A collapse that
+  would move the merged vertex farther than about maxError from the planes of
+  its triangles, as the root of the mean squared distance, is not done. So a
+  budget is given with maxFaces, and a tolerance with maxError and maxFaces = 0.
+
+  roughOrder only compares the errors by their exponent, so errors within about
+  a factor of four count as the same, and those are collapsed in the order of
+  the edge handles instead. That is faster on large marching cubes meshes,
+  whose elements are in the order of the grid, for a somewhat worse result.
+
+  numThreads is only used for computing the quadrics at the start, 0 means one
+  per hardware thread. Returns the number of collapses.
+*/
+int Decimate(HalfEdgeMesh& mesh, size_t maxFaces, float maxError = FLT_MAX, bool roughOrder = false, int numThreads = 1);
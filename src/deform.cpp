@@ -4,6 +4,18 @@
 
 
 #include "half_edge_mesh.hpp"
+#include "dual.hpp"
+#include "vertex_grid.hpp"
+#include "remesh.hpp"
+#include "normals.hpp"
+#include "parallel.hpp"
+#include "sdf.hpp"
+
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <atomic>
+#include <queue>
 
 
 const float EPS = 0.0001;
@@ -28,8 +40,15 @@ void FindBasis(const glm::vec3& v, glm::vec3& u, glm::vec3& w) {
 
 }
 
+// f is written over dual numbers, so one evaluation gives the exact gradient.
 template <typename F>
-glm::vec3 Gradient(const F& f, const glm::vec3& p ) {
+auto GradientImpl(const F& f, const glm::vec3& p, int) -> decltype(f(DualVec3()).d) {
+    return f(DualVec3::Variable(p)).d;
+}
+
+// otherwise, approximate it with central differences.
+template <typename F>
+glm::vec3 GradientImpl(const F& f, const glm::vec3& p, long) {
     const float D = 1e-5;
     return glm::vec3(
 	(f(glm::vec3(p.x + D, p.y, p.z)) - f(glm::vec3(p.x - D, p.y, p.z))) / ( 2.0f * D ),
@@ -37,252 +56,966 @@ glm::vec3 Gradient(const F& f, const glm::vec3& p ) {
 	(f(glm::vec3(p.x, p.y, p.z + D)) - f(glm::vec3(p.x, p.y, p.z - D))) / ( 2.0f * D ));
 }
 
+/*
+  The gradient of f at p. f either takes a glm::vec3 and returns a float, or
+  takes a DualVec3 and returns a Dual.
+*/
+template <typename F>
+glm::vec3 Gradient(const F& f, const glm::vec3& p ) {
+    return GradientImpl(f, p, 0);
+}
+
 
 
-void SweepHelper(Mesh& mesh) {
-    float r_i = 0.2;
-    float r_o = 0.7;
+// the inner and outer radius of the sweep tool. Within the inner radius, the
+// surface is carried along with the tool, and out to the outer radius the effect falls off.
+const float SWEEP_INNER_RADIUS = 0.2;
+const float SWEEP_OUTER_RADIUS = 0.7;
+
+/*
+  The tool at one step of the sweep: its center c, the direction v it moves
+  in, the basis u and w around v, and how far it moves.
+*/
+struct SweepFrame {
+    // the time of the step, along the sweep curve.
+    float t;
+
+    glm::vec3 c;
+    glm::vec3 v;
+    glm::vec3 u;
+    glm::vec3 w;
+    float deltaLength;
+};
+
+// the sweep curve.
+static glm::vec3 SweepCurve(float t) {
 
     glm::vec3 startSweep(0.0f, 0.0f, 1.0f);
     glm::vec3   endSweep(0.0f, 0.0f, 3.5f);
 
-    // the sweep curve.
-    auto sweepCurve = [=](float t) {
-	return
+    return
 	(1.0f-t)*startSweep + t * endSweep
 
 //	glm::vec3(0.0f, -0.9f * t*t, 0.0f );
 
 //	glm::vec3(0.0f,0.5f,0.0f) * (float)sin(0.8f*2.0f*M_PI * t);
-	; };
+	;
+}
+
+// the length of the fixed steps of the sweep, in time along the sweep curve.
+const float SWEEP_STEP_LENGTH = 0.01;
 
+// the frames of the fixed steps of the sweep.
+static std::vector<SweepFrame> SweepFrames() {
 
-    const float STEP_LENGTH = 0.01;
+    std::vector<SweepFrame> frames;
 
-    for(float t = 0.0f; t <= 1.0; t+=STEP_LENGTH) {
+    for(float t = 0.0f; t <= 1.0; t+=SWEEP_STEP_LENGTH) {
 
-	float t2 = t+STEP_LENGTH;
+	float t2 = t+SWEEP_STEP_LENGTH;
 	float t1 = t;
 
-	glm::vec3 c = sweepCurve(t1);
+	SweepFrame frame;
 
-	glm::vec3 v = sweepCurve(t2) - sweepCurve(t1);
-	float deltaLength = glm::length(v);
-	v = glm::normalize(v);
+	frame.t = t1;
+	frame.c = SweepCurve(t1);
 
-	glm::vec3 u;
-	glm::vec3 w;
+	frame.v = SweepCurve(t2) - SweepCurve(t1);
+	frame.deltaLength = glm::length(frame.v);
+	frame.v = glm::normalize(frame.v);
+
+	FindBasis(frame.v, frame.u, frame.w);
+
+	frames.push_back(frame);
+    }
+
+    return frames;
+}
 
-	FindBasis(v, u, w);
+// the time where the last of the fixed steps of SweepFrames() ends.
+static float SweepEnd() {
+    const std::vector<SweepFrame> frames = SweepFrames();
+    return frames.back().t + SWEEP_STEP_LENGTH;
+}
 
-	auto e = [&](glm::vec3 x) { return glm::dot(u, x-c ); };
-	auto f = [&](glm::vec3 x) { return glm::dot(w, x-c ); };
+/*
+  The frames of numSteps equal steps, that sweep from 0 to SweepEnd(), the
+  same as the fixed steps of SweepFrames(), just shorter or longer.
+*/
+static std::vector<SweepFrame> SweepFrames(int numSteps) {
 
-	auto b = [=](float rx) {
-	    float a = (rx - r_i) / (r_o - r_i);
-	    return 3*a*a*a*a - 4*a*a*a + 1;
-	};
+    const float stepLength = SweepEnd() / numSteps;
 
+    std::vector<SweepFrame> frames;
 
-	auto p = [&](const glm::vec3& x) {
-	    float rx = glm::length(x - c);
+    for(int i = 0; i < numSteps; ++i) {
 
-	    if(rx < r_i) {
-		return e(x);
-	    }else if(rx >= r_i && rx <= r_o) {
-		return e(x) * b(rx);
-	    } else {
-		return 0.0f;
-	    }
-	};
+	float t1 = i * stepLength;
+	float t2 = t1 + stepLength;
 
-	auto q = [&](const glm::vec3& x) {
-	    float rx = glm::length(x - c);
+	SweepFrame frame;
 
-	    if(rx < r_i) {
-		return f(x);
-	    }else if(rx >= r_i && rx <= r_o) {
-		return f(x) * b(rx);
-	    } else {
-		return 0.0f;
-	    }
-	};
+	frame.t = t1;
+	frame.c = SweepCurve(t1);
 
-	for(glm::vec3& x : mesh.vertices) {
+	frame.v = SweepCurve(t2) - SweepCurve(t1);
+	frame.deltaLength = glm::length(frame.v);
+	frame.v = glm::normalize(frame.v);
 
-	    glm::vec3 grad_p = Gradient(p, x );
-	    glm::vec3 grad_q = Gradient(q, x );
+	FindBasis(frame.v, frame.u, frame.w);
 
-	    /*
-	      float rx = glm::length(x - c);
-	      float s = 1.0f;
-	      if(rx < r_i) {
+	frames.push_back(frame);
+    }
 
-	      s *= deltaLength;
-	      } else if(rx >= r_i && rx <= r_o) {
-	      s *= b(rx);
-	      } else {
-	      s *= 0.0f;
-	      }
+    return frames;
+}
 
-	      // deformation field.
-	      //glm::vec3 D = (glm::cross(div_e, div_f));
-	      glm::vec3 D = s * v;
-	    */
+/*
+  The frame of the tool at the time t, when the sweep is seen as a continuous
+  motion. Then deltaLength is the speed of the tool, so SweepDisplacement()
+  gives the velocity of a vertex, rather than how far it moves in a step.
+*/
+static SweepFrame SweepFrameAt(float t) {
 
-	    glm::vec3 D = deltaLength * glm::cross(grad_q, grad_p  );
+    const float H = 1e-2;
 
-	    x += D;
+    SweepFrame frame;
 
-	}
+    frame.t = t;
+    frame.c = SweepCurve(t);
 
+    frame.v = (SweepCurve(t + H) - SweepCurve(t - H)) / (2.0f * H);
+    frame.deltaLength = glm::length(frame.v);
+    frame.v = glm::normalize(frame.v);
 
-    }
+    FindBasis(frame.v, frame.u, frame.w);
 
+    return frame;
 }
 
+// how far the tool moves the vertex at x, in one step.
+static glm::vec3 SweepDisplacement(const SweepFrame& frame, const glm::vec3& x) {
 
-void Sweep(Mesh& mesh) {
+    const float r_i = SWEEP_INNER_RADIUS;
+    const float r_o = SWEEP_OUTER_RADIUS;
 
-//    SweepHelper(mesh);
+    const glm::vec3& c = frame.c;
+    const glm::vec3& u = frame.u;
+    const glm::vec3& w = frame.w;
 
-//    ComputeNormals(mesh);
+    // e, f and b are given with their gradients, so that p and q can be differentiated exactly.
+    auto e = [&](const DualVec3& x) { return Dot(u, x-c ); };
+    auto f = [&](const DualVec3& x) { return Dot(w, x-c ); };
 
-    printf("original vertices: %ld\n", mesh.vertices.size()  );
-    printf("original faces: %ld\n", mesh.faces.size()  );
+    auto b = [=](const Dual& rx) {
+	float a = (rx.v - r_i) / (r_o - r_i);
+	float db = (12*a*a*a - 12*a*a) / (r_o - r_i);
+	return Dual(3*a*a*a*a - 4*a*a*a + 1, db * rx.d);
+    };
 
-//    printf("original mesh\n"  );
-
-//    mesh.Print();
 
+    auto p = [&](const DualVec3& x) {
+	Dual rx = Length(x - c);
 
-    HalfEdgeMesh m(mesh);
+	if(rx.v < r_i) {
+	    return e(x);
+	}else if(rx.v >= r_i && rx.v <= r_o) {
+	    return e(x) * b(rx);
+	} else {
+	    return Dual(0.0f);
+	}
+    };
 
+    auto q = [&](const DualVec3& x) {
+	Dual rx = Length(x - c);
 
+	if(rx.v < r_i) {
+	    return f(x);
+	}else if(rx.v >= r_i && rx.v <= r_o) {
+	    return f(x) * b(rx);
+	} else {
+	    return Dual(0.0f);
+	}
+    };
 
+    glm::vec3 grad_p = Gradient(p, x );
+    glm::vec3 grad_q = Gradient(q, x );
 
     /*
-    for(auto it = m.beginEdges(); it != m.endEdges(); ++it) {
+      float rx = glm::length(x - c);
+      float s = 1.0f;
+      if(rx < r_i) {
+
+      s *= deltaLength;
+      } else if(rx >= r_i && rx <= r_o) {
+      s *= b(rx);
+      } else {
+      s *= 0.0f;
+      }
+
+      // deformation field.
+      //glm::vec3 D = (glm::cross(div_e, div_f));
+      glm::vec3 D = s * v;
+    */
 
-	glm::vec3 a;
-	glm::vec3 b;
+    return frame.deltaLength * glm::cross(grad_q, grad_p  );
+}
+
+#ifdef SDF_SIMD
+
+/*
+  Move SDF_WIDTH points, given as separate x, y and z lanes, through one step
+  of the sweep. This does the exact same float operations as
+  SweepDisplacement(), just for several points at once.
+*/
+static inline void SweepStepSimd(const SweepFrame& frame, SdfFloats& x, SdfFloats& y, SdfFloats& z) {
+
+    const float r_i = SWEEP_INNER_RADIUS;
+    const float r_o = SWEEP_OUTER_RADIUS;
+
+    SdfFloats dx = SdfSub(x, SdfSet(frame.c.x));
+    SdfFloats dy = SdfSub(y, SdfSet(frame.c.y));
+    SdfFloats dz = SdfSub(z, SdfSet(frame.c.z));
+
+    SdfFloats rx = SdfSqrt(SdfAdd(SdfAdd(SdfMul(dx, dx), SdfMul(dy, dy)), SdfMul(dz, dz)));
+
+    // the vertices that the tool reaches in this step.
+    SdfFloats active = SdfLessEqual(rx, SdfSet(r_o));
+    if(!SdfAny(active))
+	return;
+
+    SdfFloats inner = SdfLess(rx, SdfSet(r_i));
+
+    const glm::vec3& u = frame.u;
+    const glm::vec3& w = frame.w;
+
+    SdfFloats e = SdfAdd(SdfAdd(SdfMul(SdfSet(u.x), dx), SdfMul(SdfSet(u.y), dy)), SdfMul(SdfSet(u.z), dz));
+    SdfFloats f = SdfAdd(SdfAdd(SdfMul(SdfSet(w.x), dx), SdfMul(SdfSet(w.y), dy)), SdfMul(SdfSet(w.z), dz));
+
+    // the falloff b, and its derivative.
+    SdfFloats a = SdfDiv(SdfSub(rx, SdfSet(r_i)), SdfSet(r_o - r_i));
+    SdfFloats a2 = SdfMul(SdfMul(SdfSet(4.0f), a), a);
+    SdfFloats b = SdfAdd(
+	SdfSub(SdfMul(SdfMul(SdfMul(SdfMul(SdfSet(3.0f), a), a), a), a), SdfMul(a2, a)),
+	SdfSet(1.0f));
+    SdfFloats a12 = SdfMul(SdfMul(SdfSet(12.0f), a), a);
+    SdfFloats db = SdfDiv(SdfSub(SdfMul(a12, a), a12), SdfSet(r_o - r_i));
+
+    // the gradient of b(rx).
+    SdfFloats bdx = SdfMul(db, SdfDiv(dx, rx));
+    SdfFloats bdy = SdfMul(db, SdfDiv(dy, rx));
+    SdfFloats bdz = SdfMul(db, SdfDiv(dz, rx));
+
+    // the gradients of p and q.
+    SdfFloats gpx = SdfSelect(inner, SdfSet(u.x), SdfAdd(SdfMul(SdfSet(u.x), b), SdfMul(e, bdx)));
+    SdfFloats gpy = SdfSelect(inner, SdfSet(u.y), SdfAdd(SdfMul(SdfSet(u.y), b), SdfMul(e, bdy)));
+    SdfFloats gpz = SdfSelect(inner, SdfSet(u.z), SdfAdd(SdfMul(SdfSet(u.z), b), SdfMul(e, bdz)));
+
+    SdfFloats gqx = SdfSelect(inner, SdfSet(w.x), SdfAdd(SdfMul(SdfSet(w.x), b), SdfMul(f, bdx)));
+    SdfFloats gqy = SdfSelect(inner, SdfSet(w.y), SdfAdd(SdfMul(SdfSet(w.y), b), SdfMul(f, bdy)));
+    SdfFloats gqz = SdfSelect(inner, SdfSet(w.z), SdfAdd(SdfMul(SdfSet(w.z), b), SdfMul(f, bdz)));
+
+    // deltaLength * cross(grad_q, grad_p)
+    SdfFloats deltaLength = SdfSet(frame.deltaLength);
+    SdfFloats Dx = SdfMul(deltaLength, SdfSub(SdfMul(gqy, gpz), SdfMul(gpy, gqz)));
+    SdfFloats Dy = SdfMul(deltaLength, SdfSub(SdfMul(gqz, gpx), SdfMul(gpz, gqx)));
+    SdfFloats Dz = SdfMul(deltaLength, SdfSub(SdfMul(gqx, gpy), SdfMul(gpx, gqy)));
+
+    x = SdfSelect(active, SdfAdd(x, Dx), x);
+    y = SdfSelect(active, SdfAdd(y, Dy), y);
+    z = SdfSelect(active, SdfAdd(z, Dz), z);
+}
+
+#endif
+
+/*
+  Move the n points, given as separate x, y and z arrays, through the frames,
+  like calling SweepDisplacement() for every frame that reaches a point. They
+  are moved SDF_WIDTH at a time, straight from the arrays. A point gets the
+  same float operations whichever way it is moved, so the result does not
+  depend on how the points are split up.
+*/
+static void SweepSoA(
+    const SweepFrame* frames, size_t numFrames,
+    float* xs, float* ys, float* zs, size_t n) {
 
-	it->GetEdgePoints(a,b);
+    const float r_o = SWEEP_OUTER_RADIUS;
 
+    size_t i = 0;
 
-	printf("Edge: %s § %s \n", glm::to_string(a).c_str(), glm::to_string(b).c_str() );
+#ifdef SDF_SIMD
+    for(; i + SDF_WIDTH <= n; i += SDF_WIDTH) {
+
+	SdfFloats x = SdfLoad(xs + i);
+	SdfFloats y = SdfLoad(ys + i);
+	SdfFloats z = SdfLoad(zs + i);
+
+	for(size_t f = 0; f < numFrames; ++f) {
+	    SweepStepSimd(frames[f], x, y, z);
+	}
+
+	SdfStore(xs + i, x);
+	SdfStore(ys + i, y);
+	SdfStore(zs + i, z);
     }
+#endif
+
+    for(; i < n; ++i) {
+
+	glm::vec3 x(xs[i], ys[i], zs[i]);
+
+	for(size_t f = 0; f < numFrames; ++f) {
+
+	    // the tool doesn't reach the vertex in this step.
+	    if(glm::length(x - frames[f].c) > r_o)
+		continue;
+
+	    x += SweepDisplacement(frames[f], x);
+	}
+
+	xs[i] = x.x;
+	ys[i] = x.y;
+	zs[i] = x.z;
+    }
+}
+
+/*
+  The same, for one frame, and only for the n points indices of the arrays.
+  Those are loaded and stored SDF_WIDTH at a time, right where they are.
 */
+static void SweepSoAIndexed(
+    const SweepFrame& frame,
+    float* xs, float* ys, float* zs, const GLuint* indices, size_t n) {
+
+    size_t k = 0;
+
+#ifdef SDF_SIMD
+    for(; k + SDF_WIDTH <= n; k += SDF_WIDTH) {
 
-    printf("\n");
+	SdfFloats x = SdfGather(xs, indices + k);
+	SdfFloats y = SdfGather(ys, indices + k);
+	SdfFloats z = SdfGather(zs, indices + k);
 
-    printf("Original vertex size\n");
-    printf("Num Faces: %ld\n", m.NumFaces() );
-    printf("Num Vertices: %ld\n", m.NumVertices() );
-    printf("Num Half Edges: %ld\n", m.NumHalfEdges() );
-    printf("Num Edges: %ld\n", m.NumEdges() );
-    printf("\n");
+	SweepStepSimd(frame, x, y, z);
 
-    auto it = m.beginEdges();
+	// there is no scatter, so the lanes go out one at a time.
+	float lanes[3][SDF_WIDTH];
+	SdfStore(lanes[0], x);
+	SdfStore(lanes[1], y);
+	SdfStore(lanes[2], z);
 
-    for(int i = 0; i < 50; ++i) { // if 20, it hangs. but 50 works
-	++it;
+	for(int j = 0; j < SDF_WIDTH; ++j) {
+	    GLuint i = indices[k + j];
+	    xs[i] = lanes[0][j];
+	    ys[i] = lanes[1][j];
+	    zs[i] = lanes[2][j];
+	}
+    }
+#endif
+
+    for(; k < n; ++k) {
+	GLuint i = indices[k];
+	glm::vec3 x(xs[i], ys[i], zs[i]);
+
+	x += SweepDisplacement(frame, x);
+
+	xs[i] = x.x;
+	ys[i] = x.y;
+	zs[i] = x.z;
+    }
+}
+
+// the moved vertices of every block of vertices, one after the other.
+static std::vector<GLuint> JoinBlocks(const std::vector<std::vector<GLuint> >& blocks) {
+
+    std::vector<GLuint> moved;
+
+    for(const std::vector<GLuint>& block : blocks) {
+	moved.insert(moved.end(), block.begin(), block.end());
     }
-//    m.Flip(it);
-//    VertexIter v = m.Split(it);
-//    m.Split(v->halfEdge->edge);
 
+    return moved;
+}
 
-    VertexIter v  = m.Collapse(it);
-    v = m.Collapse(v->halfEdge->edge);
-//        m.Split(v->halfEdge->edge);
+std::vector<GLuint> SweepHelper(Mesh& mesh, SweepOrder order, int numThreads, int numSteps) {
 
-//        v = m.Collapse(v->halfEdge->edge);
+    const float r_o = SWEEP_OUTER_RADIUS;
 
+    const std::vector<SweepFrame> frames = numSteps > 0 ? SweepFrames(numSteps) : SweepFrames();
 
+    if(order == SWEEP_STEP_MAJOR) {
 
-    printf("Modified vertex size\n");
-    printf("Num Faces: %ld\n", m.NumFaces() );
-    printf("Num Vertices: %ld\n", m.NumVertices() );
-    printf("Num Half Edges: %ld\n", m.NumHalfEdges() );
-    printf("Num Edges: %ld\n", m.NumEdges() );
-    printf("\n");
+	// the vertices are kept as separate x, y and z arrays for the whole sweep.
+	const size_t numVertices = mesh.vertices.size();
+	std::vector<float> xs(numVertices);
+	std::vector<float> ys(numVertices);
+	std::vector<float> zs(numVertices);
 
+	for(size_t i = 0; i < numVertices; ++i) {
+	    xs[i] = mesh.vertices[i].x;
+	    ys[i] = mesh.vertices[i].y;
+	    zs[i] = mesh.vertices[i].z;
+	}
+
+	/*
+	  p and q are zero farther than r_o from the center of the tool, so the
+	  vertices out there don't move. So we put the vertices in a grid, and
+	  every step, only look at the ones in the cells around the tool.
+	*/
+	VertexGrid grid(r_o);
+	grid.Build(mesh.vertices);
+
+	std::vector<GLuint> nearVertices;
+
+	for(const SweepFrame& frame : frames) {
+
+	    nearVertices.clear();
+	    grid.Query(frame.c, r_o, nearVertices);
+
+	    ParallelForBlocks(0, nearVertices.size(), 1024, numThreads, [&](size_t begin, size_t end) {
+		    SweepSoAIndexed(frame, xs.data(), ys.data(), zs.data(), nearVertices.data() + begin, end - begin);
+		});
+
+	    for(GLuint i : nearVertices) {
+		grid.Move(i, glm::vec3(xs[i], ys[i], zs[i]));
+	    }
+	}
+
+	std::vector<GLuint> moved;
+
+	for(size_t i = 0; i < numVertices; ++i) {
+	    glm::vec3 x(xs[i], ys[i], zs[i]);
+
+	    if(x != mesh.vertices[i]) {
+		mesh.vertices[i] = x;
+		moved.push_back((GLuint)i);
+	    }
+	}
+
+	return moved;
+
+    } else {
+
+	/*
+	  A vertex outside of the box swept by the tool is never moved, so it stays
+	  outside of the box. So it can be skipped right away.
+	*/
+	glm::vec3 sweptMin(+FLT_MAX);
+	glm::vec3 sweptMax(-FLT_MAX);
+
+	for(const SweepFrame& frame : frames) {
+	    sweptMin = glm::min(sweptMin, frame.c - glm::vec3(r_o));
+	    sweptMax = glm::max(sweptMax, frame.c + glm::vec3(r_o));
+	}
+
+	/*
+	  One pass over blocks of the vertices, that each go through all the
+	  frames. The vertices don't depend on each other, so the result doesn't
+	  depend on the number of threads.
+	*/
+	const size_t BLOCK_SIZE = 4096;
+	std::vector<std::vector<GLuint> > movedBlocks((mesh.vertices.size() + BLOCK_SIZE - 1) / BLOCK_SIZE);
+
+	ParallelForBlocks(0, mesh.vertices.size(), BLOCK_SIZE, numThreads, [&](size_t begin, size_t end) {
+
+		// the vertices of the block inside of the swept box, as separate x, y and z arrays.
+		std::vector<GLuint> indices;
+		std::vector<float> xs;
+		std::vector<float> ys;
+		std::vector<float> zs;
+
+		for(size_t i = begin; i < end; ++i) {
+		    const glm::vec3& x = mesh.vertices[i];
+
+		    if(!glm::any(glm::lessThan(x, sweptMin)) && !glm::any(glm::greaterThan(x, sweptMax))) {
+			indices.push_back((GLuint)i);
+			xs.push_back(x.x);
+			ys.push_back(x.y);
+			zs.push_back(x.z);
+		    }
+		}
+
+		SweepSoA(frames.data(), frames.size(), xs.data(), ys.data(), zs.data(), indices.size());
+
+		std::vector<GLuint>& moved = movedBlocks[begin / BLOCK_SIZE];
+
+		for(size_t k = 0; k < indices.size(); ++k) {
+		    glm::vec3 x(xs[k], ys[k], zs[k]);
+
+		    if(x != mesh.vertices[indices[k]]) {
+			mesh.vertices[indices[k]] = x;
+			moved.push_back(indices[k]);
+		    }
+		}
+	    });
+
+	return JoinBlocks(movedBlocks);
+    }
+}
 
-    printf("COLLAPSED\n");
 /*
-    it = m.beginEdges();
-    for(int i = 0; i < 3; ++i) {
-	++it;
+  Like SweepHelper(), but the motion of every vertex is integrated with the
+  Dormand-Prince method, an embedded Runge-Kutta 4(5) pair, instead of with
+  fixed Euler steps.
+
+  Every vertex gets its own steps. The difference between the 4th and 5th order
+  solutions estimates the error of a step, and the step size is adapted to keep
+  it below tolerance(in world units). So where the curve is straight, and a vertex
+  is just carried along, the steps are long, and where the curve bends, or the
+  vertex is in the falloff of the tool, they get shorter.
+
+  The velocity is zero outside of the outer radius of the tool, and its
+  derivative jumps there, which the error estimate can't see. So the times where
+  a vertex enters and leaves the tool are events, that the steps land on:
+  outside of the tool the vertex stands still, so we skip right to where the
+  tool reaches it, and a step that would carry it out of the tool is shortened
+  to end about where it leaves.
+
+  The sweep ends where the last fixed step of SweepFrames() ends, which is a
+  step past t = 1, so that this integrates the exact same motion as
+  SweepHelper().
+*/
+std::vector<GLuint> SweepHelperAdaptive(Mesh& mesh, float tolerance, int numThreads, AdaptiveSweepStats* stats) {
+
+    const float r_o = SWEEP_OUTER_RADIUS;
+
+    if(!(tolerance > 0.0f)) {
+	return std::vector<GLuint>();
+    }
+
+    /*
+      A step is never shorter than this, and is taken even if it is not
+      accurate enough. Otherwise a tolerance below the round-off error of the
+      positions could shrink the steps until t stops moving.
+    */
+    const float MIN_STEP = 1e-5f;
+
+    // the Dormand-Prince coefficients.
+    static const float c[7] = { 0.0f, 1.0f/5.0f, 3.0f/10.0f, 4.0f/5.0f, 8.0f/9.0f, 1.0f, 1.0f };
+    static const float a[7][6] = {
+	{ 0.0f },
+	{ 1.0f/5.0f },
+	{ 3.0f/40.0f, 9.0f/40.0f },
+	{ 44.0f/45.0f, -56.0f/15.0f, 32.0f/9.0f },
+	{ 19372.0f/6561.0f, -25360.0f/2187.0f, 64448.0f/6561.0f, -212.0f/729.0f },
+	{ 9017.0f/3168.0f, -355.0f/33.0f, 46732.0f/5247.0f, 49.0f/176.0f, -5103.0f/18656.0f },
+	{ 35.0f/384.0f, 0.0f, 500.0f/1113.0f, 125.0f/192.0f, -2187.0f/6784.0f, 11.0f/84.0f },
+    };
+    // the difference between the weights of the 5th and 4th order solutions.
+    static const float e[7] = {
+	71.0f/57600.0f, 0.0f, -71.0f/16695.0f, 71.0f/1920.0f, -17253.0f/339200.0f, 22.0f/525.0f, -1.0f/40.0f };
+
+    // the box swept by the tool. A vertex outside of it never moves.
+    glm::vec3 sweptMin(+FLT_MAX);
+    glm::vec3 sweptMax(-FLT_MAX);
+
+    // the top speed of the tool, with some room for the finite differences of SweepFrameAt().
+    float maxSpeed = 0.0f;
+
+    const std::vector<SweepFrame> frames = SweepFrames();
+
+    for(const SweepFrame& frame : frames) {
+	sweptMin = glm::min(sweptMin, frame.c - glm::vec3(r_o));
+	sweptMax = glm::max(sweptMax, frame.c + glm::vec3(r_o));
+	maxSpeed = std::max(maxSpeed, 1.1f * SweepFrameAt(frame.t).deltaLength);
+    }
+
+    const float tEnd = SweepEnd();
+
+    std::atomic<long> totalSteps(0);
+    std::atomic<long> totalRejected(0);
+    std::atomic<long> totalVertices(0);
+
+    const size_t BLOCK_SIZE = 1024;
+    std::vector<std::vector<GLuint> > movedBlocks((mesh.vertices.size() + BLOCK_SIZE - 1) / BLOCK_SIZE);
+
+    ParallelForBlocks(0, mesh.vertices.size(), BLOCK_SIZE, numThreads, [&](size_t begin, size_t end) {
+
+	    long steps = 0;
+	    long rejected = 0;
+	    long vertices = 0;
+
+	    for(size_t i = begin; i < end; ++i) {
+
+		glm::vec3 x = mesh.vertices[i];
+
+		if(glm::any(glm::lessThan(x, sweptMin)) || glm::any(glm::greaterThan(x, sweptMax)))
+		    continue;
+
+		++vertices;
+
+		float t = 0.0f;
+		float h = tEnd;
+
+		while(t < tEnd) {
+
+		    /*
+		      Outside of the tool, the vertex stands still, and the tool can't
+		      get closer to it than maxSpeed times the time. So skip ahead by that
+		      much, until the tool reaches the vertex.
+		    */
+		    float g = glm::length(x - SweepCurve(t)) - r_o;
+		    if(g > 0.0f) {
+			t += std::max(g / maxSpeed, MIN_STEP);
+			continue;
+		    }
+
+		    // the vertex is in the tool, so integrate until it leaves.
+		    glm::vec3 k[7];
+		    k[0] = SweepDisplacement(SweepFrameAt(t), x);
+
+		    while(t < tEnd) {
+
+			h = std::max(h, MIN_STEP);
+
+			// the last step ends exactly at tEnd.
+			bool last = h >= tEnd - t;
+			if(last) {
+			    h = tEnd - t;
+			}
+
+			for(int s = 1; s < 7; ++s) {
+			    glm::vec3 xs = x;
+			    for(int j = 0; j < s; ++j) {
+				xs += (h * a[s][j]) * k[j];
+			    }
+			    k[s] = SweepDisplacement(SweepFrameAt(t + c[s] * h), xs);
+			}
+
+			// the 5th order solution is the last stage point.
+			glm::vec3 x5 = x;
+			glm::vec3 error(0.0f);
+			for(int j = 0; j < 7; ++j) {
+			    if(j < 6) {
+				x5 += (h * a[6][j]) * k[j];
+			    }
+			    error += (h * e[j]) * k[j];
+			}
+
+			float err = glm::length(error);
+			float scale = err > 0.0f ? 0.9f * powf(tolerance / err, 0.2f) : 5.0f;
+
+			if(err > tolerance && h > MIN_STEP) {
+			    h *= std::max(0.2f, scale);
+			    ++rejected;
+			    continue;
+			}
+
+			float tNext = last ? tEnd : t + h;
+
+			/*
+			  The step carries the vertex out of the tool. Unless it ends close
+			  enough to the outer radius, shorten it, so that it ends a bit past
+			  it, where g is about tolerance / 2. g is about linear over a short
+			  step, so that is where the secant of g goes through tolerance / 2.
+			*/
+			float gNext = glm::length(x5 - SweepCurve(tNext)) - r_o;
+			if(gNext > tolerance && h > MIN_STEP) {
+			    float g0 = glm::length(x - SweepCurve(t)) - r_o;
+			    float theta = (0.5f * tolerance - g0) / (gNext - g0);
+			    h *= std::min(0.9f, std::max(0.1f, theta));
+			    ++rejected;
+			    continue;
+			}
+
+			t = tNext;
+			x = x5;
+
+			// the last stage is the first stage of the next step.
+			k[0] = k[6];
+			++steps;
+
+			h *= std::min(5.0f, std::max(0.2f, scale));
+
+			// the vertex left the tool.
+			if(gNext > 0.0f)
+			    break;
+		    }
+		}
+
+		if(x != mesh.vertices[i]) {
+		    mesh.vertices[i] = x;
+		    movedBlocks[begin / BLOCK_SIZE].push_back((GLuint)i);
+		}
+	    }
+
+	    totalSteps += steps;
+	    totalRejected += rejected;
+	    totalVertices += vertices;
+	});
+
+    if(stats) {
+	stats->steps = totalSteps.load();
+	stats->rejectedSteps = totalRejected.load();
+	stats->vertices = totalVertices.load();
     }
-    m.Split(it);
+
+    return JoinBlocks(movedBlocks);
+}
+
+
+/*
+  Adaptive remeshing during the sweep.
+
+  The sweep stretches the triangles that the tool drags along, until they are
+  far too long to follow the surface. So after every step, the edges around the
+  tool are remeshed towards the target edge length L, with the same splits,
+  collapses and flips as IsotropicRemesh(). But only the edges inside of the
+  influence region of the tool are looked at, so the rest of the mesh keeps
+  whatever resolution it had.
 */
+struct SweepRemesher {
+
+    HalfEdgeMesh& mesh;
+    VertexGrid& grid;
 
+    float maxLength;
+    float minLength;
 
-    //m.Flip(it);
+    // the region of the current step.
+    glm::vec3 center;
+    float radius;
 
+    /*
+      The edges left to look at, by priority. The longest edges are split first,
+      and the shortest are collapsed first. Splitting in any other order can keep
+      cutting slivers off the side of a long edge, without ever splitting it.
+    */
+    std::priority_queue<std::pair<float, EdgeHandle> > queue;
 
-//    printf("modified vertices: %ld\n", m.vertices.size()  );
-//    printf("modified faces: %ld\n", m.faces.size()  );
+    // the priority of an edge is its length times this.
+    float order;
 
+    std::vector<GLuint> nearVertices;
 
+    SweepRemesher(HalfEdgeMesh& mesh, VertexGrid& grid, float edgeLength):
+	mesh(mesh), grid(grid),
+	maxLength(edgeLength * 4.0f / 3.0f), minLength(edgeLength * 4.0f / 5.0f) {}
 
-    for(auto it = m.beginFaces(); it != m.endFaces(); ++it) {
-	printf("Face edge count:%d \n", it->NumEdges() );
+    float Length(EdgeHandle e)const {
+	glm::vec3 a;
+	glm::vec3 b;
+	mesh.GetEdgePoints(e, a, b);
+	return glm::length(a - b);
     }
 
-    for(auto it = m.beginVertices(); it != m.endVertices(); ++it) {
-	printf("Vertex degree:%d \n", it->Degree() );
+    bool InRegion(EdgeHandle e)const {
+	glm::vec3 a;
+	glm::vec3 b;
+	mesh.GetEdgePoints(e, a, b);
+	return glm::length((a + b) * 0.5f - center) <= radius;
     }
 
+    // queue all the edges around the vertex.
+    void QueueEdges(VertexHandle v) {
+	for(HalfEdgeHandle h : mesh.Outgoing(v)) {
+	    EdgeHandle e = mesh.GetHalfEdge(h).edge;
+	    queue.push(std::make_pair(order * Length(e), e));
+	}
+    }
 
+    /*
+      Take the next edge off the queue. Returns false when the queue is empty.
+      The handles in the queue may have been removed, or reused, since they were queued.
+    */
+    bool NextEdge(EdgeHandle& e) {
+	while(!queue.empty()) {
+	    std::pair<float, EdgeHandle> top = queue.top();
+	    queue.pop();
+
+	    e = top.second;
+
+	    if(!mesh.GetEdge(e).Removed() && top.first == order * Length(e) && InRegion(e))
+		return true;
+	}
+	return false;
+    }
+
+    // queue all the inner edges of the region.
+    void QueueRegion(float priorityOrder) {
+	order = priorityOrder;
+
+	nearVertices.clear();
+	grid.Query(center, radius, nearVertices);
+
+	for(VertexHandle v : nearVertices) {
+	    if(glm::length(mesh.GetVertex(v).p - center) <= radius && !mesh.IsBoundary(v))
+		QueueEdges(v);
+	}
+    }
+
+    void Remesh(const glm::vec3& regionCenter, float regionRadius) {
+
+	center = regionCenter;
+	radius = regionRadius;
 
+	EdgeHandle e;
+
+	// split the long edges. The new edges are queued, until they are all short enough.
+	QueueRegion(+1.0f);
+
+	while(NextEdge(e)) {
+
+	    if(Length(e) <= maxLength || !mesh.CanSplit(e) || !LongestEdge(mesh, e))
+		continue;
+
+	    VertexHandle v = mesh.Split(e);
+	    grid.Add(v, mesh.GetVertex(v).p);
+	    QueueEdges(v);
+	}
+
+	// collapse the short edges.
+	QueueRegion(-1.0f);
+
+	while(NextEdge(e)) {
+
+	    if(Length(e) >= minLength || !mesh.CanCollapse(e) || !GoodCollapse(mesh, e, maxLength))
+		continue;
+
+	    // the vertex at the end of the edge is the one that is removed.
+	    VertexHandle removed = mesh.GetHalfEdge(mesh.GetHalfEdge(mesh.GetEdge(e).halfEdge).twin).vertex;
+	    grid.Remove(removed);
+
+	    VertexHandle v = mesh.Collapse(e);
+	    grid.Move(v, mesh.GetVertex(v).p);
+	    QueueEdges(v);
+	}
 
-    printf("CONVERT TO MESH:\n");
-    Mesh m2 = m.ToMesh();
-    printf("MADE TO MESH\n");
+	/*
+	  flip the edges that improve the degrees. Every flip makes the deviation
+	  strictly smaller, so this terminates.
+	*/
+	QueueRegion(0.0f);
 
+	while(NextEdge(e)) {
+
+	    if(!mesh.CanFlip(e) || FlipGain(mesh, e) == 0)
+		continue;
+
+	    // the vertices opposite to the edge get an edge more.
+	    const HalfEdge& h0 = mesh.GetHalfEdge(mesh.GetEdge(e).halfEdge);
+	    VertexHandle c = mesh.GetHalfEdge(mesh.GetHalfEdge(h0.next).next).vertex;
+	    VertexHandle d = mesh.GetHalfEdge(mesh.GetHalfEdge(mesh.GetHalfEdge(h0.twin).next).next).vertex;
+
+	    mesh.Flip(e);
+
+	    // the degrees around the quad changed, so its edges may want to flip now.
+	    QueueEdges(c);
+	    QueueEdges(d);
+	}
+    }
+};
 
 /*
-    printf("new vertices: %ld\n", m2.vertices.size()  );
-    printf("new faces: %ld\n\n", m2.faces.size()  );
+  Like the step-major SweepHelper(), but the mesh is remeshed around the tool
+  after every step. edgeLength is the target edge length of the remeshing.
+  The remeshing is serial, numThreads is only used for moving the vertices.
 */
+void SweepRemeshed(HalfEdgeMesh& mesh, float edgeLength, int numThreads) {
 
-//    m2.Print();
+    const float r_o = SWEEP_OUTER_RADIUS;
 
-    mesh = m2;
-    ComputeNormals(mesh);
+    VertexGrid grid(r_o);
 
+    for(VertexIter it = mesh.beginVertices(); it != mesh.endVertices(); ++it) {
+	grid.Add(*it, mesh.GetVertex(*it).p);
+    }
+
+    SweepRemesher remesher(mesh, grid, edgeLength);
 
     /*
+      The remesher adds, removes and moves vertices between the steps, so the
+      positions of the vertices near the tool are gathered anew every step.
+      The arrays are kept, so that they are only allocated once.
+    */
+    std::vector<GLuint> nearVertices;
+    std::vector<float> xs;
+    std::vector<float> ys;
+    std::vector<float> zs;
+
+    const std::vector<SweepFrame> frames = SweepFrames();
+
+    for(const SweepFrame& frame : frames) {
+
+	/*
+	  The vertices moved in this step are all within r_o of the tool, but
+	  their edges reach a bit farther than that. So remesh that region first,
+	  so that the tool has enough vertices to work with.
+	*/
+	remesher.Remesh(frame.c, r_o + edgeLength);
+
+	nearVertices.clear();
+	grid.Query(frame.c, r_o, nearVertices);
+
+	const size_t n = nearVertices.size();
+	xs.resize(n);
+	ys.resize(n);
+	zs.resize(n);
+
+	for(size_t k = 0; k < n; ++k) {
+	    const glm::vec3& p = mesh.GetVertex(nearVertices[k]).p;
+	    xs[k] = p.x;
+	    ys[k] = p.y;
+	    zs[k] = p.z;
+	}
+
+	ParallelForBlocks(0, n, 1024, numThreads, [&](size_t begin, size_t end) {
+		SweepSoA(&frame, 1, xs.data() + begin, ys.data() + begin, zs.data() + begin, end - begin);
+	    });
 
+	for(size_t k = 0; k < n; ++k) {
+	    glm::vec3 p(xs[k], ys[k], zs[k]);
+	    mesh.GetVertex(nearVertices[k]).p = p;
+	    grid.Move(nearVertices[k], p);
+	}
+    }
 
-      compute normals.
+    // the last step also stretched some edges.
+    remesher.Remesh(frames.back().c, r_o + edgeLength);
+}
 
-      for all edges, find this info: we need to have the indices of (c,d) for every triangle. (a,b) is already stored in edge ID.
-      we keep this in a hash named edgeJacadcenties.(we find this as follows: iterate over all faces, for every edge in that
-      face, we already have one of the opposite vertices, so add to pair! we do this for all faces).
 
+void Sweep(Mesh& mesh, const SweepOptions& options) {
 
-      iterate over all faces:
-      iterate over all edges, and add SORTED edge to stack(use set to make sure we process all edges only once)
+    if(options.edgeLength <= 0.0f) {
 
-      we keep a set of all added triangles.
+	std::vector<GLuint> moved = options.tolerance > 0.0f ?
+	    SweepHelperAdaptive(mesh, options.tolerance, options.numThreads) :
+	    SweepHelper(mesh, options.order, options.numThreads);
 
+	/*
+	  The faces stay as they are. So if the mesh already has the normals of
+	  ComputeNormals(), only those around the vertices that the tool moved have
+	  to be found again. The faces around the vertices are kept with the mesh,
+	  for the next sweep.
+	*/
+	if(mesh.normalsFromFaces && mesh.normals.size() == mesh.vertices.size()) {
+	    if(!mesh.vertexFaces || !mesh.vertexFaces->Matches(mesh)) {
+		mesh.vertexFaces = std::make_shared<VertexFaces>(mesh, options.numThreads);
+	    }
 
-      iterate until stack is empty:
-      pop edge e of stack.
-      if e should be split according to criterion
-      split it. so compute midpoint m from (a and b) and add to list.
-      now use midpoint to create four new triangles. use all of a,b,c,d to compute normal of m.
+	    UpdateNormals(mesh, *mesh.vertexFaces, moved, options.numThreads);
+	} else {
+	    ComputeNormals(mesh, options.numThreads);
+	}
+	return;
+    }
 
-      now add all four new edges. BUT WHEN WE SPLIT, ENSURE THAT edgeJacadcenties is properly updated.
+//    printf("original mesh\n"  );
+
+//    mesh.Print();
 
-      else
-      add both triangles(opposite to e), if necessary.
 
+    HalfEdgeMesh m(mesh, options.numThreads);
+
+    /*
+      The mesh doesn't have to be fine to begin with, the remeshing adds the
+      vertices where the tool needs them.
     */
+    SweepRemeshed(m, options.edgeLength, options.numThreads);
 
+    mesh = m.ToMesh();
+    ComputeNormals(mesh, options.numThreads);
 }
 
 /*
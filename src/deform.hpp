@@ -1,36 +1,66 @@
 #pragma once
 
-#include "gl_common.hpp"
+#include "mesh.hpp"
 
+/*
+  The order that SweepHelper() visits the steps and the vertices in. Every
+  vertex moves independently of all the others, so the result is the same.
+*/
+enum SweepOrder {
+    // for every step, move the vertices near the tool.
+    SWEEP_STEP_MAJOR,
 
+    // for every vertex, move it through all of the steps. That way the vertex is only
+    // read and written once, and the vertices can be done in parallel.
+    SWEEP_VERTEX_MAJOR
+};
 
-void Sweep(Mesh& mesh);
+/*
+  Move the vertices of the mesh with the sweep tool, in fixed steps along the
+  sweep curve. The faces are left as they are. 0 threads means one per
+  hardware thread. The result does not depend on the number of threads.
+  numSteps > 0 splits the sweep into that many equal steps instead of the
+  usual ones. Returns the vertices that were moved, in increasing order.
+*/
+std::vector<GLuint> SweepHelper(Mesh& mesh, SweepOrder order = SWEEP_VERTEX_MAJOR, int numThreads = 1, int numSteps = 0);
 
+struct AdaptiveSweepStats {
+    // the accepted steps, summed over all the vertices.
+    long steps = 0;
 
-inline void ComputeNormals(Mesh& mesh) {
-          for(size_t i = 0; i < mesh.vertices.size(); ++i) {
-      mesh.normals.push_back( glm::vec3(0.0f, 0.0f, 0.0f) );
-      }
+    // the steps that were too inaccurate, or went too far past the tool, and were taken again.
+    long rejectedSteps = 0;
 
-      // sum all adjacent face normals for the vertices.
-      for(size_t i = 0; i < mesh.faces.size(); i+=1) {
-	  glm::vec3 p0 = mesh.vertices[mesh.faces[i].i[0]];
-	  glm::vec3 p1 = mesh.vertices[mesh.faces[i].i[1]];
-	  glm::vec3 p2 = mesh.vertices[mesh.faces[i].i[2]];
+    // the vertices that were integrated, the ones in the box swept by the tool.
+    long vertices = 0;
+};
 
-	  glm::vec3 u = p2 - p0;
-	  glm::vec3 v = p1 - p0;
+/*
+  Like SweepHelper(), but every vertex is integrated with an adaptive
+  Runge-Kutta 4(5) method, to an error of about tolerance in world units per
+  step, instead of with fixed Euler steps. tolerance must be positive. Returns
+  the vertices that were moved, in increasing order, and fills in stats, if
+  there is one.
+*/
+std::vector<GLuint> SweepHelperAdaptive(Mesh& mesh, float tolerance, int numThreads = 1, AdaptiveSweepStats* stats = NULL);
 
-	  glm::vec3 fn = glm::normalize(glm::cross(u,v));
+struct SweepOptions {
+    /*
+      The target edge length of the remeshing around the tool, which adds the
+      vertices that the tool needs as it goes. The default is a quarter of the
+      falloff of the tool. 0 turns the remeshing off, and then the vertices are
+      only moved, with SweepHelper() or SweepHelperAdaptive().
+    */
+    float edgeLength = 0.125f;
 
+    // the order of SweepHelper(), when there is no remeshing.
+    SweepOrder order = SWEEP_VERTEX_MAJOR;
 
-      mesh.normals[mesh.faces[i].i[0]] += fn;
-      mesh.normals[mesh.faces[i].i[1]] += fn;
-      mesh.normals[mesh.faces[i].i[2]] += fn;
+    // when there is no remeshing, a tolerance > 0 moves the vertices with SweepHelperAdaptive() instead.
+    float tolerance = 0.0f;
 
-      }
+    int numThreads = 1;
+};
 
-      for(size_t i = 0; i < mesh.vertices.size(); ++i) {
-	  mesh.normals[i] = glm::normalize(mesh.normals[i]);
-      }
-}
+// deform the mesh with the sweep tool, and compute its normals.
+void Sweep(Mesh& mesh, const SweepOptions& options = SweepOptions());
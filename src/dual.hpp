@@ -0,0 +1,69 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+
+/*
+  Forward-mode automatic differentiation, for functions from 3D points to numbers.
+
+  A Dual is a number together with its gradient with respect to the point. If a
+  function is written over DualVec3 and Dual instead of glm::vec3 and float, then
+  evaluating it once gives both its value and its exact gradient, with no need
+  for finite differences.
+*/
+struct Dual {
+    float v; // the value.
+    glm::vec3 d; // the gradient of the value.
+
+    Dual() {}
+    Dual(float v): v(v), d(0.0f) {}
+    Dual(float v, const glm::vec3& d): v(v), d(d) {}
+};
+
+/*
+  A point that depends on the point we differentiate with respect to. d[i] is
+  the gradient of the component i.
+*/
+struct DualVec3 {
+    glm::vec3 v;
+    glm::mat3 d;
+
+    DualVec3() {}
+    DualVec3(const glm::vec3& v, const glm::mat3& d): v(v), d(d) {}
+
+    // the point that we differentiate with respect to.
+    static DualVec3 Variable(const glm::vec3& p) { return DualVec3(p, glm::mat3(1.0f)); }
+};
+
+inline Dual operator+(const Dual& a, const Dual& b) { return Dual(a.v + b.v, a.d + b.d); }
+inline Dual operator-(const Dual& a, const Dual& b) { return Dual(a.v - b.v, a.d - b.d); }
+inline Dual operator*(const Dual& a, const Dual& b) { return Dual(a.v * b.v, a.d * b.v + a.v * b.d); }
+inline Dual operator/(const Dual& a, const Dual& b) { return Dual(a.v / b.v, (a.d * b.v - a.v * b.d) / (b.v * b.v)); }
+inline Dual operator-(const Dual& a) { return Dual(-a.v, -a.d); }
+
+inline Dual operator+(const Dual& a, float b) { return Dual(a.v + b, a.d); }
+inline Dual operator-(const Dual& a, float b) { return Dual(a.v - b, a.d); }
+inline Dual operator*(const Dual& a, float b) { return Dual(a.v * b, a.d * b); }
+inline Dual operator/(const Dual& a, float b) { return Dual(a.v / b, a.d / b); }
+
+inline Dual operator+(float a, const Dual& b) { return b + a; }
+inline Dual operator-(float a, const Dual& b) { return Dual(a - b.v, -b.d); }
+inline Dual operator*(float a, const Dual& b) { return b * a; }
+
+inline Dual Sqrt(const Dual& a) {
+    float s = sqrtf(a.v);
+    return Dual(s, s > 0.0f ? a.d * (0.5f / s) : glm::vec3(0.0f));
+}
+
+inline DualVec3 operator+(const DualVec3& a, const glm::vec3& b) { return DualVec3(a.v + b, a.d); }
+inline DualVec3 operator-(const DualVec3& a, const glm::vec3& b) { return DualVec3(a.v - b, a.d); }
+
+inline Dual Dot(const glm::vec3& a, const DualVec3& b) {
+    return Dual(glm::dot(a, b.v), b.d * a);
+}
+
+inline Dual Length(const DualVec3& a) {
+    float l = glm::length(a.v);
+    return Dual(l, l > 0.0f ? a.d * (a.v / l) : glm::vec3(0.0f));
+}
@@ -3,9 +3,7 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
-#include <vector>
-
-#include "glm/gtx/string_cast.hpp"
+#include "mesh.hpp"
 
 typedef unsigned int uint;
 
@@ -33,45 +31,3 @@ inline void CheckOpenGLError(const char* stmt, const char* fname, int line)
 #else
     #define GL_C(stmt) stmt
 #endif
-
-struct Tri {
-
-public:
-    GLuint i[3];
-
-    Tri(GLuint i0, GLuint i1, GLuint i2):
-	i{i0,i1,i2}{
-    }
-
-    Tri() {}
-};
-
-struct Mesh {
-
-    std::vector<glm::vec3> vertices;
-    std::vector<glm::vec3> normals;
-    std::vector<Tri> faces;
-
-    GLuint indexVbo;
-    GLuint vertexVbo;
-    GLuint normalVbo;
-
-    void Print() {
-
-	for(const glm::vec3& v: vertices ) {
-	    printf("vertex: %s\n",  glm::to_string(v).c_str() );
-	}
-
-	printf("\n");
-	for(const glm::vec3& n: normals ) {
-	    printf("normals: %s\n",  glm::to_string(n).c_str() );
-	}
-
-	printf("\n");
-	for(Tri t: faces ) {
-	    printf("indices: %d, %d, %d\n",  t.i[0], t.i[1], t.i[2] );
-	}
-
-    }
-
-};
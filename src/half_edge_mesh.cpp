@@ -1,190 +1,233 @@
 #include "half_edge_mesh.hpp"
+#include "parallel.hpp"
 
-#include <map>
-#include <stack>
+#include <algorithm>
+#include <atomic>
 
-using std::pair;
-using std::map;
-using std::stack;
+// the number of items that a thread grabs at a time when building the mesh.
+const size_t BUILD_BLOCK_SIZE = 1 << 14;
 
-typedef pair<GLuint,GLuint> HalfEdgeId;
-typedef pair<GLuint,GLuint> EdgeId;
+/*
+  Replace every flag by the number of set flags before it, and return the total.
 
-inline EdgeId Sort(GLuint x, GLuint y) {
-    return x <= y ? EdgeId(x,y) : EdgeId(y,x);
+  This is how the mesh construction hands out handles: an element gets the
+  same handle that it would have gotten if the elements had been created one
+  at a time, by a serial pass over the flags.
+*/
+static GLuint ExclusiveScan(std::vector<GLuint>& flags, int numThreads) {
+    return ExclusiveScan(flags, BUILD_BLOCK_SIZE, numThreads);
 }
 
-struct pair_hash {
-    std::size_t operator () (const HalfEdgeId& p) const {
-        int h1 = p.first;
-        int h2 = p.second;
-
-        return h1 ^ h2;
-    }
-};
-
-HalfEdgeMesh::HalfEdgeMesh(const Mesh& mesh) {
-
-    map< pair<GLuint, GLuint>, HalfEdgeIter > addedHalfEdges;
-    map< pair<GLuint, GLuint>, EdgeIter > addedEdges;
-    map< GLuint, VertexIter > addedVertices;
-
-
-    /*
-      First iterate through all faces and create all faces and all half edges.
-
-     */
-    for(const Tri& tri : mesh.faces) {
-
-	FaceIter face = NewFace();
-	face->halfEdge = m_halfEdges.end(); // initial value.
+/*
+  The half-edge 3*f+i goes from corner i to corner i+1 of the face f, so the
+  faces and half-edges are known right away. What remains is to pair up the
+  twins, and to find the edges and vertices.
+
+  To pair the twins, every half-edge is put in a bucket by the smaller of its
+  two vertex indices. A bucket only holds about as many half-edges as the
+  degree of its vertex, so sorting it by the other vertex index is cheap, and
+  afterwards the two half-edges of every edge sit next to each other.
+
+  All the passes are linear, and run in parallel. The handles come out
+  exactly like they would if we walked through the faces in order, creating
+  every vertex and edge the first time we see it.
+*/
+HalfEdgeMesh::HalfEdgeMesh(const Mesh& mesh, int numThreads) {
 
-//	printf("Iterate tri: %d, %d, %d\n",  tri.i[0], tri.i[1], tri.i[2] );
+    const size_t numHalfEdges = 3 * mesh.faces.size();
+    const size_t numPoints = mesh.vertices.size();
 
-	//  Create half-edges and make sure that all half-edges gets assigned the face to the left of it.
-	for(int i = 0; i < 3; ++i) {
+    auto Origin = [&](size_t h) { return mesh.faces[h / 3].i[h % 3]; };
+    auto Target = [&](size_t h) { return mesh.faces[h / 3].i[(h % 3 + 1) % 3]; };
 
-	    GLuint u = tri.i[(i+0)%3];
-	    GLuint v = tri.i[(i+1)%3];
+    // count the half-edges in every bucket.
+    std::vector<std::atomic<GLuint> > bucketCursor(numPoints);
 
-	    HalfEdgeId halfEdgeId = HalfEdgeId(u, v);
-	    EdgeId     edgeId     = Sort(u, v);
+    ParallelForBlocks(0, numPoints, BUILD_BLOCK_SIZE, numThreads, [&](size_t begin, size_t end) {
+	    for(size_t u = begin; u < end; ++u) {
+		bucketCursor[u].store(0, std::memory_order_relaxed);
+	    }
+	});
 
-	    // sanity check.
-	    if(addedHalfEdges.count(halfEdgeId)>0) {
-		printf("SOMETHING IS RONG!!!\n");
-		exit(1);
+    ParallelForBlocks(0, numHalfEdges, BUILD_BLOCK_SIZE, numThreads, [&](size_t begin, size_t end) {
+	    for(size_t h = begin; h < end; ++h) {
+		bucketCursor[std::min(Origin(h), Target(h))].fetch_add(1, std::memory_order_relaxed);
 	    }
+	});
 
+    // the buckets are stored back to back, bucket u is [bucketStart[u], bucketStart[u+1]).
+    std::vector<GLuint> bucketStart(numPoints + 1, 0);
+    for(size_t u = 0; u < numPoints; ++u) {
+	bucketStart[u] = bucketCursor[u].load(std::memory_order_relaxed);
+    }
+    ExclusiveScan(bucketStart, numThreads);
 
+    std::vector<GLuint> buckets(numHalfEdges);
 
+    ParallelForBlocks(0, numPoints, BUILD_BLOCK_SIZE, numThreads, [&](size_t begin, size_t end) {
+	    for(size_t u = begin; u < end; ++u) {
+		bucketCursor[u].store(bucketStart[u], std::memory_order_relaxed);
+	    }
+	});
 
-	    HalfEdgeIter halfEdge =
-		NewHalfEdge();
+    ParallelForBlocks(0, numHalfEdges, BUILD_BLOCK_SIZE, numThreads, [&](size_t begin, size_t end) {
+	    for(size_t h = begin; h < end; ++h) {
+		GLuint u = std::min(Origin(h), Target(h));
+		buckets[bucketCursor[u].fetch_add(1, std::memory_order_relaxed)] = (GLuint)h;
+	    }
+	});
 
+    // now pair up the twins.
+    std::vector<HalfEdgeHandle> twins(numHalfEdges);
+    std::atomic<bool> nonManifold(false);
 
-	    EdgeIter edge;
-	    if(addedEdges.count(edgeId) == 0) {
-		// create edge on the fly:
-		edge = NewEdge();
-		addedEdges[edgeId] = edge;
-		edge->halfEdge = halfEdge;
-	    } else {
-		edge = addedEdges[edgeId];
-	    }
+    ParallelForBlocks(0, numPoints, BUILD_BLOCK_SIZE, numThreads, [&](size_t begin, size_t end) {
+	    for(size_t u = begin; u < end; ++u) {
 
+		GLuint* first = buckets.data() + bucketStart[u];
+		GLuint* last = buckets.data() + bucketStart[u+1];
 
+		auto Other = [&](GLuint h) { return std::max(Origin(h), Target(h)); };
 
+		std::sort(first, last, [&](GLuint a, GLuint b) {
+			return Other(a) != Other(b) ? Other(a) < Other(b) : a < b;
+		    });
 
-	    if(addedVertices.count(u) == 0) {
-		// create vertex.
-		glm::vec3 p = mesh.vertices[u];
+		for(GLuint* group = first; group != last; ) {
 
-		VertexIter vertex = NewVertex();
-		vertex->p = p;
+		    GLuint* groupEnd = group + 1;
+		    while(groupEnd != last && Other(*groupEnd) == Other(*group)) {
+			++groupEnd;
+		    }
 
-		addedVertices[u] = vertex;
-		vertex->halfEdge = halfEdge;
-	    }
+		    if(groupEnd - group > 2 || (groupEnd - group == 2 && Origin(group[0]) == Origin(group[1]))) {
+			nonManifold = true;
+		    }
 
-	    addedHalfEdges[halfEdgeId] = halfEdge;
-	    halfEdge->face = face;
-	    halfEdge->edge = edge;
+		    for(GLuint* h = group; h != groupEnd; ++h) {
+			twins[*h] = INVALID_HANDLE;
+		    }
 
-	    if(i == 0) {
+		    if(groupEnd - group == 2) {
+			twins[group[0]] = group[1];
+			twins[group[1]] = group[0];
+		    }
 
-		if(face->halfEdge != m_halfEdges.end() ) {
-		    printf("face->edge is not null!\n");
-		    exit(1);
+		    group = groupEnd;
 		}
-
-		face->halfEdge = halfEdge;
 	    }
-	}
-
-//	printf("num half edges: %d\n", edges.size() );
-
-
-	// make sure that every half-edge points to the next half-edge around the face.
-	// also, each half-edge should point to its twin.
-	for(int i = 0; i < 3; ++i) {
-
-	    HalfEdgeId idCur = HalfEdgeId(
-		tri.i[(i+0)%3],
-		tri.i[(i+1)%3]);
+	});
 
-	    HalfEdgeId idNext = HalfEdgeId(
-		tri.i[(i+1)%3],
-		tri.i[(i+2)%3]);
+    if(nonManifold) {
+	printf("HalfEdgeMesh: an edge is shared by more than two faces, or by two faces with opposite orientation\n");
+	exit(1);
+    }
 
-	    /*printf("idCur: %d, %d\n",  idCur.first, idCur.second );
-	    printf("idNext: %d, %d\n",  idNext.first, idNext.second );
+    Link(mesh.vertices, mesh.faces, twins, numThreads);
+}
 
-*/
-	    if(addedHalfEdges.count(idCur) == 0 || addedHalfEdges.count(idNext) == 0) {
-		printf("RRRRRONGGGGG!\n");
-		exit(1);
-	    }
+HalfEdgeMesh::HalfEdgeMesh(
+    const std::vector<glm::vec3>& vertices,
+    const std::vector<Tri>& faces,
+    const std::vector<HalfEdgeHandle>& twins,
+    int numThreads) {
 
+    Link(vertices, faces, twins, numThreads);
+}
 
-	    addedHalfEdges[idCur]->next = addedHalfEdges[idNext];
+void HalfEdgeMesh::Link(
+    const std::vector<glm::vec3>& vertices,
+    const std::vector<Tri>& faces,
+    const std::vector<HalfEdgeHandle>& twins,
+    int numThreads) {
 
-	    // add vertex located at the root of the half-edge
-	    addedHalfEdges[idCur]->vertex = addedVertices[idCur.first];
+    const size_t numHalfEdges = 3 * faces.size();
+    const size_t numPoints = vertices.size();
 
+    auto Origin = [&](size_t h) { return faces[h / 3].i[h % 3]; };
 
-	    HalfEdgeId idCurTwin = HalfEdgeId(
-		idCur.second,
-		idCur.first);
+    // for every mesh vertex, find the first half-edge going out from it.
+    std::vector<std::atomic<GLuint> > firstOut(numPoints);
 
-	    if(addedHalfEdges.count(idCurTwin)>0) {
+    ParallelForBlocks(0, numPoints, BUILD_BLOCK_SIZE, numThreads, [&](size_t begin, size_t end) {
+	    for(size_t u = begin; u < end; ++u) {
+		firstOut[u].store(INVALID_HANDLE, std::memory_order_relaxed);
+	    }
+	});
 
-		addedHalfEdges[idCurTwin]->twin = addedHalfEdges[idCur];
-		addedHalfEdges[idCur    ]->twin = addedHalfEdges[idCurTwin];
+    ParallelForBlocks(0, numHalfEdges, BUILD_BLOCK_SIZE, numThreads, [&](size_t begin, size_t end) {
+	    for(size_t h = begin; h < end; ++h) {
+		std::atomic<GLuint>& first = firstOut[Origin(h)];
 
+		GLuint current = first.load(std::memory_order_relaxed);
+		while(h < current && !first.compare_exchange_weak(current, (GLuint)h, std::memory_order_relaxed)) {
+		}
 	    }
+	});
 
+    // the edge of a half-edge is created by whichever of it and its twin comes first.
+    auto EdgeFirst = [&](size_t h) { return twins[h] < h ? twins[h] : (GLuint)h; };
 
-	}
-
-    }
+    /*
+      Hand out the edge and vertex handles, in the order of the half-edges
+      that create them.
+    */
+    std::vector<GLuint> edgeIndex(numHalfEdges);
+    std::vector<GLuint> vertexIndex(numHalfEdges);
 
-    printf("Faces: %ld\n", m_faces.size() );
-    printf("HalfEdges: %ld\n", m_halfEdges.size() );
-    printf("Vertices: %ld\n", m_vertices.size() );
-    printf("Edges: %ld\n", m_edges.size() );
+    ParallelForBlocks(0, numHalfEdges, BUILD_BLOCK_SIZE, numThreads, [&](size_t begin, size_t end) {
+	    for(size_t h = begin; h < end; ++h) {
+		edgeIndex[h] = EdgeFirst(h) == h;
+		vertexIndex[h] = firstOut[Origin(h)].load(std::memory_order_relaxed) == h;
+	    }
+	});
 
-}
+    m_halfEdges.resize(numHalfEdges);
+    m_edges.resize(ExclusiveScan(edgeIndex, numThreads));
+    m_vertices.resize(ExclusiveScan(vertexIndex, numThreads));
+    m_faces.resize(faces.size());
 
-int Face::NumEdges()const {
-    int numEdges = 0;
+    /*
+      Finally, link everything together.
+    */
+    ParallelForBlocks(0, numHalfEdges, BUILD_BLOCK_SIZE, numThreads, [&](size_t h0, size_t h1) {
+	    for(size_t h = h0; h < h1; ++h) {
 
-    HalfEdgeIter h = this->halfEdge;
-    HalfEdgeIter start = h;
+		GLuint u = Origin(h);
+		GLuint vertexFirst = firstOut[u].load(std::memory_order_relaxed);
 
-    do {
+		HalfEdge& halfEdge = m_halfEdges[h];
+		halfEdge.twin = twins[h];
+		halfEdge.next = (GLuint)(3 * (h / 3) + (h % 3 + 1) % 3);
+		halfEdge.face = (GLuint)(h / 3);
+		halfEdge.edge = edgeIndex[EdgeFirst(h)];
+		halfEdge.vertex = vertexIndex[vertexFirst];
 
-	h = h->next;
-	++numEdges;
+		if(EdgeFirst(h) == h) {
+		    m_edges[halfEdge.edge].halfEdge = (GLuint)h;
+		}
 
-    } while(h != start);
+		if(vertexFirst == h) {
+		    Vertex& vertex = m_vertices[halfEdge.vertex];
+		    vertex.p = vertices[u];
+		    vertex.halfEdge = (GLuint)h;
+		}
 
-    return numEdges;
+		if(h % 3 == 0) {
+		    m_faces[h / 3].halfEdge = (GLuint)h;
+		}
+	    }
+	});
 }
 
-int Vertex::Degree()const {
-
-    HalfEdgeCIter halfEdge = this->halfEdge;
-    int degree = 0;
-
-    do {
-
-	halfEdge = halfEdge->twin->next;
-	++degree;
-
-    }while(halfEdge != this->halfEdge);
+int HalfEdgeMesh::NumEdges(FaceHandle f)const {
+    CirculatorRange<FaceHalfEdgeCirculator> halfEdges = FaceHalfEdges(f);
+    return (int)std::distance(halfEdges.begin(), halfEdges.end());
+}
 
-    return degree;
+int HalfEdgeMesh::Degree(VertexHandle v)const {
+    CirculatorRange<OutgoingCirculator> outgoing = Outgoing(v);
+    return (int)std::distance(outgoing.begin(), outgoing.end());
 }
 
 
@@ -192,27 +235,23 @@ Mesh HalfEdgeMesh::ToMesh()const {
 
     Mesh mesh;
 
-    map< VertexCIter, GLuint > verticesMap;
+    // the index of every vertex in the mesh, by handle.
+    std::vector<GLuint> verticesMap(m_vertices.size(), INVALID_HANDLE);
 
     GLuint index = 0;
-    for(VertexCIter it = beginVertices(); it != endVertices(); ++it) {
-	mesh.vertices.push_back(it->p);
-	verticesMap[it] = index++;
+    for(VertexIter it = beginVertices(); it != endVertices(); ++it) {
+	mesh.vertices.push_back(m_vertices[*it].p);
+	verticesMap[*it] = index++;
     }
 
-    for(FaceCIter it = beginFaces(); it != endFaces(); ++it) {
-
-	HalfEdgeIter halfEdge = it->halfEdge;
+    for(FaceIter it = beginFaces(); it != endFaces(); ++it) {
 
 	Tri tri;
 	GLuint i = 0;
 
-	do {
-
-	    tri.i[i++] = verticesMap[halfEdge->vertex];
-	    halfEdge = halfEdge->next;
-
-	} while(halfEdge != it->halfEdge);
+	for(HalfEdgeHandle halfEdge : FaceHalfEdges(*it)) {
+	    tri.i[i++] = verticesMap[m_halfEdges[halfEdge].vertex];
+	}
 
 	mesh.faces.push_back(tri);
 
@@ -221,404 +260,336 @@ Mesh HalfEdgeMesh::ToMesh()const {
     return mesh;
 }
 
-void Edge::GetEdgePoints(glm::vec3& a, glm::vec3& b) {
-    a = halfEdge->vertex->p;
-    b = halfEdge->twin->vertex->p;
+void HalfEdgeMesh::GetEdgePoints(EdgeHandle e, glm::vec3& a, glm::vec3& b)const {
+    const HalfEdge& halfEdge = m_halfEdges[m_edges[e].halfEdge];
+
+    a = m_vertices[halfEdge.vertex].p;
+    b = m_vertices[m_halfEdges[halfEdge.next].vertex].p; // also works on the boundary, where there is no twin.
 }
 
 
-void HalfEdgeMesh::Flip(EdgeIter e0) {
+void HalfEdgeMesh::Flip(EdgeHandle e0) {
 
     // HALF EDGES
-    HalfEdgeIter h0 = e0->halfEdge;
-    HalfEdgeIter h1 = h0->next;
-    HalfEdgeIter h2 = h1->next;
+    HalfEdgeHandle h0 = m_edges[e0].halfEdge;
+    HalfEdgeHandle h1 = m_halfEdges[h0].next;
+    HalfEdgeHandle h2 = m_halfEdges[h1].next;
 
-    HalfEdgeIter h3 = h0->twin;
-    HalfEdgeIter h4 = h3->next;
-    HalfEdgeIter h5 = h4->next;
+    HalfEdgeHandle h3 = m_halfEdges[h0].twin;
+    HalfEdgeHandle h4 = m_halfEdges[h3].next;
+    HalfEdgeHandle h5 = m_halfEdges[h4].next;
 
-    HalfEdgeIter h6 = h1->twin;
-    HalfEdgeIter h7 = h2->twin;
-    HalfEdgeIter h8 = h4->twin;
-    HalfEdgeIter h9 = h5->twin;
+    HalfEdgeHandle h6 = m_halfEdges[h1].twin;
+    HalfEdgeHandle h7 = m_halfEdges[h2].twin;
+    HalfEdgeHandle h8 = m_halfEdges[h4].twin;
+    HalfEdgeHandle h9 = m_halfEdges[h5].twin;
 
     // VERTICES
-    VertexIter v0 = h3->vertex;
-    VertexIter v1 = h0->vertex;
-    VertexIter v2 = h6->vertex;
-    VertexIter v3 = h8->vertex;
+    VertexHandle v0 = m_halfEdges[h3].vertex;
+    VertexHandle v1 = m_halfEdges[h0].vertex;
+    VertexHandle v2 = m_halfEdges[h6].vertex;
+    VertexHandle v3 = m_halfEdges[h8].vertex;
 
     // EDGES
-    EdgeIter e1 = h2->edge;
-    EdgeIter e2 = h1->edge;
-    EdgeIter e3 = h5->edge;
-    EdgeIter e4 = h4->edge;
+    EdgeHandle e1 = m_halfEdges[h2].edge;
+    EdgeHandle e2 = m_halfEdges[h1].edge;
+    EdgeHandle e3 = m_halfEdges[h5].edge;
+    EdgeHandle e4 = m_halfEdges[h4].edge;
 
     // FACES
-    FaceIter f0 = h0->face;
-    FaceIter f1 = h3->face;
+    FaceHandle f0 = m_halfEdges[h0].face;
+    FaceHandle f1 = m_halfEdges[h3].face;
 
 
     // Update HALF-EDGES
+    //          half-edge  next  twin  vertex  edge  face
+
+    SetHalfEdge(h0,        h1,   h3,   v2,     e0,   f0);
+    SetHalfEdge(h1,        h2,   h9,   v3,     e3,   f0);
+    SetHalfEdge(h2,        h0,   h6,   v0,     e2,   f0);
+    SetHalfEdge(h3,        h4,   h0,   v3,     e0,   f1);
+    SetHalfEdge(h4,        h5,   h7,   v2,     e1,   f1);
+    SetHalfEdge(h5,        h3,   h8,   v1,     e4,   f1);
 
-    h0->next = h1;
-    h0->twin = h3;
-    h0->vertex = v2;
-    h0->edge = e0;
-    h0->face = f0;
-
-    h1->next = h2;
-    h1->twin = h9;
-    h1->vertex = v3;
-    h1->edge = e3;
-    h1->face = f0;
-
-    h2->next = h0;
-    h2->twin = h6;
-    h2->vertex = v0;
-    h2->edge = e2;
-    h2->face = f0;
-
-    h3->next = h4;
-    h3->twin = h0;
-    h3->vertex = v3;
-    h3->edge = e0;
-    h3->face = f1;
-
-    h4->next = h5;
-    h4->twin = h7;
-    h4->vertex = v2;
-    h4->edge = e1;
-    h4->face = f1;
-
-    h5->next = h3;
-    h5->twin = h8;
-    h5->vertex = v1;
-    h5->edge = e4;
-    h5->face = f1;
-
-
-    h6->next = h6->next;
-    h6->twin = h2;
-    h6->vertex = v2;
-    h6->edge = e2;
-    h6->face = h6->face;
-
-
-    // now do outer half-edges.
-    h7->next = h7->next;
-    h7->twin = h4;
-    h7->vertex = v1;
-    h7->edge = e1;
-    h7->face = h7->face;
-
-
-    h8->next = h8->next;
-    h8->twin = h5;
-    h8->vertex = v3;
-    h8->edge = e4;
-    h8->face = h8->face;
-
-    h9->next = h9->next;
-    h9->twin = h1;
-    h9->vertex = v0;
-    h9->edge = e3;
-    h9->face = h9->face;
+
+    // now do outer half-edges. Their next and face stay the same.
+    SetHalfEdge(h6, m_halfEdges[h6].next, h2, v2, e2, m_halfEdges[h6].face);
+    SetHalfEdge(h7, m_halfEdges[h7].next, h4, v1, e1, m_halfEdges[h7].face);
+    SetHalfEdge(h8, m_halfEdges[h8].next, h5, v3, e4, m_halfEdges[h8].face);
+    SetHalfEdge(h9, m_halfEdges[h9].next, h1, v0, e3, m_halfEdges[h9].face);
 
     // VERTICES.
-    v0->halfEdge = h2;
-    v1->halfEdge = h5;
-    v2->halfEdge = h4;
-    v3->halfEdge = h1;
+    m_vertices[v0].halfEdge = h2;
+    m_vertices[v1].halfEdge = h5;
+    m_vertices[v2].halfEdge = h4;
+    m_vertices[v3].halfEdge = h1;
 
     // EDGES
-    e0->halfEdge = h3;
-    e1->halfEdge = h4;
-    e2->halfEdge = h2;
-    e3->halfEdge = h1;
-    e4->halfEdge = h5;
+    m_edges[e0].halfEdge = h3;
+    m_edges[e1].halfEdge = h4;
+    m_edges[e2].halfEdge = h2;
+    m_edges[e3].halfEdge = h1;
+    m_edges[e4].halfEdge = h5;
 
     // FACES
 
-    f0->halfEdge = h0;
-    f1->halfEdge = h3;
+    m_faces[f0].halfEdge = h0;
+    m_faces[f1].halfEdge = h3;
 
 
 
 
     /*
-    printf("v0 %s\n", v0->ToString().c_str() );
-    printf("v1 %s\n", v1->ToString().c_str() );
-    printf("v2 %s\n", v2->ToString().c_str() );
-    printf("v3 %s\n", v3->ToString().c_str() );
+    printf("v0 %s\n", m_vertices[v0].ToString().c_str() );
+    printf("v1 %s\n", m_vertices[v1].ToString().c_str() );
+    printf("v2 %s\n", m_vertices[v2].ToString().c_str() );
+    printf("v3 %s\n", m_vertices[v3].ToString().c_str() );
 */
 }
 
-VertexIter HalfEdgeMesh::Split(EdgeIter e0) {
+VertexHandle HalfEdgeMesh::Split(EdgeHandle e0) {
+
+    HalfEdgeHandle newHalfEdges[6];
+    for(HalfEdgeHandle& h : newHalfEdges) {
+	h = NewHalfEdge();
+    }
+
+    VertexHandle v4 = NewVertex();
+
+    EdgeHandle newEdges[3];
+    for(EdgeHandle& e : newEdges) {
+	e = NewEdge();
+    }
+
+    FaceHandle newFaces[2];
+    for(FaceHandle& f : newFaces) {
+	f = NewFace();
+    }
+
+    return SplitWith(e0, newHalfEdges, v4, newEdges, newFaces);
+}
+
+void HalfEdgeMesh::ReserveSplits(size_t n) {
+
+    m_reservedHalfEdges = (GLuint)m_halfEdges.size();
+    m_reservedVertices = (GLuint)m_vertices.size();
+    m_reservedEdges = (GLuint)m_edges.size();
+    m_reservedFaces = (GLuint)m_faces.size();
+
+    m_halfEdges.resize(m_halfEdges.size() + 6 * n);
+    m_vertices.resize(m_vertices.size() + n);
+    m_edges.resize(m_edges.size() + 3 * n);
+    m_faces.resize(m_faces.size() + 2 * n);
+}
+
+VertexHandle HalfEdgeMesh::SplitReserved(EdgeHandle e0, size_t i) {
+
+    HalfEdgeHandle newHalfEdges[6];
+    for(GLuint j = 0; j < 6; ++j) {
+	newHalfEdges[j] = m_reservedHalfEdges + 6 * (GLuint)i + j;
+    }
+
+    EdgeHandle newEdges[3];
+    for(GLuint j = 0; j < 3; ++j) {
+	newEdges[j] = m_reservedEdges + 3 * (GLuint)i + j;
+    }
+
+    FaceHandle newFaces[2];
+    for(GLuint j = 0; j < 2; ++j) {
+	newFaces[j] = m_reservedFaces + 2 * (GLuint)i + j;
+    }
+
+    return SplitWith(e0, newHalfEdges, m_reservedVertices + (GLuint)i, newEdges, newFaces);
+}
+
+VertexHandle HalfEdgeMesh::SplitWith(
+    EdgeHandle e0,
+    const HalfEdgeHandle* newHalfEdges, VertexHandle v4,
+    const EdgeHandle* newEdges, const FaceHandle* newFaces) {
 
     // FIRST WE COLLECT INFO
 
     // HALF EDGES
-    HalfEdgeIter h0 = e0->halfEdge;
-    HalfEdgeIter h1 = h0->next;
-    HalfEdgeIter h2 = h1->next;
+    HalfEdgeHandle h0 = m_edges[e0].halfEdge;
+    HalfEdgeHandle h1 = m_halfEdges[h0].next;
+    HalfEdgeHandle h2 = m_halfEdges[h1].next;
 
-    HalfEdgeIter h3 = h0->twin;
-    HalfEdgeIter h4 = h3->next;
-    HalfEdgeIter h5 = h4->next;
+    HalfEdgeHandle h3 = m_halfEdges[h0].twin;
+    HalfEdgeHandle h4 = m_halfEdges[h3].next;
+    HalfEdgeHandle h5 = m_halfEdges[h4].next;
 
-    HalfEdgeIter h6 = h1->twin;
-    HalfEdgeIter h7 = h2->twin;
-    HalfEdgeIter h8 = h4->twin;
-    HalfEdgeIter h9 = h5->twin;
+    HalfEdgeHandle h6 = m_halfEdges[h1].twin;
+    HalfEdgeHandle h7 = m_halfEdges[h2].twin;
+    HalfEdgeHandle h8 = m_halfEdges[h4].twin;
+    HalfEdgeHandle h9 = m_halfEdges[h5].twin;
 
     // VERTICES
-    VertexIter v0 = h3->vertex;
-    VertexIter v1 = h0->vertex;
-    VertexIter v2 = h6->vertex;
-    VertexIter v3 = h8->vertex;
+    VertexHandle v0 = m_halfEdges[h3].vertex;
+    VertexHandle v1 = m_halfEdges[h0].vertex;
+    VertexHandle v2 = m_halfEdges[h6].vertex;
+    VertexHandle v3 = m_halfEdges[h8].vertex;
 
     // EDGES
-    EdgeIter e1 = h2->edge;
-    EdgeIter e2 = h1->edge;
-    EdgeIter e3 = h5->edge;
-    EdgeIter e4 = h4->edge;
+    EdgeHandle e1 = m_halfEdges[h2].edge;
+    EdgeHandle e2 = m_halfEdges[h1].edge;
+    EdgeHandle e3 = m_halfEdges[h5].edge;
+    EdgeHandle e4 = m_halfEdges[h4].edge;
 
     // FACES
-    FaceIter f0 = h0->face;
-    FaceIter f1 = h3->face;
+    FaceHandle f0 = m_halfEdges[h0].face;
+    FaceHandle f1 = m_halfEdges[h3].face;
 
-    // ALLOCATE NEW
+    // THE NEW ELEMENTS
 
     // HALF EDGES
-    HalfEdgeIter h10 = NewHalfEdge();
-    HalfEdgeIter h11 = NewHalfEdge();
-    HalfEdgeIter h12 = NewHalfEdge();
-    HalfEdgeIter h13 = NewHalfEdge();
-    HalfEdgeIter h14 = NewHalfEdge();
-    HalfEdgeIter h15 = NewHalfEdge();
+    HalfEdgeHandle h10 = newHalfEdges[0];
+    HalfEdgeHandle h11 = newHalfEdges[1];
+    HalfEdgeHandle h12 = newHalfEdges[2];
+    HalfEdgeHandle h13 = newHalfEdges[3];
+    HalfEdgeHandle h14 = newHalfEdges[4];
+    HalfEdgeHandle h15 = newHalfEdges[5];
 
     // VERTICES
-    VertexIter v4 = NewVertex();
-    glm::vec3 m = (e0->halfEdge->vertex->p + e0->halfEdge->twin->vertex->p) * 0.5f;
-    v4->p = m;
+    glm::vec3 m = (m_vertices[v1].p + m_vertices[v0].p) * 0.5f;
+    m_vertices[v4].p = m;
 
 //    glm::vec3 m = e0->halfEdge->vertex->p;
 
 //    printf("m :%s\n", glm::to_string(m).c_str() );
 
     // EDGES
-    EdgeIter e5 = NewEdge();
-    EdgeIter e6 = NewEdge();
-    EdgeIter e7 = NewEdge();
+    EdgeHandle e5 = newEdges[0];
+    EdgeHandle e6 = newEdges[1];
+    EdgeHandle e7 = newEdges[2];
 
     // FACES
-    FaceIter f2 = NewFace();
-    FaceIter f3 = NewFace();
+    FaceHandle f2 = newFaces[0];
+    FaceHandle f3 = newFaces[1];
 
 
     // NOW WE START ASSIGNING
-    h0->next = h11;
-    h0->twin = h3;
-    h0->vertex = v1;
-    h0->edge = e0;
-    h0->face = f0;
-
-    h1->next = h12;
-    h1->twin = h6;
-    h1->vertex = v0;
-    h1->edge = e2;
-    h1->face = f3;
-
-    h2->next = h0;
-    h2->twin = h7;
-    h2->vertex = v2;
-    h2->edge = e1;
-    h2->face = f0;
-
-    h3->next = h4;
-    h3->twin = h0;
-    h3->vertex = v4;
-    h3->edge = e0;
-    h3->face = f1;
-
-    h4->next = h10;
-    h4->twin = h8;
-    h4->vertex = v1;
-    h4->edge = e4;
-    h4->face = f1;
-
-    h5->next = h14;
-    h5->twin = h9;
-    h5->vertex = v3;
-    h5->edge = e3;
-    h5->face = f2;
-
-    h6->next = h6->next;
-    h6->twin = h1;
-    h6->vertex = v2;
-    h6->edge = e2;
-    h6->face = h6->face;
-
-    h7->next = h7->next;
-    h7->twin = h2;
-    h7->vertex = v1;
-    h7->edge = e1;
-    h7->face = h7->face;
-
-    h8->next = h8->next;
-    h8->twin = h4;
-    h8->vertex = v3;
-    h8->edge = e4;
-    h8->face = h8->face;
-
-    h9->next = h9->next;
-    h9->twin = h5;
-    h9->vertex = v0;
-    h9->edge = e3;
-    h9->face = h9->face;
-
-    h10->next = h3;
-    h10->twin = h15;
-    h10->vertex = v3;
-    h10->edge = e6;
-    h10->face = f1;
-
-    h11->next = h2;
-    h11->twin = h12;
-    h11->vertex = v4;
-    h11->edge = e5;
-    h11->face = f0;
-
-    h12->next = h13;
-    h12->twin = h11;
-    h12->vertex = v2;
-    h12->edge = e5;
-    h12->face = f3;
-
-    h13->next = h1;
-    h13->twin = h14;
-    h13->vertex = v4;
-    h13->edge = e7;
-    h13->face = f3;
-
-    h14->next = h15;
-    h14->twin = h13;
-    h14->vertex = v0;
-    h14->edge = e7;
-    h14->face = f2;
-
-    h15->next = h5;
-    h15->twin = h10;
-    h15->vertex = v4;
-    h15->edge = e6;
-    h15->face = f2;
+    //          half-edge  next  twin  vertex  edge  face
+
+    SetHalfEdge(h0,        h11,  h3,   v1,     e0,   f0);
+    SetHalfEdge(h1,        h12,  h6,   v0,     e2,   f3);
+    SetHalfEdge(h2,        h0,   h7,   v2,     e1,   f0);
+    SetHalfEdge(h3,        h4,   h0,   v4,     e0,   f1);
+    SetHalfEdge(h4,        h10,  h8,   v1,     e4,   f1);
+    SetHalfEdge(h5,        h14,  h9,   v3,     e3,   f2);
+
+    // the outer half-edges keep their next and face.
+    SetHalfEdge(h6, m_halfEdges[h6].next, h1, v2, e2, m_halfEdges[h6].face);
+    SetHalfEdge(h7, m_halfEdges[h7].next, h2, v1, e1, m_halfEdges[h7].face);
+    SetHalfEdge(h8, m_halfEdges[h8].next, h4, v3, e4, m_halfEdges[h8].face);
+    SetHalfEdge(h9, m_halfEdges[h9].next, h5, v0, e3, m_halfEdges[h9].face);
+
+    SetHalfEdge(h10,       h3,   h15,  v3,     e6,   f1);
+    SetHalfEdge(h11,       h2,   h12,  v4,     e5,   f0);
+    SetHalfEdge(h12,       h13,  h11,  v2,     e5,   f3);
+    SetHalfEdge(h13,       h1,   h14,  v4,     e7,   f3);
+    SetHalfEdge(h14,       h15,  h13,  v0,     e7,   f2);
+    SetHalfEdge(h15,       h5,   h10,  v4,     e6,   f2);
 
     // VERTICES
-    v0->halfEdge = h1;
-    v1->halfEdge = h0;
-    v2->halfEdge = h2;
-    v3->halfEdge = h5;
-    v4->halfEdge = h3;
+    m_vertices[v0].halfEdge = h1;
+    m_vertices[v1].halfEdge = h0;
+    m_vertices[v2].halfEdge = h2;
+    m_vertices[v3].halfEdge = h5;
+    m_vertices[v4].halfEdge = h3;
 
     // EDGES
-    e0->halfEdge = h0;
-    e1->halfEdge = h2;
-    e2->halfEdge = h1;
-    e3->halfEdge = h5;
-    e4->halfEdge = h4;
+    m_edges[e0].halfEdge = h0;
+    m_edges[e1].halfEdge = h2;
+    m_edges[e2].halfEdge = h1;
+    m_edges[e3].halfEdge = h5;
+    m_edges[e4].halfEdge = h4;
 
-    e5->halfEdge = h11;
-    e6->halfEdge = h10;
-    e7->halfEdge = h13;
+    m_edges[e5].halfEdge = h11;
+    m_edges[e6].halfEdge = h10;
+    m_edges[e7].halfEdge = h13;
 
 
     // FACES
-    f0->halfEdge = h2;
-    f1->halfEdge = h3;
-    f2->halfEdge = h5;
-    f3->halfEdge = h1;
+    m_faces[f0].halfEdge = h2;
+    m_faces[f1].halfEdge = h3;
+    m_faces[f2].halfEdge = h5;
+    m_faces[f3].halfEdge = h1;
 
 
     return v4;
 }
 
-VertexIter HalfEdgeMesh::Collapse(EdgeIter e8) {
+VertexHandle HalfEdgeMesh::Collapse(EdgeHandle e8, bool freeElements) {
+    HalfEdgeHandle h18 = m_edges[e8].halfEdge;
+
+    glm::vec3 m =
+	(m_vertices[m_halfEdges[h18].vertex].p +
+	 m_vertices[m_halfEdges[m_halfEdges[h18].twin].vertex].p) * 0.5f;
+
+    return Collapse(e8, m, freeElements);
+}
+
+VertexHandle HalfEdgeMesh::Collapse(EdgeHandle e8, const glm::vec3& m, bool freeElements) {
 
     // FIRST WE COLLECT INFO
 
     // HALF EDGES
 
     // f4
-    HalfEdgeIter h18 = e8->halfEdge;
-    HalfEdgeIter h16 = h18->next;
-    HalfEdgeIter h17 = h16->next;
+    HalfEdgeHandle h18 = m_edges[e8].halfEdge;
+    HalfEdgeHandle h16 = m_halfEdges[h18].next;
+    HalfEdgeHandle h17 = m_halfEdges[h16].next;
 
     // f5
-    HalfEdgeIter h19 = h18->twin;
-    HalfEdgeIter h20 = h19->next;
-    HalfEdgeIter h21 = h20->next;
+    HalfEdgeHandle h19 = m_halfEdges[h18].twin;
+    HalfEdgeHandle h20 = m_halfEdges[h19].next;
+    HalfEdgeHandle h21 = m_halfEdges[h20].next;
 
     // f6
-    HalfEdgeIter h26 = h21->twin;
+    HalfEdgeHandle h26 = m_halfEdges[h21].twin;
 
     // f7
-    HalfEdgeIter h23 = h16->twin;
-    HalfEdgeIter h24 = h23->next;
-
-    // f8
-    HalfEdgeIter h32 = h24->twin->next;
-
-    // f9
-    HalfEdgeIter h35 = h26->next->next->twin;
+    HalfEdgeHandle h23 = m_halfEdges[h16].twin;
+    HalfEdgeHandle h24 = m_halfEdges[h23].next;
 
     // f2
-    HalfEdgeIter h10 = h17->twin;
+    HalfEdgeHandle h10 = m_halfEdges[h17].twin;
 
     // f3
-    HalfEdgeIter h12 = h20->twin;
+    HalfEdgeHandle h12 = m_halfEdges[h20].twin;
 
     // VERTICES:
-    VertexIter v1 = h17->vertex;
+    VertexHandle v1 = m_halfEdges[h17].vertex;
 
-    VertexIter v4 = h18->vertex;
-    VertexIter v5 = h24->vertex;
+    VertexHandle v4 = m_halfEdges[h18].vertex;
+    VertexHandle v5 = m_halfEdges[h24].vertex;
 
-    VertexIter v8 = h12->vertex;
+    VertexHandle v8 = m_halfEdges[h12].vertex;
 
 
     // EDGES
-    EdgeIter e7 = h10->edge;
-    EdgeIter e9 = h12->edge;
-    EdgeIter e11 = h23->edge;
-    EdgeIter e12 = h26->edge;
-    EdgeIter e14 = h24->edge;
-    EdgeIter e15 = h32->edge;
-    EdgeIter e16 = h35->edge;
+    EdgeHandle e7 = m_halfEdges[h10].edge;
+    EdgeHandle e9 = m_halfEdges[h12].edge;
+    EdgeHandle e11 = m_halfEdges[h23].edge;
+    EdgeHandle e12 = m_halfEdges[h26].edge;
 
     // FACES
-    FaceIter f4 = h17->face;
-    FaceIter f5 = h19->face;
-    FaceIter f6 = h26->face;
-    FaceIter f8 = h32->face;
-
-    glm::vec3 m = (v4->p + v5->p) * 0.5f;
-//    v4->p = m;
+    FaceHandle f4 = m_halfEdges[h17].face;
+    FaceHandle f5 = m_halfEdges[h19].face;
 
-    v4->p = m;
+    m_vertices[v4].p = m;
 
     // NOW WE START ASSIGNING.
 
     // HALF EDGES
 
-    h10->twin = h23;
-    h10->vertex = v4;
-    h10->edge = e7;
+    m_halfEdges[h10].twin = h23;
+    m_halfEdges[h10].vertex = v4;
+    m_halfEdges[h10].edge = e7;
 
-    h12->twin = h26;
-    h12->vertex = v8;
-    h12->edge = e9;
+    m_halfEdges[h12].twin = h26;
+    m_halfEdges[h12].vertex = v8;
+    m_halfEdges[h12].edge = e9;
 
     // h16 will be removed.
     // h17 will be removed.
@@ -628,73 +599,196 @@ VertexIter HalfEdgeMesh::Collapse(EdgeIter e8) {
     // h20 will be removed.
     // h21 will be removed.
 
-    h23->twin = h10;
-    h23->vertex = v1;
-    h23->edge = e7;
-
-    stack<HalfEdgeIter> outgoings;
-
-    HalfEdgeIter it = v5->halfEdge;
-
-
-    do {
+    m_halfEdges[h23].twin = h10;
+    m_halfEdges[h23].vertex = v1;
+    m_halfEdges[h23].edge = e7;
 
+    // all the half-edges going out from v5 now go out from v4.
+    for(HalfEdgeHandle it : Outgoing(v5)) {
 	if(it != h16 && it != h26) {
-	    it->vertex = v4;
+	    m_halfEdges[it].vertex = v4;
 	}
-	it = it->twin->next;
-
-    } while(it != v5->halfEdge );
-
-
-
-
-/*
-    // out going.
-    h24->vertex = v4;
-    // outgoing
-    h32->vertex = v4;
-    // outgoing
-    h35->vertex = v4;
-    */
+    }
 
 
-    h26->twin = h12;
-    h26->vertex = v4;
-    h26->edge = e9;
+    m_halfEdges[h26].twin = h12;
+    m_halfEdges[h26].vertex = v4;
+    m_halfEdges[h26].edge = e9;
 
 
-    v1->halfEdge = h23;
-    v4->halfEdge = h10;
-    v8->halfEdge = h12;
+    m_vertices[v1].halfEdge = h23;
+    m_vertices[v4].halfEdge = h10;
+    m_vertices[v8].halfEdge = h12;
 
     // v5 will be removed
 
     // EDGES
-    e7->halfEdge = h10;
+    m_edges[e7].halfEdge = h10;
     // e8 will be removed
-    e9->halfEdge = h12;
+    m_edges[e9].halfEdge = h12;
     // e11 will be removed
     // e12 will be removed
 
 
-    RemoveFace(f4);
-    RemoveFace(f5);
+    RemoveFace(f4, freeElements);
+    RemoveFace(f5, freeElements);
 
-    RemoveVertex(v5);
+    RemoveVertex(v5, freeElements);
 
-    RemoveEdge(e8);
-    RemoveEdge(e11);
-    RemoveEdge(e12);
+    RemoveEdge(e8, freeElements);
+    RemoveEdge(e11, freeElements);
+    RemoveEdge(e12, freeElements);
 
-    RemoveHalfEdge(h16);
-    RemoveHalfEdge(h17);
-    RemoveHalfEdge(h18);
-    RemoveHalfEdge(h19);
-    RemoveHalfEdge(h20);
-    RemoveHalfEdge(h21);
+    RemoveHalfEdge(h16, freeElements);
+    RemoveHalfEdge(h17, freeElements);
+    RemoveHalfEdge(h18, freeElements);
+    RemoveHalfEdge(h19, freeElements);
+    RemoveHalfEdge(h20, freeElements);
+    RemoveHalfEdge(h21, freeElements);
 
 
     // return the vertex that the edge was collapsed into:
     return v4;
 }
+
+void HalfEdgeMesh::GetOutgoing(VertexHandle v, std::vector<HalfEdgeHandle>& halfEdges)const {
+    CirculatorRange<OutgoingCirculator> outgoing = Outgoing(v);
+    halfEdges.insert(halfEdges.end(), outgoing.begin(), outgoing.end());
+}
+
+int HalfEdgeMesh::InnerDegree(VertexHandle v)const {
+    int degree = 0;
+
+    // the walk stops before it steps over the boundary.
+    for(HalfEdgeHandle halfEdge : Outgoing(v)) {
+	if(m_halfEdges[halfEdge].twin == INVALID_HANDLE)
+	    return 0;
+	++degree;
+    }
+
+    return degree;
+}
+
+bool HalfEdgeMesh::IsBoundary(VertexHandle v)const {
+
+    // the walk stops before it steps over the boundary.
+    for(HalfEdgeHandle halfEdge : Outgoing(v)) {
+	if(m_halfEdges[halfEdge].twin == INVALID_HANDLE)
+	    return true;
+    }
+
+    return false;
+}
+
+bool HalfEdgeMesh::CanSplit(EdgeHandle e)const {
+
+    HalfEdgeHandle h0 = m_edges[e].halfEdge;
+    HalfEdgeHandle h3 = m_halfEdges[h0].twin;
+
+    if(h3 == INVALID_HANDLE)
+	return false;
+
+    // Split() also relinks the twins of the other edges of the two triangles.
+    HalfEdgeHandle h1 = m_halfEdges[h0].next;
+    HalfEdgeHandle h4 = m_halfEdges[h3].next;
+
+    return
+	m_halfEdges[h1].twin != INVALID_HANDLE &&
+	m_halfEdges[m_halfEdges[h1].next].twin != INVALID_HANDLE &&
+	m_halfEdges[h4].twin != INVALID_HANDLE &&
+	m_halfEdges[m_halfEdges[h4].next].twin != INVALID_HANDLE;
+}
+
+bool HalfEdgeMesh::CanFlip(EdgeHandle e)const {
+
+    if(!CanSplit(e))
+	return false;
+
+    HalfEdgeHandle h0 = m_edges[e].halfEdge;
+    HalfEdgeHandle h3 = m_halfEdges[h0].twin;
+
+    VertexHandle a = m_halfEdges[h0].vertex;
+    VertexHandle b = m_halfEdges[h3].vertex;
+
+    // the vertices opposite to the edge.
+    VertexHandle c = m_halfEdges[m_halfEdges[m_halfEdges[h0].next].next].vertex;
+    VertexHandle d = m_halfEdges[m_halfEdges[m_halfEdges[h3].next].next].vertex;
+
+    if(c == d || IsBoundary(a) || IsBoundary(b) || IsBoundary(c) || IsBoundary(d))
+	return false;
+
+    // a and b lose an edge, and must still have at least three.
+    if(Degree(a) <= 3 || Degree(b) <= 3)
+	return false;
+
+    // if c and d are already connected, we would get two edges between them.
+    for(VertexHandle neighbour : Neighbours(c)) {
+	if(neighbour == d)
+	    return false;
+    }
+
+    return true;
+}
+
+bool HalfEdgeMesh::CanCollapse(EdgeHandle e)const {
+
+    HalfEdgeHandle h0 = m_edges[e].halfEdge;
+    HalfEdgeHandle h3 = m_halfEdges[h0].twin;
+
+    if(h3 == INVALID_HANDLE)
+	return false;
+
+    VertexHandle a = m_halfEdges[h0].vertex;
+    VertexHandle b = m_halfEdges[h3].vertex;
+
+    VertexHandle c = m_halfEdges[m_halfEdges[m_halfEdges[h0].next].next].vertex;
+    VertexHandle d = m_halfEdges[m_halfEdges[m_halfEdges[h3].next].next].vertex;
+
+    // c and d lose an edge, and the merged vertex gets the edges of both a and b, minus four.
+    int degreeC = InnerDegree(c);
+    if(degreeC <= 3)
+	return false;
+
+    int degreeD = InnerDegree(d);
+    if(degreeD <= 3)
+	return false;
+
+    int degreeA = InnerDegree(a);
+    int degreeB = InnerDegree(b);
+    if(degreeA == 0 || degreeB == 0 || degreeA + degreeB - 4 < 3)
+	return false;
+
+    /*
+      The link condition: a and b may only have c and d as common neighbours.
+      Otherwise the collapse would glue two edges together, and the mesh would
+      no longer be a manifold. The rings are small, so they are just walked
+      around, without collecting them anywhere first.
+    */
+    int common = 0;
+
+    for(VertexHandle neighbourA : Neighbours(a)) {
+	for(VertexHandle neighbourB : Neighbours(b)) {
+	    if(neighbourA == neighbourB && ++common > 2)
+		return false;
+	}
+    }
+
+    return common == 2;
+}
+
+template<typename T>
+static void RebuildFreeList(const std::vector<T>& elements, std::vector<GLuint>& freeList) {
+    freeList.clear();
+
+    for(GLuint handle = 0; handle < elements.size(); ++handle) {
+	if(elements[handle].Removed())
+	    freeList.push_back(handle);
+    }
+}
+
+void HalfEdgeMesh::RebuildFreeLists() {
+    RebuildFreeList(m_halfEdges, m_freeHalfEdges);
+    RebuildFreeList(m_faces, m_freeFaces);
+    RebuildFreeList(m_vertices, m_freeVertices);
+    RebuildFreeList(m_edges, m_freeEdges);
+}
@@ -1,8 +1,9 @@
 #pragma once
 
-#include "gl_common.hpp"
+#include "mesh.hpp"
 
-#include <list>
+#include <iterator>
+#include <vector>
 
 /*
   https://fgiesen.wordpress.com/2012/02/21/half-edge-based-mesh-representations-theory/
@@ -10,153 +11,399 @@
   http://www.leonardofischer.com/dcel-data-structure-c-plus-plus-implementation/
 */
 
+/*
+  The elements of the mesh are kept in contiguous arrays, and refer to each other
+  by their 32-bit index into those arrays(their handle). When an element is removed,
+  its slot is put on a free list, and reused for the next element of that kind.
+*/
+typedef GLuint HalfEdgeHandle;
+typedef GLuint VertexHandle;
+typedef GLuint EdgeHandle;
+typedef GLuint FaceHandle;
 
-class HalfEdge;
-class Vertex;
-class Face;
-class Edge;
-
-typedef std::list<HalfEdge>::iterator HalfEdgeIter;
-typedef std::list<Face>::iterator FaceIter;
-typedef std::list<Vertex>::iterator VertexIter;
-typedef std::list<Edge>::iterator EdgeIter;
-
-typedef std::list<HalfEdge>::const_iterator HalfEdgeCIter;
-typedef std::list<Face>::const_iterator FaceCIter;
-typedef std::list<Vertex>::const_iterator VertexCIter;
-typedef std::list<Edge>::const_iterator EdgeCIter;
+const GLuint INVALID_HANDLE = 0xffffffff;
 
 struct HalfEdge {
-    HalfEdgeIter twin;
-    HalfEdgeIter next; // the next half-edge around the face.
+    HalfEdgeHandle twin;
+    HalfEdgeHandle next; // the next half-edge around the face.
+
+    VertexHandle vertex; // the vertex at the root of the half-edge..
 
-    VertexIter vertex; // the vertex at the root of the half-edge..
+    FaceHandle face; // the face to the left of this half-edge
 
-    FaceIter face; // the face to the left of this half-edge
+    EdgeHandle edge; // containing edge.
 
-    EdgeIter edge; // containing edge.
+    bool Removed()const { return next == INVALID_HANDLE; }
 };
 
 struct Edge {
-    HalfEdgeIter halfEdge; // one of the two half-edges that this edge is split into.
+    HalfEdgeHandle halfEdge; // one of the two half-edges that this edge is split into.
 
-    void GetEdgePoints(glm::vec3& a, glm::vec3& b);
+    bool Removed()const { return halfEdge == INVALID_HANDLE; }
 };
 
 
 struct Vertex {
     glm::vec3 p;
 
-    HalfEdgeIter halfEdge; // one of the half-edges emanating from this vertex.
-
-    int Degree()const;
+    HalfEdgeHandle halfEdge; // one of the half-edges emanating from this vertex.
 
     std::string ToString() { return glm::to_string(p);  }
+
+    bool Removed()const { return halfEdge == INVALID_HANDLE; }
 };
 
 struct Face {
-    HalfEdgeIter halfEdge; // one of the half-edges bordering the face.
+    HalfEdgeHandle halfEdge; // one of the half-edges bordering the face.
 
-    // compute the number of edges in a face.
-    int NumEdges()const;
+    bool Removed()const { return halfEdge == INVALID_HANDLE; }
 };
 
+/*
+  Iterates over the handles of the elements of an array, skipping the removed ones.
+*/
+template<typename T>
+class HandleIter {
 
-// we need these, if we want to use the iterators with std::maps.
-inline bool operator<( const HalfEdgeIter& i, const HalfEdgeIter& j ) { return &*i < &*j; }
-inline bool operator<( const   VertexIter& i, const   VertexIter& j ) { return &*i < &*j; }
-inline bool operator<( const     FaceIter& i, const     FaceIter& j ) { return &*i < &*j; }
-
-inline bool operator<( const HalfEdgeCIter& i, const HalfEdgeCIter& j ) { return &*i < &*j; }
-inline bool operator<( const   VertexCIter& i, const   VertexCIter& j ) { return &*i < &*j; }
-inline bool operator<( const     FaceCIter& i, const     FaceCIter& j ) { return &*i < &*j; }
+private:
 
+    const std::vector<T>* m_elements;
+    GLuint m_handle;
 
-class HalfEdgeMesh {
+    void SkipRemoved() {
+	while(m_handle < m_elements->size() && (*m_elements)[m_handle].Removed()) {
+	    ++m_handle;
+	}
+    }
 
 public:
 
+    HandleIter(const std::vector<T>* elements, GLuint handle):
+	m_elements(elements), m_handle(handle) {
+	SkipRemoved();
+    }
+
+    GLuint operator*()const { return m_handle; }
+
+    HandleIter& operator++() {
+	++m_handle;
+	SkipRemoved();
+	return *this;
+    }
+
+    bool operator==(const HandleIter& that)const { return m_handle == that.m_handle; }
+    bool operator!=(const HandleIter& that)const { return m_handle != that.m_handle; }
+};
+
+typedef HandleIter<HalfEdge> HalfEdgeIter;
+typedef HandleIter<Face> FaceIter;
+typedef HandleIter<Vertex> VertexIter;
+typedef HandleIter<Edge> EdgeIter;
+
+/*
+  Walks around a vertex, or a face, one half-edge at a time, without collecting
+  the half-edges anywhere first. Step says how to get to the next half-edge, and
+  Value what to yield for every half-edge. A circulator is just the half-edge
+  array and two handles, so it costs nothing to make, and the walk compiles down
+  to the loop that would have been written by hand. The walk around a vertex
+  assumes an inner vertex, like Degree() does.
 
+  Use it with range-for, like:
+
+    for(VertexHandle neighbour : mesh.Neighbours(v)) { ... }
+*/
+template<typename Step, typename Value>
+class HalfEdgeCirculator {
 
 private:
 
-    std::list<HalfEdge> m_halfEdges;
-    std::list<Face> m_faces;
-    std::list<Vertex> m_vertices;
-    std::list<Edge> m_edges;
+    const HalfEdge* m_halfEdges;
+    HalfEdgeHandle m_start;
+    HalfEdgeHandle m_current; // INVALID_HANDLE once the walk is back at the start.
+
+public:
+
+    typedef std::forward_iterator_tag iterator_category;
+    typedef GLuint value_type;
+    typedef ptrdiff_t difference_type;
+    typedef const GLuint* pointer;
+    typedef GLuint reference;
+
+    HalfEdgeCirculator(const HalfEdge* halfEdges, HalfEdgeHandle start, HalfEdgeHandle current):
+	m_halfEdges(halfEdges), m_start(start), m_current(current) {}
 
-    HalfEdgeIter NewHalfEdge() {
-	return m_halfEdges.insert(m_halfEdges.end(), HalfEdge() );
+    GLuint operator*()const { return Value::Get(m_halfEdges, m_current); }
+
+    // the half-edge that the circulator is at.
+    HalfEdgeHandle Current()const { return m_current; }
+
+    HalfEdgeCirculator& operator++() {
+	HalfEdgeHandle next = Step::Next(m_halfEdges, m_current);
+	m_current = next == m_start ? INVALID_HANDLE : next;
+	return *this;
     }
 
-    FaceIter NewFace() {
-	return m_faces.insert(m_faces.end(), Face()  );
+    HalfEdgeCirculator operator++(int) {
+	HalfEdgeCirculator old = *this;
+	++*this;
+	return old;
     }
 
-    EdgeIter NewEdge() {
-	return m_edges.insert(m_edges.end(), Edge());
+    bool operator==(const HalfEdgeCirculator& that)const { return m_current == that.m_current; }
+    bool operator!=(const HalfEdgeCirculator& that)const { return !(*this == that); }
+};
+
+template<typename Circulator>
+class CirculatorRange {
+
+private:
+
+    Circulator m_begin;
+    Circulator m_end;
+
+public:
+
+    CirculatorRange(const HalfEdge* halfEdges, HalfEdgeHandle start):
+	m_begin(halfEdges, start, start), m_end(halfEdges, start, INVALID_HANDLE) {}
+
+    Circulator begin()const { return m_begin; }
+    Circulator end()const { return m_end; }
+};
+
+// the steps.
+struct AroundVertex {
+    static HalfEdgeHandle Next(const HalfEdge* halfEdges, HalfEdgeHandle h) { return halfEdges[halfEdges[h].twin].next; }
+};
+
+struct AroundFace {
+    static HalfEdgeHandle Next(const HalfEdge* halfEdges, HalfEdgeHandle h) { return halfEdges[h].next; }
+};
+
+// the values.
+struct HalfEdgeValue {
+    static HalfEdgeHandle Get(const HalfEdge*, HalfEdgeHandle h) { return h; }
+};
+
+// the vertex at the tip of the half-edge.
+struct TipValue {
+    static VertexHandle Get(const HalfEdge* halfEdges, HalfEdgeHandle h) { return halfEdges[halfEdges[h].next].vertex; }
+};
+
+struct FaceValue {
+    static FaceHandle Get(const HalfEdge* halfEdges, HalfEdgeHandle h) { return halfEdges[h].face; }
+};
+
+typedef HalfEdgeCirculator<AroundVertex, HalfEdgeValue> OutgoingCirculator;
+typedef HalfEdgeCirculator<AroundVertex, TipValue> NeighbourCirculator;
+typedef HalfEdgeCirculator<AroundVertex, FaceValue> VertexFaceCirculator;
+typedef HalfEdgeCirculator<AroundFace, HalfEdgeValue> FaceHalfEdgeCirculator;
+
+
+class HalfEdgeMesh {
+
+public:
+
+
+
+private:
+
+    std::vector<HalfEdge> m_halfEdges;
+    std::vector<Face> m_faces;
+    std::vector<Vertex> m_vertices;
+    std::vector<Edge> m_edges;
+
+    // the slots of the removed elements, that can be reused.
+    std::vector<HalfEdgeHandle> m_freeHalfEdges;
+    std::vector<FaceHandle> m_freeFaces;
+    std::vector<VertexHandle> m_freeVertices;
+    std::vector<EdgeHandle> m_freeEdges;
+
+    template<typename T>
+    static GLuint NewElement(std::vector<T>& elements, std::vector<GLuint>& freeList) {
+	if(freeList.empty()) {
+	    elements.push_back(T());
+	    return (GLuint)elements.size() - 1;
+	}
+
+	GLuint handle = freeList.back();
+	freeList.pop_back();
+	elements[handle] = T();
+	return handle;
     }
 
-    VertexIter NewVertex() {
-	return m_vertices.insert(m_vertices.end(), Vertex() );
+    HalfEdgeHandle NewHalfEdge() { return NewElement(m_halfEdges, m_freeHalfEdges); }
+    FaceHandle NewFace() { return NewElement(m_faces, m_freeFaces); }
+    EdgeHandle NewEdge() { return NewElement(m_edges, m_freeEdges); }
+    VertexHandle NewVertex() { return NewElement(m_vertices, m_freeVertices); }
+
+    // if free is false, the slot is not put on the free list, see Collapse().
+    void RemoveHalfEdge ( HalfEdgeHandle halfEdge, bool free = true ) { m_halfEdges[halfEdge].next = INVALID_HANDLE; if(free) m_freeHalfEdges.push_back(halfEdge); }
+    void RemoveVertex   (   VertexHandle vertex, bool free = true ) {   m_vertices[vertex].halfEdge = INVALID_HANDLE; if(free) m_freeVertices.push_back(vertex); }
+    void RemoveEdge     (     EdgeHandle edge, bool free = true ) {        m_edges[edge].halfEdge = INVALID_HANDLE; if(free) m_freeEdges.push_back(edge); }
+    void RemoveFace     (     FaceHandle face, bool free = true ) {        m_faces[face].halfEdge = INVALID_HANDLE; if(free) m_freeFaces.push_back(face); }
+
+    // the first handles of the elements allocated by ReserveSplits().
+    GLuint m_reservedHalfEdges;
+    GLuint m_reservedVertices;
+    GLuint m_reservedEdges;
+    GLuint m_reservedFaces;
+
+    // split with the given new elements: six half-edges, a vertex, three edges and two faces.
+    VertexHandle SplitWith(
+	EdgeHandle e0,
+	const HalfEdgeHandle* newHalfEdges, VertexHandle v4,
+	const EdgeHandle* newEdges, const FaceHandle* newFaces);
+
+    // set all the fields of a half-edge at once.
+    void SetHalfEdge(
+	HalfEdgeHandle h,
+	HalfEdgeHandle next, HalfEdgeHandle twin,
+	VertexHandle vertex, EdgeHandle edge, FaceHandle face) {
+
+	HalfEdge& halfEdge = m_halfEdges[h];
+	halfEdge.next = next;
+	halfEdge.twin = twin;
+	halfEdge.vertex = vertex;
+	halfEdge.edge = edge;
+	halfEdge.face = face;
     }
 
-    void RemoveHalfEdge ( HalfEdgeIter halfEdge ) {  m_halfEdges.erase( halfEdge ); }
-    void RemoveVertex   (   VertexIter vertex ) {   m_vertices.erase(vertex); }
-    void RemoveEdge     (     EdgeIter edge ) {      m_edges.erase(edge); }
-    void RemoveFace     (     FaceIter face ) {      m_faces.erase(face); }
+    // like Degree(), in one walk around the vertex, but 0 if it is on the boundary.
+    int InnerDegree(VertexHandle v)const;
+
+    // create all the elements from the triangles and the twins of their half-edges.
+    void Link(
+	const std::vector<glm::vec3>& vertices,
+	const std::vector<Tri>& faces,
+	const std::vector<HalfEdgeHandle>& twins,
+	int numThreads);
 
 public:
 
-    HalfEdgeMesh(const Mesh& mesh);
+    // numThreads is the number of threads to build the mesh with. 0 means one per hardware thread.
+    HalfEdgeMesh(const Mesh& mesh, int numThreads = 1);
+
+    /*
+      Build the mesh from triangles whose twins are already known, so that they
+      don't have to be searched for. The half-edge 3*f+i goes from corner i to
+      corner i+1 of the face f, and twins[3*f+i] is its twin, or INVALID_HANDLE
+      if it is on a boundary.
+    */
+    HalfEdgeMesh(
+	const std::vector<glm::vec3>& vertices,
+	const std::vector<Tri>& faces,
+	const std::vector<HalfEdgeHandle>& twins,
+	int numThreads = 1);
 
 
     Mesh ToMesh()const;
 
 
-    void Flip(EdgeIter h0);
+    void Flip(EdgeHandle h0);
 
 
-    VertexIter Split(EdgeIter e0);
+    VertexHandle Split(EdgeHandle e0);
 
-    VertexIter Collapse(EdgeIter e8);
+    /*
+      If freeElements is false, the removed elements are not put on the free lists.
+      Then collapses of edges that are far enough apart can run in parallel, and
+      RebuildFreeLists() must be called afterwards.
+    */
+    VertexHandle Collapse(EdgeHandle e8, bool freeElements = true);
 
+    // collapse the edge into the point m, instead of into its midpoint.
+    VertexHandle Collapse(EdgeHandle e8, const glm::vec3& m, bool freeElements = true);
 
     /*
-      begin/end
+      For splitting many edges in parallel. ReserveSplits(n) allocates the new
+      elements of n splits up front, and then SplitReserved(e, i), for every i in
+      [0, n), splits an edge with the elements number i. Splits of edges that
+      share no vertices, and no triangles, can run at the same time.
+    */
+    void ReserveSplits(size_t n);
+    VertexHandle SplitReserved(EdgeHandle e0, size_t i);
+
+    void RebuildFreeLists();
+
+    // the number of edges incident to a vertex.
+    int Degree(VertexHandle v)const;
+
+    // compute the number of edges in a face.
+    int NumEdges(FaceHandle f)const;
+
+    void GetEdgePoints(EdgeHandle e, glm::vec3& a, glm::vec3& b)const;
+
+    // add the half-edges going out from an inner vertex to halfEdges.
+    void GetOutgoing(VertexHandle v, std::vector<HalfEdgeHandle>& halfEdges)const;
+
+    /*
+      circulators, see HalfEdgeCirculator. Outgoing() walks the half-edges going
+      out from the vertex, Neighbours() the vertices at their tips, and
+      FacesAround() the faces to their left. FaceHalfEdges() walks the
+      half-edges around the face.
+    */
+    CirculatorRange<OutgoingCirculator> Outgoing(VertexHandle v)const {
+	return CirculatorRange<OutgoingCirculator>(m_halfEdges.data(), m_vertices[v].halfEdge);
+    }
+    CirculatorRange<NeighbourCirculator> Neighbours(VertexHandle v)const {
+	return CirculatorRange<NeighbourCirculator>(m_halfEdges.data(), m_vertices[v].halfEdge);
+    }
+    CirculatorRange<VertexFaceCirculator> FacesAround(VertexHandle v)const {
+	return CirculatorRange<VertexFaceCirculator>(m_halfEdges.data(), m_vertices[v].halfEdge);
+    }
+    CirculatorRange<FaceHalfEdgeCirculator> FaceHalfEdges(FaceHandle f)const {
+	return CirculatorRange<FaceHalfEdgeCirculator>(m_halfEdges.data(), m_faces[f].halfEdge);
+    }
+
+    bool IsBoundary(VertexHandle v)const;
+
+    /*
+      Whether Split(), Flip() and Collapse() can be done on the edge. They assume
+      that the triangles around the edge are not on the boundary, and Flip() and
+      Collapse() must also leave a valid manifold mesh behind.
     */
-    HalfEdgeIter beginHalfEdges() { return m_halfEdges.begin(); }
-    HalfEdgeIter   endHalfEdges() { return m_halfEdges.end(); }
+    bool CanSplit(EdgeHandle e)const;
+    bool CanFlip(EdgeHandle e)const;
+    bool CanCollapse(EdgeHandle e)const;
 
-    FaceIter beginFaces() { return m_faces.begin(); }
-    FaceIter   endFaces() { return m_faces.end(); }
 
-    VertexIter beginVertices() { return m_vertices.begin(); }
-    VertexIter   endVertices() { return m_vertices.end(); }
+    /*
+      element access
+    */
+    HalfEdge& GetHalfEdge(HalfEdgeHandle h) { return m_halfEdges[h]; }
+    Vertex& GetVertex(VertexHandle v) { return m_vertices[v]; }
+    Edge& GetEdge(EdgeHandle e) { return m_edges[e]; }
+    Face& GetFace(FaceHandle f) { return m_faces[f]; }
 
-    EdgeIter beginEdges() { return m_edges.begin(); }
-    EdgeIter   endEdges() { return m_edges.end(); }
+    const HalfEdge& GetHalfEdge(HalfEdgeHandle h)const { return m_halfEdges[h]; }
+    const Vertex& GetVertex(VertexHandle v)const { return m_vertices[v]; }
+    const Edge& GetEdge(EdgeHandle e)const { return m_edges[e]; }
+    const Face& GetFace(FaceHandle f)const { return m_faces[f]; }
 
 
     /*
-      const begin/end
+      begin/end
     */
-    HalfEdgeCIter beginHalfEdges()const { return m_halfEdges.cbegin(); }
-    HalfEdgeCIter   endHalfEdges()const { return m_halfEdges.cend(); }
+    HalfEdgeIter beginHalfEdges()const { return HalfEdgeIter(&m_halfEdges, 0); }
+    HalfEdgeIter   endHalfEdges()const { return HalfEdgeIter(&m_halfEdges, (GLuint)m_halfEdges.size()); }
+
+    FaceIter beginFaces()const { return FaceIter(&m_faces, 0); }
+    FaceIter   endFaces()const { return FaceIter(&m_faces, (GLuint)m_faces.size()); }
 
-    FaceCIter beginFaces()const { return m_faces.cbegin(); }
-    FaceCIter   endFaces()const { return m_faces.cend(); }
+    VertexIter beginVertices()const { return VertexIter(&m_vertices, 0); }
+    VertexIter   endVertices()const { return VertexIter(&m_vertices, (GLuint)m_vertices.size()); }
 
-    VertexCIter beginVertices()const { return m_vertices.cbegin(); }
-    VertexCIter   endVertices()const { return m_vertices.cend(); }
+    EdgeIter beginEdges()const { return EdgeIter(&m_edges, 0); }
+    EdgeIter   endEdges()const { return EdgeIter(&m_edges, (GLuint)m_edges.size()); }
 
-    EdgeCIter beginEdges()const { return m_edges.cbegin(); }
-    EdgeCIter   endEdges()const { return m_edges.cend(); }
+    size_t NumHalfEdges()const { return m_halfEdges.size() - m_freeHalfEdges.size(); }
+    size_t NumFaces()const { return m_faces.size() - m_freeFaces.size(); }
+    size_t NumVertices()const { return m_vertices.size() - m_freeVertices.size(); }
+    size_t NumEdges()const { return m_edges.size() - m_freeEdges.size(); }
 
-    size_t NumHalfEdges()const { return m_halfEdges.size(); }
-    size_t NumFaces()const { return m_faces.size(); }
-    size_t NumVertices()const { return m_vertices.size(); }
-    size_t NumEdges()const { return m_edges.size(); }
+    // one past the largest handle, removed elements included. For looping over the handles in parallel.
+    GLuint NumVertexHandles()const { return (GLuint)m_vertices.size(); }
+    GLuint NumEdgeHandles()const { return (GLuint)m_edges.size(); }
 
 
 
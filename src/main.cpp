@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 
 
 #include <glad/glad.h>
@@ -12,6 +13,9 @@
 #include "gl_common.hpp"
 
 #include "marching_cubes.hpp"
+#include "sdf.hpp"
+#include "capsule_set.hpp"
+#include "stroke_volume.hpp"
 
 #include "deform.hpp"
 
@@ -152,51 +156,31 @@ void updateViewMatrix() {
 
 
 
-float Capsule(float x_, float y_, float z_, glm::vec3 p0, glm::vec3 p1, float r) {
-
-    // Source of the below formula:
-    // see equation (4.40) of http://image.diku.dk/projects/media/kelager.06.pdf
-
-    glm::vec3 x(x_,y_,z_);
-
-    float t = - glm::dot(p0 - x, p1 - p0) / glm::dot(p1 - p0, p1 - p0);
-    t = std::min(1.0f, std::max(0.0f,t));
-
-    glm::vec3 q = p0 + t * (p1-p0);
-
-    return glm::length(q - x) - r;
-}
-
-float Torus(float x, float y, float z, float R, float r) {
-
-    return (R - sqrt(x*x + y*y) )*(R - sqrt(x*x + y*y) ) + z*z - r*r;
-
-}
+vector<glm::vec3> points;
 
-float Union(float v1, float v2) {
-    return std::min(v1,v2);
+// the point of the helix that the sculpture is drawn along, at s.
+vec3 HelixPoint(float s) {
+    return vec3(
+	cos(s / sqrt(2) ),
+	sin(s / sqrt(2) ),
+	s / sqrt(2)
+	);
 }
 
-vector<glm::vec3> points;
-
 void InitSculpt() {
     for(float s = 0; s < 16.0f; s +=1.0f) {
 
-	vec3 p(
-	    cos(s / sqrt(2) ),
-	    sin(s / sqrt(2) ),
-	    s / sqrt(2)
-	    );
-	points.push_back(p);
+	points.push_back(HelixPoint(s));
 
     }
 }
 
 struct Density {
 
-    float eval(float x, float y, float z) const{
+    // the capsules that make up the sculpture.
+    CapsuleSet capsules;
 
-	float v = FLT_MAX;
+    Density() {
 
 //	v = x*x + y*y + z*z - 1;
 
@@ -209,33 +193,47 @@ struct Density {
 	    r = 0.5;
 
 
-	    v = Union(v, Capsule(x,y,z, points[i-1] , points[i-0],
-
-				 r
+	    capsules.Add(points[i-1] , points[i-0], r);
+	}
 
+/*
+  capsules.Add(glm::vec3(0,-5,0), glm::vec3(0,3,0), 0.3);
+  capsules.Add(glm::vec3(-3,3,0), glm::vec3(3,3,0), 1.0);	capsules.Add(glm::vec3(-3,-5,-3), glm::vec3(3,-5,3), 1.0);
+*/
 
-			  ));
+	capsules.Build();
+    }
 
+    float eval(float x, float y, float z) const{
 
-	}
+	return capsules.Eval(x,y,z);
 
+//	return torus(x,y,z, 3, 1);
 
+    }
 
+    // the same as eval(), but for n points at once.
+    void evalBatch(const float* xs, const float* ys, const float* zs, float* out, size_t n) const {
+	capsules.EvalBatch(xs, ys, zs, out, n);
+    }
 
+    // the exact normals of the capsules, for marching cubes.
+    glm::vec3 gradient(float x, float y, float z) const {
+	return capsules.Gradient(x,y,z);
+    }
+};
 
 /*
-  v = Union(v, Capsule(x,y,z, glm::vec3(0,-5,0), glm::vec3(0,3,0), 0.3));
-  v = Union(v, Capsule(x,y,z, glm::vec3(-3,3,0), glm::vec3(3,3,0), 1.0) );	v = Union(v, Capsule(x,y,z, glm::vec3(-3,-5,-3), glm::vec3(3,-5,3), 1.0) );
+  With --strokes, the sculpture is a capsule stroke between every two points,
+  kept in a StrokeVolume instead of Density. That way, adding or removing a
+  stroke only remeshes the part of the sculpture that the stroke touches.
 */
+StrokeVolume* volume = nullptr;
 
-	return v;
-
+// the ids of the strokes, in the order they were added.
+vector<int> strokes;
 
-
-//	return torus(x,y,z, 3, 1);
-
-    }
-};
+const float STROKE_RADIUS = 0.5f;
 
 
 void CreateUVSphere() {
@@ -498,7 +496,9 @@ void InitMC(void)
 			100,
 			 -10, +10,
 			 -10,  +10,
-			 -10, +10
+			 -10, +10,
+			 0, // use all cores.
+			 1.0f // the capsules make up a true distance field.
 	);
 
 
@@ -506,6 +506,34 @@ void InitMC(void)
 
 }
 
+// take the geometry of the sculpture, but keep the buffers.
+void SetMesh(const Mesh& m) {
+    mesh.vertices = m.vertices;
+    mesh.normals = m.normals;
+    mesh.faces = m.faces;
+    mesh.normalsFromFaces = m.normalsFromFaces;
+    mesh.vertexFaces = m.vertexFaces;
+}
+
+void InitStrokes(void)
+{
+
+    // there is room for the helix to grow up to about twice its length along z.
+    volume = new StrokeVolume(
+	128,
+	-12, +12,
+	-12, +12,
+	-3, +21,
+	0 // use all cores.
+	);
+
+    for(size_t i = 1; i < points.size(); ++i) {
+	strokes.push_back(volume->AddStroke(points[i-1], points[i], STROKE_RADIUS));
+    }
+
+    SetMesh(volume->GetMesh());
+}
+
 /**********************************************************************
  * OpenGL helper functions
  *********************************************************************/
@@ -513,21 +541,26 @@ void InitMC(void)
 /* Create VBO, IBO and VAO objects for the heightmap geometry and bind them to
  * the specified program object
  */
-void make_mesh(){
-    GL_C(glGenBuffers(1, &mesh.indexVbo));
+// upload the geometry of the mesh to its buffers.
+void upload_mesh(){
     GL_C(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexVbo));
     GL_C(glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint)* mesh.faces.size()*3, mesh.faces.data(), GL_STATIC_DRAW));
 
-
-    // create
-
-    GL_C(glGenBuffers(1, &mesh.vertexVbo));
     GL_C(glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexVbo));
     GL_C(glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*3*mesh.vertices.size(), mesh.vertices.data() , GL_STATIC_DRAW));
 
-    GL_C(glGenBuffers(1, &mesh.normalVbo));
     GL_C(glBindBuffer(GL_ARRAY_BUFFER, mesh.normalVbo));
     GL_C(glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat)*3*mesh.normals.size(), mesh.normals.data() , GL_STATIC_DRAW));
+}
+
+void make_mesh(){
+    // create
+
+    GL_C(glGenBuffers(1, &mesh.indexVbo));
+    GL_C(glGenBuffers(1, &mesh.vertexVbo));
+    GL_C(glGenBuffers(1, &mesh.normalVbo));
+
+    upload_mesh();
 
 
 
@@ -557,12 +590,53 @@ void ScrollCallback(GLFWwindow* window, double xoffset, double yoffset){
 
 }
 
+// remesh the part of the sculpture that the last edit changed, and show it.
+void UpdateSculpture() {
+    double start = glfwGetTime();
+
+    SetMesh(volume->GetMesh());
+    upload_mesh();
+
+    printf("remeshed %ld faces in %f seconds\n", mesh.faces.size(), glfwGetTime() - start);
+}
+
+// continue the helix with another stroke.
+void AddStroke() {
+    vec3 p = HelixPoint((float)points.size());
+
+    strokes.push_back(volume->AddStroke(points.back(), p, STROKE_RADIUS));
+    points.push_back(p);
+
+    UpdateSculpture();
+}
+
+// take back the last stroke.
+void RemoveStroke() {
+    if(strokes.empty())
+	return;
+
+    volume->RemoveStroke(strokes.back());
+    strokes.pop_back();
+    points.pop_back();
+
+    UpdateSculpture();
+}
+
 void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods){
     switch(key){
     case GLFW_KEY_ESCAPE:
 	/* Exit program on Escape */
 	glfwSetWindowShouldClose(window, GLFW_TRUE);
 	break;
+    case GLFW_KEY_A:
+	/* With --strokes, add a stroke to the sculpture on A, and remove the last one on Backspace */
+	if(action == GLFW_PRESS && volume)
+	    AddStroke();
+	break;
+    case GLFW_KEY_BACKSPACE:
+	if(action == GLFW_PRESS && volume)
+	    RemoveStroke();
+	break;
     }
 }
 
@@ -619,9 +693,12 @@ int main(int argc, char** argv)
     glm::mat4 projectionMatrix = glm::perspective(0.9f, (float)WINDOW_WIDTH / WINDOW_HEIGHT, 0.1f, 1000.0f);
 
 
-    /* Create mesh data */
+    /* Create mesh data. --strokes shows the sculpture in a StrokeVolume, that can be edited */
 //    InitMC();
-  InitSphere();
+    if(argc > 1 && !strcmp(argv[1], "--strokes"))
+	InitStrokes();
+    else
+	InitSphere();
     make_mesh();
 
 
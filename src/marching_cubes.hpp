@@ -1,40 +1,1293 @@
 #pragma once
 
 #include "marching_cubes_tables.hpp"
+#include "parallel.hpp"
+#include "half_edge_mesh.hpp"
 
 #include <glm/glm.hpp>
 #include <vector>
-#include <unordered_map>
 #include <functional>
+#include <utility>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-inline std::pair<int,int> sort(int x, int y) {
-    return x <= y ? std::pair<int,int>(x,y) : std::pair<int,int>(y,x);
+
+inline int XyzToId(const int* C, int resolution) {
+    return
+	(C[0])*resolution*resolution +
+	(C[1])*resolution            +
+	(C[2]);
+}
+
+inline int XyzToId(const int* C, int i, int resolution) {
+    return
+	(C[0] + cubeVerticesTable[i][0])*resolution*resolution +
+	(C[1] + cubeVerticesTable[i][1])*resolution            +
+	(C[2] + cubeVerticesTable[i][2]);
+}
+
+/*
+  Where the density values of the whole grid are stored, for MarchingCubes().
+
+  With XyzToId(), the eight corners of a cell are spread over four rows in two
+  planes, that are resolution^2 floats apart, and so are the neighbours that a
+  normal is found from. At large resolutions, that is a few cache lines and pages
+  for every cell. So instead, the grid is split into bricks of 8^3 grid points,
+  and every brick is stored in one piece, of 2kB, with z the fastest, then y and x.
+  Nearly all the reads for a cell then hit the same brick. The bricks themselves
+  are stored in Morton order, so that bricks that are close in space are mostly
+  close in memory as well.
+
+  The Morton order is over a cube of a power of two bricks per axis, which may
+  be larger than the grid, so m_brickIds gives every Morton code the index of
+  its brick among the bricks that are in the grid.
+*/
+class McBrickLayout {
+
+private:
+
+    enum { BRICK_BITS = 3, BRICK_SIZE = 1 << BRICK_BITS, BRICK_VOLUME = BRICK_SIZE*BRICK_SIZE*BRICK_SIZE };
+
+    int m_numBricks;
+
+    // the bits of a brick coordinate spread out, so that bit i goes to bit 3*i.
+    std::vector<uint32_t> m_spread;
+
+    std::vector<uint32_t> m_brickIds;
+
+    static uint32_t Spread(uint32_t b) {
+	uint32_t m = 0;
+	for(int i = 0; b >> i; ++i) {
+	    m |= ((b >> i) & 1) << (3*i);
+	}
+	return m;
+    }
+
+public:
+
+    McBrickLayout(int resolution):
+	m_numBricks((resolution + BRICK_SIZE-1) / BRICK_SIZE) {
+
+	int cube = 1;
+	while(cube < m_numBricks) {
+	    cube *= 2;
+	}
+
+	m_spread.resize(cube);
+	for(int b = 0; b < cube; ++b) {
+	    m_spread[b] = Spread(b);
+	}
+
+	m_brickIds.resize((size_t)cube * cube * cube);
+
+	uint32_t next = 0;
+
+	// go through the codes in Morton order, and number the bricks that are in the grid.
+	for(size_t code = 0; code < m_brickIds.size(); ++code) {
+	    int b[3] = { 0, 0, 0 };
+	    for(int i = 0; (code >> (3*i)) != 0; ++i) {
+		b[0] |= (int)((code >> (3*i + 2)) & 1) << i;
+		b[1] |= (int)((code >> (3*i + 1)) & 1) << i;
+		b[2] |= (int)((code >> (3*i + 0)) & 1) << i;
+	    }
+
+	    bool inGrid = b[0] < m_numBricks && b[1] < m_numBricks && b[2] < m_numBricks;
+	    m_brickIds[code] = inGrid ? next++ : 0;
+	}
+    }
+
+    // the number of floats it takes to store the grid, which is rounded up to whole bricks.
+    size_t Size()const {
+	return (size_t)m_numBricks * m_numBricks * m_numBricks * BRICK_VOLUME;
+    }
+
+    size_t Id(const int* C)const {
+	uint32_t code =
+	    m_spread[C[0] >> BRICK_BITS] << 2 |
+	    m_spread[C[1] >> BRICK_BITS] << 1 |
+	    m_spread[C[2] >> BRICK_BITS];
+
+	return (size_t)m_brickIds[code] * BRICK_VOLUME +
+	    ((C[0] & (BRICK_SIZE-1)) << (2*BRICK_BITS) |
+	     (C[1] & (BRICK_SIZE-1)) << BRICK_BITS |
+	     (C[2] & (BRICK_SIZE-1)));
+    }
+
+    // the grid points (x, y, z) to (x, y, z+RunLength()-1) are stored one after another, if z is a multiple of it.
+    static int RunLength() { return BRICK_SIZE; }
+};
+
+/*
+  The plain x-major layout of XyzToId(), behind the same interface as
+  McBrickLayout, so that the two can be compared. MarchingCubes() always uses
+  McBrickLayout, this is only for the "layout" benchmark of sculpt-cli.
+*/
+class McLinearLayout {
+
+private:
+
+    int m_resolution;
+
+public:
+
+    McLinearLayout(int resolution): m_resolution(resolution) {}
+
+    size_t Size()const {
+	return (size_t)m_resolution * m_resolution * m_resolution;
+    }
+
+    size_t Id(const int* C)const {
+	return ((size_t)C[0] * m_resolution + C[1]) * m_resolution + C[2];
+    }
+
+    // a whole row is stored in one piece, but a run must fit in a word of McSignGrid.
+    static int RunLength() { return 64; }
+};
+
+/*
+  Evaluate the density at n points at once. If the density functor F has a
+  method evalBatch(xs, ys, zs, out, n), that is used. Otherwise, we fall back
+  to calling eval(x, y, z) for every point.
+*/
+template<typename F>
+auto EvalDensityBatch(
+    const F& density,
+    const float* xs, const float* ys, const float* zs, float* out, size_t n,
+    int /* preferred overload */)
+    -> decltype(density.evalBatch(xs, ys, zs, out, n), void()) {
+
+    density.evalBatch(xs, ys, zs, out, n);
+}
+
+template<typename F>
+void EvalDensityBatch(
+    const F& density,
+    const float* xs, const float* ys, const float* zs, float* out, size_t n,
+    long /* fallback overload */) {
+
+    for(size_t i = 0; i < n; ++i) {
+	out[i] = density.eval(xs[i], ys[i], zs[i]);
+    }
+}
+
+/*
+  Evaluate the density for the row of grid points (x, y, 0), (x, y, 1), ..., (x, y, resolution-1),
+  and store the values in out. The batch is kept in the arrays xs, ys and zs.
+*/
+template<typename F>
+void EvalDensityRow(
+    const F& density,
+    const int x, const int y,
+    const int resolution,
+    const float bounds[2][3],
+    const float cellSizes[3],
+    std::vector<float>& xs, std::vector<float>& ys, std::vector<float>& zs,
+    float* out) {
+
+    xs.assign(resolution, bounds[0][0] + x * cellSizes[0]);
+    ys.assign(resolution, bounds[0][1] + y * cellSizes[1]);
+    zs.resize(resolution);
+
+    for(int z = 0; z < resolution; ++z) {
+	zs[z] = bounds[0][2] + z * cellSizes[2];
+    }
+
+    EvalDensityBatch(density, xs.data(), ys.data(), zs.data(), out, resolution, 0);
+}
+
+/*
+  Remembers the index of the vertex that was created on a grid edge, so that
+  only one vertex is created for every edge that the surface passes through.
+
+  The cells are visited in x-major order, and a cell at x = C[0] only touches
+  grid edges whose lower endpoint lies in one of the planes x = C[0] and
+  x = C[0]+1. So instead of hashing all the edges of the grid, we keep two
+  planes of resolution^2 * 3 slots(one slot per edge axis), and roll them
+  forward every time we advance to the next layer of cells.
+*/
+class EdgeVertexCache {
+
+private:
+
+    int m_resolution;
+
+    // m_planes[0] is the plane x = C[0], and m_planes[1] is the plane x = C[0]+1
+    std::vector<int> m_planes[2];
+
+public:
+
+    enum { NONE = -1 };
+
+    EdgeVertexCache(int resolution):
+	m_resolution(resolution) {
+
+	m_planes[0].assign(resolution*resolution*3, NONE);
+	m_planes[1].assign(resolution*resolution*3, NONE);
+    }
+
+    // the index of the slot of an edge within its plane.
+    static int Slot(const int* base, int axis, int resolution) {
+	return (base[1]*resolution + base[2])*3 + axis;
+    }
+
+    // Get the slot of the edge that starts at the grid point base and goes
+    // along axis, as seen from the cells at x = x0.
+    int& At(const int* base, int axis, int x0) {
+	return m_planes[base[0] - x0][Slot(base, axis, m_resolution)];
+    }
+
+    // move on to the next layer of cells.
+    void Advance() {
+	std::swap(m_planes[0], m_planes[1]);
+	std::fill(m_planes[1].begin(), m_planes[1].end(), NONE);
+    }
+
+    // m_planes[0] is the plane x = C[0], and m_planes[1] is the plane x = C[0]+1
+    const std::vector<int>& Plane(int i)const { return m_planes[i]; }
+};
+
+/*
+  For an edge between the grid points A and B, find the lower one of the
+  two points, and the axis along which the edge goes.
+*/
+inline int EdgeBase(const int* A, const int* B, const int*& base) {
+    int axis = 0;
+    while(A[axis] == B[axis])
+	++axis;
+
+    base = A[axis] < B[axis] ? A : B;
+    return axis;
+}
+
+/*
+  In a slab, a face index with this bit set does not refer to a vertex of the
+  slab itself, but to a vertex on the lower plane of the slab, which belongs to
+  the previous slab. The remaining bits are the slot of the edge in that plane.
+*/
+const GLuint MC_SHARED_VERTEX = 0x80000000u;
+
+/*
+  Estimate the normal at the interior grid point C, by taking the central
+  difference of the density values of the grid G.
+*/
+template<typename G>
+glm::vec3 CentralDifferenceNormal(const G& grid, int* C) {
+
+    glm::vec3 n;
+
+    int A[3];
+    int B[3];
+
+    for(int j = 0; j < 3; ++j) {
+
+	for(int k = 0; k < 3; ++k) {
+	    A[k] = C[k] + (k == j ? 1 : 0);
+	    B[k] = C[k] - (k == j ? 1 : 0);
+	}
+
+	float a = grid.Value(A);
+	float b = grid.Value(B);
+
+	n[j] = 0.5f * (a - b);
+    }
+
+    return glm::normalize(n);
+}
+
+/*
+  The central difference normal at the grid point P of the grid G. On the
+  boundary of the grid, there are no neighbours to take the difference with,
+  so there the normal is zero.
+*/
+template<typename G>
+glm::vec3 McGridNormal(const G& grid, int* P, int resolution) {
+
+    for(int j = 0; j < 3; ++j) {
+	if(P[j] == 0 || P[j] == resolution-1)
+	    return glm::vec3(0.0f);
+    }
+    return CentralDifferenceNormal(grid, P);
+}
+
+/*
+  The normal of the density at the grid point P of the grid G. If the density
+  functor F has a method gradient(x, y, z), the normal is the normalized gradient
+  at the point. Otherwise, it is the central difference of the density values
+  of the grid.
+*/
+template<typename F, typename G>
+auto McDensityNormal(
+    const F& density, const G& /* grid */, int* P,
+    int /* resolution */, const float bounds[2][3], const float cellSizes[3],
+    int /* preferred overload */)
+    -> decltype(density.gradient(0.0f, 0.0f, 0.0f), glm::vec3()) {
+
+    glm::vec3 g = density.gradient(
+	bounds[0][0] + P[0] * cellSizes[0],
+	bounds[0][1] + P[1] * cellSizes[1],
+	bounds[0][2] + P[2] * cellSizes[2]);
+
+    float length = glm::length(g);
+    return length > 0.0f ? g / length : glm::vec3(0.0f);
+}
+
+template<typename F, typename G>
+glm::vec3 McDensityNormal(
+    const F& /* density */, const G& grid, int* P,
+    int resolution, const float /* bounds */[2][3], const float /* cellSizes */[3],
+    long /* fallback overload */) {
+
+    return McGridNormal(grid, P, resolution);
+}
+
+/*
+  The grid of density values, when the normals are computed from them when
+  they are needed.
+*/
+struct McValueGrid {
+    const float* densityValues;
+    int resolution;
+
+    float Value(int* P)const { return densityValues[XyzToId(P, resolution)]; }
+    glm::vec3 Normal(int* P)const { return McGridNormal(*this, P, resolution); }
+};
+
+/*
+  The grid of density values that the cells are created from, when the whole
+  grid is kept in memory, in the layout L, McBrickLayout unless it is being
+  compared to another one. Only the density values are stored. A normal is only
+  needed at the endpoints of the edges that the surface crosses, so it is found
+  right there, from the density F.
+*/
+template<typename F, typename L = McBrickLayout>
+struct McDensityGrid {
+    const F& density;
+    const L& layout;
+    const float* densityValues;
+    int resolution;
+    const float (*bounds)[3];
+    const float* cellSizes;
+
+    float Value(int* P)const { return densityValues[layout.Id(P)]; }
+
+    glm::vec3 Normal(int* P)const {
+	return McDensityNormal(density, *this, P, resolution, bounds, cellSizes, 0);
+    }
+};
+
+/*
+  Compute the vertex p and normal n on the edge from the grid point A to the grid
+  point B, where the density takes the values vA and vB.
+*/
+template<typename G>
+void McEdgeVertex(
+    const G& grid,
+    int* A, int* B,
+    const float vA, const float vB,
+    const float bounds[2][3],
+    const float cellSizes[3],
+    glm::vec3& p, glm::vec3& n) {
+
+    // compute the lerp-factor t.
+    float d = vA - vB;
+    float t = 0.0;
+    if(fabs(d) > 0.00001) {
+	t = vA / d;
+    }
+
+    // to compute the vertex, we interpolate between the vertices at the edge-point.
+    for(int j = 0; j < 3; ++j) {
+	float e0 = bounds[0][j] + A[j] * cellSizes[j];
+	float e1 = bounds[0][j] + B[j] * cellSizes[j];
+	p[j] = (e1-e0)*t + e0;
+    }
+
+    glm::vec3 n0 = grid.Normal(A);
+    glm::vec3 n1 = grid.Normal(B);
+
+    //printf("n0: %f, %f, %f\n",  n0[0], n0[1], n0[2]);
+
+    n = glm::normalize((n1-n0)*t + n0);
+}
+
+/*
+  Create the geometry for the cell C, whose corners have the density values
+  cellValues, and the cell index cellIndex. The arguments are the same as for
+  MarchingCubesLayer(), and edgeIndicesCache must have been advanced to the
+  layer of the cell.
+*/
+template<typename G, typename S>
+void McCellGeometry(
+    const G& grid,
+    const int resolution,
+    const float bounds[2][3],
+    const float cellSizes[3],
+    int* C,
+    const float cellValues[8],
+    const int cellIndex,
+    const bool sharedLowerPlane,
+    EdgeVertexCache& edgeIndicesCache,
+    GLuint& index,
+    S& sink) {
+
+    GLuint edgeIndices[12];
+
+    int A[3];
+    int B[3];
+
+    const int x = C[0];
+    const int edgeTableMask = edgeTable[cellIndex];
+
+    //  for all edges where the surface passes through, we create vertices.
+    // and we keep track of the indices for the vertices through the
+    // array edgeIndices
+    for(int i = 0; i < 12; ++i) {
+
+	if(  ((1 << i) & edgeTableMask) == 0 )
+	    continue; // no geometry!
+
+	const int* e = edges[i];
+
+
+	/*
+	  Only one interpolated vertex between every edge is necessary.
+	  Once we have interpolated and computed one such vertex,
+	  we save its index in edgeIndicesCache.
+
+	  By doing this, the vertexcount of the created geometry is
+	  MUCH lowered.
+	*/
+	for(int j = 0; j < 3; ++j) {
+	    A[j] = C[j] + cubeVerticesTable[e[0]][j];
+	    B[j] = C[j] + cubeVerticesTable[e[1]][j];
+	}
+	const int* base;
+	int axis = EdgeBase(A, B, base);
+
+	if(sharedLowerPlane && base[0] == x && axis != 0) {
+	    // this vertex is created by the previous layer.
+	    edgeIndices[i] = MC_SHARED_VERTEX | EdgeVertexCache::Slot(base, axis, resolution);
+	    continue;
+	}
+
+	int& cached = edgeIndicesCache.At(base, axis, x);
+
+	if(cached != EdgeVertexCache::NONE) {
+	    // we have already computed the vertex between this edge.
+	    // so reuse it.
+
+	    edgeIndices[i] = cached;
+
+	} else {
+
+	    glm::vec3 p;
+	    glm::vec3 n;
+
+	    McEdgeVertex(
+		grid, A, B,
+		cellValues[e[0]], cellValues[e[1]],
+		bounds, cellSizes,
+		p, n);
+
+	    // now add the interpolated vertex.
+	    edgeIndices[i] = index++;
+	    sink.AddVertex( p, n );
+
+	    cached = edgeIndices[i];
+
+	}
+
+
+
+    }
+
+    const int* tri = triTable[cellIndex];
+
+    // finally, we now create all the triangle faces.
+    for(int i = 0; i < 16; i+=3) {
+
+	if(tri[i] == -1)
+	    break; // no more triangles!
+
+	GLuint i0 = edgeIndices[ tri[i+0] ];
+	GLuint i1 = edgeIndices[ tri[i+1] ];
+	GLuint i2 = edgeIndices[ tri[i+2] ];
+
+	sink.AddFace(i0, i1, i2);
+
+
+    }
+
+    sink.EndCell(C);
+}
+
+/*
+  Create the geometry for the layer of cells at x, and hand it to the sink S,
+  which has the methods AddVertex(p, n) and AddFace(i0, i1, i2). After the faces
+  of a cell, it calls EndCell(C), where C is the cell. Cells without geometry are skipped.
+
+  The density values and normals are read from the grid G, which has the methods
+  Value(P) and Normal(P), for grid points P. edgeIndicesCache must have been
+  advanced to the layer x, and index is the index of the next vertex.
+
+  If sharedLowerPlane is set, the vertices on the edges of the plane x are not created.
+  They belong to whoever meshed the previous layer, and are referred to with
+  MC_SHARED_VERTEX instead.
+*/
+template<typename G, typename S>
+void MarchingCubesLayer(
+    const G& grid,
+    const int resolution,
+    const float bounds[2][3],
+    const float cellSizes[3],
+    const int x,
+    const bool sharedLowerPlane,
+    EdgeVertexCache& edgeIndicesCache,
+    GLuint& index,
+    S& sink) {
+
+    float gridCellValues[8];
+
+    // Represents (x,y,z)
+    int C[3];
+    int A[3];
+
+    C[0] = x;
+
+    // we iterate through all the cells, and create geometry for them, one by one.
+    for(C[1] = 0; C[1] < (resolution-1); ++C[1])
+	for(C[2] = 0; C[2] < (resolution-1); ++C[2]) {
+
+	    int cellIndex = 0;
+
+	    // compute the values at the cell vertices, and create the cell index.
+	    for(int i = 0; i < 8; ++i) {
+
+		for(int j = 0; j < 3; ++j) {
+		    A[j] = C[j] + cubeVerticesTable[i][j];
+		}
+		gridCellValues[i] = grid.Value(A);
+
+		if( gridCellValues[i] > 0 ) {
+		    cellIndex |= ( 1 << i );
+		}
+	    }
+
+	    if(edgeTable[cellIndex] == 0)
+		continue; // no geometry in this cell!
+
+	    McCellGeometry(
+		grid, resolution, bounds, cellSizes,
+		C, gridCellValues, cellIndex, sharedLowerPlane,
+		edgeIndicesCache, index, sink);
+	}
+}
+
+inline int McPopCount(uint64_t w) {
+#if defined(__GNUC__)
+    return __builtin_popcountll(w);
+#else
+    int n = 0;
+    for(; w; w &= w - 1) {
+	++n;
+    }
+    return n;
+#endif
+}
+
+// the index of the lowest set bit of w, which must not be 0.
+inline int McLowestBit(uint64_t w) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(w);
+#else
+    int i = 0;
+    for(; !(w & 1); w >>= 1) {
+	++i;
+    }
+    return i;
+#endif
+}
+
+/*
+  The signs of the density values, one bit per grid point, which is set where
+  the density is > 0, just like for the cell index. Every row (x,y,0), ...,
+  (x,y,resolution-1) of the grid takes up RowWords() whole 64-bit words, bit z%64
+  of word z/64. That is 32 times less than the density values, and finding out
+  which cells have geometry only needs these.
+*/
+class McSignGrid {
+
+private:
+
+    int m_resolution;
+    int m_rowWords;
+    std::vector<uint64_t> m_bits;
+
+public:
+
+    template<typename L>
+    McSignGrid(const float* densityValues, const L& layout, int resolution, int numThreads):
+	m_resolution(resolution), m_rowWords((resolution + 63) / 64) {
+
+	// all zero, the bits are or'ed in.
+	m_bits.resize((size_t)resolution * resolution * m_rowWords);
+
+	/*
+	  The signs are read a brick at a time, in the order they are stored in,
+	  rather than a row at a time, which would go through a whole row of
+	  bricks for every row. The runs always fit in a word.
+	*/
+	const int brickSize = L::RunLength();
+	const int numBricks = (resolution + brickSize-1) / brickSize;
+
+	ParallelFor(0, numBricks, numThreads, [&](int bx) {
+		int C[3];
+
+		for(int by = 0; by < numBricks; ++by)
+		    for(int bz = 0; bz < numBricks; ++bz) {
+
+			for(C[0] = bx * brickSize; C[0] < std::min((bx+1) * brickSize, m_resolution); ++C[0])
+			    for(C[1] = by * brickSize; C[1] < std::min((by+1) * brickSize, m_resolution); ++C[1]) {
+				C[2] = bz * brickSize;
+
+				const float* v = densityValues + layout.Id(C);
+				const int n = std::min(brickSize, m_resolution - C[2]);
+
+				uint64_t run = 0;
+				int k = 0;
+#if defined(__SSE2__)
+				// four signs at a time.
+				for(; k + 4 <= n; k += 4) {
+				    int mask = _mm_movemask_ps(_mm_cmpgt_ps(_mm_loadu_ps(v + k), _mm_setzero_ps()));
+				    run |= (uint64_t)mask << k;
+				}
+#endif
+				for(; k < n; ++k) {
+				    run |= (uint64_t)(v[k] > 0) << k;
+				}
+				m_bits[((size_t)C[0] * m_resolution + C[1]) * m_rowWords + C[2] / 64] |= run << (C[2] % 64);
+			    }
+		    }
+	    });
+    }
+
+    int RowWords()const { return m_rowWords; }
+
+    const uint64_t* Row(int x, int y)const {
+	return &m_bits[((size_t)x * m_resolution + y) * m_rowWords];
+    }
+};
+
+/*
+  Count the vertices and triangles that the cells with x in [xBegin, xEnd)
+  create, as one slab, without creating them. The cells that have geometry are
+  added to cells, as their XyzToId(), in x-major order.
+
+  A vertex is created for every grid edge whose endpoints have different signs,
+  by the first cell that touches it. So the slab creates the vertices of the
+  edges along x that start in its layers, and of the edges along y and z in the
+  planes x in (xBegin, xEnd], and also in the plane x = xBegin for the first slab.
+
+  This only looks at the signs, 64 grid points at a time. The edges that cross
+  are the bits that differ between a row and the row next to it, or the row
+  shifted by one. A cell has geometry unless its eight corners all have the same
+  sign, so the cells with geometry of two neighbouring rows of cells are where
+  the OR of their corners is set, but the AND is not. Only for those cells, the
+  cell index is put together bit by bit. Its bits 0 to 3 are the corners
+  (x,y), (x+1,y), (x+1,y+1), (x,y+1) at z, and bits 4 to 7 the same at z+1.
+*/
+inline void McCountSlab(
+    const McSignGrid& signs,
+    const int resolution,
+    const int xBegin, const int xEnd,
+    size_t& numVertices, size_t& numFaces,
+    std::vector<int>& cells) {
+
+    numVertices = 0;
+    numFaces = 0;
+
+    const int rowWords = signs.RowWords();
+
+    // the bits of word i that are grid points with z < limit.
+    auto ValidBits = [](int i, int limit) {
+	int n = std::min(64, std::max(0, limit - 64*i));
+	return n == 64 ? ~(uint64_t)0 : (((uint64_t)1 << n) - 1);
+    };
+
+    // word i of the row, shifted so that bit z is the grid point z+1.
+    auto Next = [&](const uint64_t* row, int i) {
+	return (row[i] >> 1) | (i+1 < rowWords ? row[i+1] << 63 : 0);
+    };
+
+    for(int x = xBegin; x <= xEnd; ++x) {
+
+	const bool ownsPlane = x > xBegin || xBegin == 0;
+
+	for(int y = 0; y < resolution; ++y) {
+
+	    // the rows (x,y) and (x,y+1).
+	    const uint64_t* row = signs.Row(x, y);
+	    const uint64_t* rowY = y+1 < resolution ? signs.Row(x, y+1) : NULL;
+
+	    if(ownsPlane) {
+		for(int i = 0; i < rowWords; ++i) {
+		    numVertices += McPopCount((row[i] ^ Next(row, i)) & ValidBits(i, resolution-1));
+		    if(rowY)
+			numVertices += McPopCount(row[i] ^ rowY[i]);
+		}
+	    }
+
+	    if(x == xEnd)
+		continue;
+
+	    // the rows (x+1,y) and (x+1,y+1).
+	    const uint64_t* rowX = signs.Row(x+1, y);
+
+	    for(int i = 0; i < rowWords; ++i) {
+		numVertices += McPopCount(row[i] ^ rowX[i]);
+	    }
+
+	    if(!rowY)
+		continue;
+
+	    const uint64_t* rowXY = signs.Row(x+1, y+1);
+
+	    for(int i = 0; i < rowWords; ++i) {
+
+		uint64_t any = row[i] | rowX[i] | rowXY[i] | rowY[i];
+		uint64_t all = row[i] & rowX[i] & rowXY[i] & rowY[i];
+
+		uint64_t anyNext = Next(row, i) | Next(rowX, i) | Next(rowXY, i) | Next(rowY, i);
+		uint64_t allNext = Next(row, i) & Next(rowX, i) & Next(rowXY, i) & Next(rowY, i);
+
+		uint64_t active = (any | anyNext) & ~(all & allNext) & ValidBits(i, resolution-1);
+
+		for(; active; active &= active - 1) {
+		    const int bit = McLowestBit(active);
+		    const int z = 64*i + bit;
+
+		    auto Column = [&](int b, int word) {
+			return
+			    (int)((row[word]   >> b) & 1) << 0 |
+			    (int)((rowX[word]  >> b) & 1) << 1 |
+			    (int)((rowXY[word] >> b) & 1) << 2 |
+			    (int)((rowY[word]  >> b) & 1) << 3;
+		    };
+
+		    int cellIndex = Column(bit, i) | (bit < 63 ? Column(bit+1, i) : Column(0, i+1)) << 4;
+
+		    int C[3] = { x, y, z };
+		    cells.push_back(XyzToId(C, resolution));
+
+		    for(const int* tri = triTable[cellIndex]; *tri != -1; tri += 3) {
+			++numFaces;
+		    }
+		}
+	    }
+	}
+    }
+}
+
+/*
+  Create the geometry for the cells with x in [xBegin, xEnd), as one slab. Only
+  the cells in the list cells, that McCountSlab() found to have geometry, are
+  visited, since all the others are empty.
+
+  The vertices on the edges of the plane x = xBegin are created by the previous
+  slab(if there is one), so they are referred to with MC_SHARED_VERTEX. Other than
+  that, the vertices are created in exactly the same order as when all of the
+  cells are processed as one single slab.
+*/
+template<typename G, typename S>
+void MarchingCubesCells(
+    const G& grid,
+    const int resolution,
+    const float bounds[2][3],
+    const float cellSizes[3],
+    const int xBegin, const int xEnd,
+    const std::vector<int>& cells,
+    S& slab) {
+
+    GLuint index = 0;
+    EdgeVertexCache edgeIndicesCache(resolution);
+
+    float cellValues[8];
+
+    int C[3];
+    int A[3];
+
+    // the layer that edgeIndicesCache is at.
+    int x = xBegin;
+
+    for(int id : cells) {
+
+	C[0] = id / (resolution*resolution);
+	C[1] = (id / resolution) % resolution;
+	C[2] = id % resolution;
+
+	for(; x < C[0]; ++x) {
+	    edgeIndicesCache.Advance();
+	}
+
+	int cellIndex = 0;
+
+	for(int i = 0; i < 8; ++i) {
+
+	    for(int j = 0; j < 3; ++j) {
+		A[j] = C[j] + cubeVerticesTable[i][j];
+	    }
+	    cellValues[i] = grid.Value(A);
+
+	    if( cellValues[i] > 0 ) {
+		cellIndex |= ( 1 << i );
+	    }
+	}
+
+	McCellGeometry(
+	    grid, resolution, bounds, cellSizes,
+	    C, cellValues, cellIndex, xBegin > 0 && C[0] == xBegin,
+	    edgeIndicesCache, index, slab);
+    }
+
+    for(; x < xEnd; ++x) {
+	edgeIndicesCache.Advance();
+    }
+
+    // we have advanced past the last layer, so the upper plane is now plane 0.
+    const std::vector<int>& upper = edgeIndicesCache.Plane(0);
+    for(int slot = 0; slot < (int)upper.size(); ++slot) {
+	if(upper[slot] != EdgeVertexCache::NONE) {
+	    slab.upperPlane.emplace_back(slot, (GLuint)upper[slot]);
+	}
+    }
+}
+
+/*
+  Evaluate the density at the grid points in the block [lo, hi), but skip the
+  parts of the block that are far away from the surface.
+
+  If the density has the Lipschitz constant lipschitz, then the density at the
+  center of the block tells us how far away the surface at least is. If the
+  surface can't come within margin of the block, the sign of the density is the
+  same all over it, so we just fill it with the value at the center. Otherwise
+  we split it into eight, and try again.
+
+  Returns the number of times the density was evaluated.
+*/
+template<typename F, typename L>
+long SparseEvalBlock(
+    const F& density,
+    const L& layout,
+    float* densityValues,
+    const int resolution,
+    const float bounds[2][3],
+    const float cellSizes[3],
+    const float lipschitz,
+    const float margin,
+    const int* lo, const int* hi) {
+
+    int C[3];
+
+    // blocks this small are cheaper to just evaluate.
+    const int LEAF_SIZE = 2;
+
+    if(hi[0] - lo[0] <= LEAF_SIZE && hi[1] - lo[1] <= LEAF_SIZE && hi[2] - lo[2] <= LEAF_SIZE) {
+
+	for(C[0] = lo[0]; C[0] < hi[0]; ++C[0])
+	    for(C[1] = lo[1]; C[1] < hi[1]; ++C[1])
+		for(C[2] = lo[2]; C[2] < hi[2]; ++C[2]) {
+
+		    densityValues[
+			layout.Id(C)] = density.eval(
+			bounds[0][0] + (C[0]) * cellSizes[0],
+			bounds[0][1] + (C[1]) * cellSizes[1],
+			bounds[0][2] + (C[2]) * cellSizes[2]
+			);
+		}
+
+	return (long)(hi[0] - lo[0]) * (hi[1] - lo[1]) * (hi[2] - lo[2]);
+    }
+
+    glm::vec3 pMin;
+    glm::vec3 pMax;
+    for(int j = 0; j < 3; ++j) {
+	pMin[j] = bounds[0][j] + (lo[j]  ) * cellSizes[j];
+	pMax[j] = bounds[0][j] + (hi[j]-1) * cellSizes[j];
+    }
+
+    glm::vec3 center = 0.5f * (pMin + pMax);
+    float halfDiagonal = 0.5f * glm::length(pMax - pMin);
+
+    float v = density.eval(center.x, center.y, center.z);
+
+    if(fabs(v) > lipschitz * (halfDiagonal + margin)) {
+	// no surface anywhere near, so only the sign matters.
+	const int runLength = L::RunLength();
+
+	// a run ends at the next multiple of the run length, so it is filled at once.
+	for(C[0] = lo[0]; C[0] < hi[0]; ++C[0])
+	    for(C[1] = lo[1]; C[1] < hi[1]; ++C[1])
+		for(C[2] = lo[2]; C[2] < hi[2]; ) {
+		    const int runEnd = std::min((C[2] / runLength + 1) * runLength, hi[2]);
+		    std::fill_n(densityValues + layout.Id(C), runEnd - C[2], v);
+		    C[2] = runEnd;
+		}
+
+	return 1;
+    }
+
+    long numEvals = 1;
+
+    int mid[3];
+    for(int j = 0; j < 3; ++j) {
+	mid[j] = (lo[j] + hi[j]) / 2;
+    }
+
+    int childLo[3];
+    int childHi[3];
+
+    for(int i = 0; i < 8; ++i) {
+
+	for(int j = 0; j < 3; ++j) {
+	    childLo[j] = cubeVerticesTable[i][j] ? mid[j] : lo[j];
+	    childHi[j] = cubeVerticesTable[i][j] ? hi[j] : mid[j];
+	}
+
+	if(childLo[0] == childHi[0] || childLo[1] == childHi[1] || childLo[2] == childHi[2])
+	    continue; // the block was too thin to split along this axis.
+
+	numEvals += SparseEvalBlock(
+	    density, layout, densityValues, resolution, bounds, cellSizes,
+	    lipschitz, margin, childLo, childHi);
+    }
+
+    return numEvals;
+}
+
+/*
+  Evaluate the density at every grid point, and store the values in
+  densityValues, which has room for layout.Size() values. The arguments are the
+  same as for MarchingCubes(). Returns how many times the density was
+  evaluated, which is less than resolution^3 when the empty space is skipped.
+*/
+template<typename F, typename L>
+long McEvalDensity(
+    const F& density,
+    const int resolution,
+    const float bounds[2][3],
+    const float cellSizes[3],
+    const int numThreads,
+    const float lipschitz,
+    const L& layout,
+    float* densityValues) {
+
+    if(lipschitz > 0.0f) {
+
+	/*
+	  The density values far away from the surface are only used for their sign.
+	  The values that matter are the ones at the endpoints of the edges that the surface
+	  crosses, and at their neighbours (for the normals). Those are all within two cells
+	  of the surface, so that is the margin we need to keep.
+	*/
+	const float margin = 2.0f * glm::length(glm::vec3(cellSizes[0], cellSizes[1], cellSizes[2]));
+
+	const int BLOCK_SIZE = 32;
+	const int numBlocks = (resolution + BLOCK_SIZE-1) / BLOCK_SIZE;
+
+	std::vector<long> numEvals(numBlocks*numBlocks*numBlocks, 0);
+
+	ParallelFor(0, numBlocks*numBlocks*numBlocks, numThreads, [&](int block) {
+
+		int lo[3] = { block / (numBlocks*numBlocks), (block / numBlocks) % numBlocks, block % numBlocks };
+		int hi[3];
+
+		for(int j = 0; j < 3; ++j) {
+		    lo[j] *= BLOCK_SIZE;
+		    hi[j] = std::min(lo[j] + BLOCK_SIZE, resolution);
+		}
+
+		numEvals[block] = SparseEvalBlock(
+		    density, layout, densityValues, resolution, bounds, cellSizes,
+		    lipschitz, margin, lo, hi);
+	    });
+
+	long totalEvals = 0;
+	for(long n : numEvals) {
+	    totalEvals += n;
+	}
+
+	return totalEvals;
+
+    } else {
+
+	// precompute all the density values for the entire grid, one row at a time:
+	ParallelFor(0, resolution, numThreads, [&](int x) {
+
+		std::vector<float> xs, ys, zs;
+		std::vector<float> row(resolution);
+
+		const int runLength = L::RunLength();
+
+		int C[3] = { x, 0, 0 };
+
+		for(C[1] = 0; C[1] < (resolution); ++C[1]) {
+		    EvalDensityRow(
+			density, C[0], C[1], resolution, bounds, cellSizes,
+			xs, ys, zs,
+			row.data());
+
+		    // and put the row in place, one run of the bricks at a time.
+		    for(C[2] = 0; C[2] < resolution; C[2] += runLength) {
+			std::copy(
+			    row.begin() + C[2], row.begin() + std::min(C[2] + runLength, resolution),
+			    densityValues + layout.Id(C));
+		    }
+		}
+	    });
+
+	return (long)resolution*resolution*resolution;
+    }
+
+
+
+/*
+    for(C[0] = 2; C[0] < (resolution-2); ++C[0])
+	for(C[1] = 2; C[1] < (resolution-2); ++C[1])
+	    for(C[2] = 2; C[2] < (resolution-2); ++C[2]) {
+
+		float sum = 0;
+
+		for(int i = -2; i <= +2; ++i) {
+
+
+		    for(int j = -2; j <= +2; ++j) {
+
+
+			for(int k = -2; k <= +2; ++k) {
+
+			    A[0] = C[0] + i;
+			    A[1] = C[1] + j;
+			    A[2] = C[2] + k;
+
+			    sum += densityValues[layout.Id(A)];
+			}
+
+		    }
+
+		}
+
+		smoothedDensityValues[layout.Id(C)] = sum / 125.0f;
+
+
+	    }
+*/
+}
+
+/*
+  The layers of cells are split into slabs, that are meshed independently.
+  A single thread just takes all the layers as one slab. Slab k has the layers
+  [McSlabBegin(k), McSlabBegin(k+1)).
+*/
+inline int McNumSlabs(int resolution, int numThreads) {
+    const int numCellLayers = resolution - 1;
+    return std::min(numCellLayers, NumThreads(numThreads) == 1 ? 1 : NumThreads(numThreads) * 4);
+}
+
+inline int McSlabBegin(int resolution, int numSlabs, int k) {
+    return ((resolution - 1) * k) / numSlabs;
+}
+
+/*
+  The index in the whole mesh of the vertex index of the slab k, given the
+  offsets of the vertices of every slab in the mesh.
+*/
+template<typename S>
+GLuint McGlobalVertex(const std::vector<S>& slabs, const std::vector<GLuint>& offsets, int k, GLuint index) {
+
+    if(index & MC_SHARED_VERTEX) {
+	const std::vector<std::pair<int, GLuint> >& shared = slabs[k-1].upperPlane;
+
+	int slot = (int)(index & ~MC_SHARED_VERTEX);
+	auto it = std::lower_bound(
+	    shared.begin(), shared.end(), std::pair<int, GLuint>(slot, 0));
+
+	return offsets[k-1] + it->second;
+    } else {
+	return offsets[k] + index;
+    }
 }
 
-struct pair_hash {
-    std::size_t operator () (const std::pair<int,int>& p) const {
-        int h1 = p.first;
-        int h2 = p.second;
+/*
+  A sink for MarchingCubesCells() that writes the geometry of a slab straight
+  into its place in the arrays of the whole mesh. The faces refer to the
+  vertices with the indices of the slab, until McGlobalFaces() fixes them up.
+*/
+struct McBufferSlab {
+    glm::vec3* vertices;
+    glm::vec3* normals;
+    Tri* faces;
+
+    // the vertices that were created on the upper plane of the slab, as
+    // (slot, vertex index) pairs sorted by slot. The next slab refers to these.
+    std::vector<std::pair<int, GLuint> > upperPlane;
+
+    void AddVertex(const glm::vec3& p, const glm::vec3& n) {
+	*vertices++ = p;
+	*normals++ = n;
+    }
 
-        return h1 ^ h2;
+    void AddFace(GLuint i0, GLuint i1, GLuint i2) {
+	*faces++ = Tri(i0, i1, i2);
     }
+
+    void EndCell(const int* /* C */) {}
 };
 
-inline int XyzToId(int* C, int resolution) {
-    return
-	(C[0])*resolution*resolution +
-	(C[1])*resolution            +
-	(C[2]);
+/*
+  How many vertices and triangles every slab creates, and so where they start
+  in the arrays of the whole mesh. The last offsets are the totals.
+*/
+struct McSlabCounts {
+    int numSlabs;
+    std::vector<size_t> vertexOffsets;
+    std::vector<size_t> faceOffsets;
+
+    // the cells of every slab that have geometry.
+    std::vector<std::vector<int> > cells;
+};
+
+/*
+  The slabs are meshed in two passes. The first pass counts how many vertices
+  and triangles every slab creates, and the offsets of the slabs in the mesh
+  are the sums of the counts before them. So the arrays of the mesh are
+  allocated once, at their exact size, and in the second pass, McFillSlabs(),
+  every slab writes its geometry right into them. The mesh is the same for
+  every number of threads.
+
+  The first pass also remembers the cells with geometry, so the second pass
+  only has to visit those.
+*/
+template<typename F, typename L>
+McSlabCounts McCountSlabs(
+    const McDensityGrid<F, L>& grid,
+    const int resolution,
+    const int numThreads) {
+
+    McSlabCounts counts;
+    counts.numSlabs = McNumSlabs(resolution, numThreads);
+
+    const int numSlabs = counts.numSlabs;
+
+    McSignGrid signs(grid.densityValues, grid.layout, resolution, numThreads);
+
+    counts.vertexOffsets.assign(numSlabs + 1, 0);
+    counts.faceOffsets.assign(numSlabs + 1, 0);
+    counts.cells.resize(numSlabs);
+
+    ParallelFor(0, numSlabs, numThreads, [&](int k) {
+	    McCountSlab(
+		signs, resolution,
+		McSlabBegin(resolution, numSlabs, k),
+		McSlabBegin(resolution, numSlabs, k+1),
+		counts.vertexOffsets[k], counts.faceOffsets[k], counts.cells[k]);
+	});
+
+    // there are only a few slabs, so this is not worth doing in parallel.
+    ExclusiveScan(counts.vertexOffsets, counts.vertexOffsets.size(), 1);
+    ExclusiveScan(counts.faceOffsets, counts.faceOffsets.size(), 1);
+
+    return counts;
 }
 
-inline int XyzToId(int* C, int i, int resolution) {
-    return
-	(C[0] + cubeVerticesTable[i][0])*resolution*resolution +
-	(C[1] + cubeVerticesTable[i][1])*resolution            +
-	(C[2] + cubeVerticesTable[i][2]);
+/*
+  The second pass. slabs[k] is a McBufferSlab, or derived from one, that points
+  at the place of the slab k in the arrays of the mesh.
+*/
+template<typename F, typename L, typename S>
+void McFillSlabs(
+    const McDensityGrid<F, L>& grid,
+    const int resolution,
+    const float bounds[2][3],
+    const float cellSizes[3],
+    const int numThreads,
+    McSlabCounts& counts,
+    std::vector<S>& slabs) {
+
+    const int numSlabs = counts.numSlabs;
+
+    ParallelFor(0, numSlabs, numThreads, [&](int k) {
+	    MarchingCubesCells(
+		grid, resolution, bounds, cellSizes,
+		McSlabBegin(resolution, numSlabs, k),
+		McSlabBegin(resolution, numSlabs, k+1),
+		counts.cells[k], slabs[k]);
+
+	    // not needed anymore.
+	    std::vector<int>().swap(counts.cells[k]);
+	});
+}
+
+// now that all the slabs are there, the faces can refer to the vertices of the whole mesh.
+template<typename S>
+void McGlobalFaces(Tri* faces, const McSlabCounts& counts, const std::vector<S>& slabs, const int numThreads) {
+
+    if(counts.numSlabs == 1)
+	return;
+
+    std::vector<GLuint> offsets(counts.vertexOffsets.begin(), counts.vertexOffsets.end());
+
+    ParallelFor(0, counts.numSlabs, numThreads, [&](int k) {
+	    for(size_t f = counts.faceOffsets[k]; f < counts.faceOffsets[k+1]; ++f) {
+		for(int i = 0; i < 3; ++i) {
+		    faces[f].i[i] = McGlobalVertex(slabs, offsets, k, faces[f].i[i]);
+		}
+	    }
+	});
+}
+
+// point the slabs at their places in the arrays of the mesh, which have the sizes of the counts.
+template<typename S>
+void McPlaceSlabs(Mesh& mesh, const McSlabCounts& counts, std::vector<S>& slabs) {
+
+    slabs.resize(counts.numSlabs);
+
+    for(int k = 0; k < counts.numSlabs; ++k) {
+	slabs[k].vertices = mesh.vertices.data() + counts.vertexOffsets[k];
+	slabs[k].normals = mesh.normals.data() + counts.vertexOffsets[k];
+	slabs[k].faces = mesh.faces.data() + counts.faceOffsets[k];
+    }
 }
 
+template<typename F, typename L>
+Mesh McMeshSlabs(
+    const McDensityGrid<F, L>& grid,
+    const int resolution,
+    const float bounds[2][3],
+    const float cellSizes[3],
+    const int numThreads) {
+
+    McSlabCounts counts = McCountSlabs(grid, resolution, numThreads);
+
+    Mesh mesh;
+    mesh.vertices.resize(counts.vertexOffsets.back());
+    mesh.normals.resize(counts.vertexOffsets.back());
+    mesh.faces.resize(counts.faceOffsets.back());
+
+    std::vector<McBufferSlab> slabs;
+    McPlaceSlabs(mesh, counts, slabs);
+
+    McFillSlabs(grid, resolution, bounds, cellSizes, numThreads, counts, slabs);
+
+    McGlobalFaces(mesh.faces.data(), counts, slabs, numThreads);
+
+    return mesh;
+}
 
 template<typename F>
 Mesh MarchingCubes(
@@ -46,7 +1299,17 @@ Mesh MarchingCubes(
 
     const float xMin, const float xMax,
     const float yMin, const float yMax,
-    const float zMin, const float zMax
+    const float zMin, const float zMax,
+
+    // how many threads to mesh with. 0 means one thread per core.
+    // The output is the same no matter the number of threads.
+    const int numThreads = 1,
+
+    // if the density is a distance bound with this Lipschitz constant(1 for a
+    // true distance field), the empty space far away from the surface is skipped
+    // when evaluating it. The output is the same, just cheaper to compute.
+    // 0 means that every grid point is evaluated.
+    const float lipschitz = 0.0f
     ) {
 
     float bounds[2][3] = {
@@ -55,8 +1318,6 @@ Mesh MarchingCubes(
 
     };
 
-    Mesh mesh;
-
     // the sizes of the cells.
     float cellSizes[3];
 
@@ -64,255 +1325,520 @@ Mesh MarchingCubes(
 	cellSizes[i] = (bounds[1][i] - bounds[0][i]) / (float)(resolution-1);
     }
 
-    float gridCellValues[8];
-    int edgeIndices[12];
 
-    GLuint index = 0;
+    McBrickLayout layout(resolution);
+    float* densityValues = new float[layout.Size()];
 
+    McEvalDensity(density, resolution, bounds, cellSizes, numThreads, lipschitz, layout, densityValues);
 
-    float* densityValues = new float[resolution*resolution*resolution];
-    float* smoothedDensityValues = new float[resolution*resolution*resolution];
+    McDensityGrid<F> grid = { density, layout, densityValues, resolution, bounds, cellSizes };
 
-    glm::vec3* normals = new glm::vec3[resolution*resolution*resolution];
+    Mesh mesh = McMeshSlabs(grid, resolution, bounds, cellSizes, numThreads);
 
-    std::unordered_map<std::pair<int,int>, int ,pair_hash> edgeIndicesCache;
+    delete[] densityValues;
 
-    // Represents (x,y,z)
-    int C[3];
-    int A[3];
-    int B[3];
+    printf("vertices: %ld\n", mesh.vertices.size() );
 
-    // precompute all the density values for the entire grid:
-    for(C[0] = 0; C[0] < (resolution); ++C[0])
-	for(C[1] = 0; C[1] < (resolution); ++C[1])
-	    for(C[2] = 0; C[2] < (resolution); ++C[2]) {
+    printf("normals: %ld\n", mesh.normals.size() );
 
-		densityValues[
-		    XyzToId(C, resolution)] = density.eval(
-		    bounds[0][0] + (C[0]) * cellSizes[0],
-		    bounds[0][1] + (C[1]) * cellSizes[1],
-		    bounds[0][2] + (C[2]) * cellSizes[2]
-		    );
+/*
+  for(const glm::vec3& p : mesh.vertices ) {
+  printf("p: %f, %f, %f\n", p.x, p.y, p.z );
+  }
+*/
 
-	    }
+//    printf("faces: %ld\n", mesh.faces.size() );
+    printf("faces: %ld\n", mesh.faces.size() );
 
+    return mesh;
+}
+/*
+  A slab that also pairs up the twins of the half-edges of its triangles, while
+  they are being created, and writes them into the twins of the whole mesh. The
+  half-edge 3*f+i goes from corner i to corner i+1 of the face f of the slab,
+  just like in HalfEdgeMesh, and the twins are also indices of the slab, until
+  MarchingCubesHalfEdge() fixes them up.
+
+  The twin of a half-edge is either in the same cell, or in one of the six
+  cells that share a face with it. So after every cell, we first pair up the
+  half-edges inside of the cell. The rest can only have their twins in the
+  neighbours at -x, -y and -z, which were created before, or in the neighbours
+  at +x, +y and +z, which will look for them later. So we keep the unpaired
+  half-edges of the cells of the last two layers around, and that is all the
+  lookup there is.
+*/
+struct McHalfEdgeSlab : public McBufferSlab {
 
+    // a cell of a layer, that had unpaired half-edges when it was created.
+    struct Cell {
+	int y;
+	int z;
 
-    int offsetTable[3][3] =
-	{
-	    {1,0,0},
-	    {0,1,0},
-	    {0,0,1},
-	};
-/*
-    for(C[0] = 2; C[0] < (resolution-2); ++C[0])
-	for(C[1] = 2; C[1] < (resolution-2); ++C[1])
-	    for(C[2] = 2; C[2] < (resolution-2); ++C[2]) {
+	// the half-edges are [begin, end) of the halfEdges of the layer.
+	GLuint begin;
+	GLuint end;
+    };
 
-		float sum = 0;
+    struct Layer {
+	int x;
 
-		for(int i = -2; i <= +2; ++i) {
+	// sorted by (y,z), since that is the order the cells are created in.
+	std::vector<Cell> cells;
+	std::vector<GLuint> halfEdges;
+    };
 
+    // the first face of the slab, faces is the next one.
+    const Tri* firstFace;
 
-		    for(int j = -2; j <= +2; ++j) {
+    // the twin of every half-edge, or INVALID_HANDLE, which they all start out as.
+    HalfEdgeHandle* twins;
 
+    // layers[0] is the first layer with geometry, which is kept so that it can be paired
+    // with the previous slab. After that, layers[1] and layers[2] take turns.
+    Layer layers[3];
 
-			for(int k = -2; k <= +2; ++k) {
+    // the layer that is being created, and the one before it. -1 if there is none.
+    int current;
+    int previous;
 
-			    A[0] = C[0] + i;
-			    A[1] = C[1] + j;
-			    A[2] = C[2] + k;
+    // the first face of the cell that is being created.
+    size_t cellFaces;
 
-			    sum += densityValues[XyzToId(A, resolution)];
-			}
+    // the next cells to look at in the current and previous layers.
+    size_t currentCursor;
+    size_t previousCursor;
 
-		    }
+    McHalfEdgeSlab():
+	firstFace(NULL), twins(NULL), current(-1), previous(-1), cellFaces(0), currentCursor(0), previousCursor(0) {
+    }
 
-		}
+    GLuint Origin(GLuint h)const { return firstFace[h / 3].i[h % 3]; }
+    GLuint Target(GLuint h)const { return firstFace[h / 3].i[(h % 3 + 1) % 3]; }
+
+    // the last layer with geometry, or NULL if the slab is empty.
+    const Layer* UpperLayer()const { return current == -1 ? NULL : &layers[current]; }
+    const Layer* LowerLayer()const { return current == -1 ? NULL : &layers[0]; }
+
+    /*
+      Find the cell (y,z) of the layer, or NULL if it has no unpaired half-edges.
+      The cursor is only moved forward, so the cells must be asked for in
+      increasing (y,z) order.
+    */
+    static const Cell* FindCell(const Layer& layer, size_t& cursor, int y, int z) {
+
+	while(cursor < layer.cells.size() &&
+	      (layer.cells[cursor].y < y || (layer.cells[cursor].y == y && layer.cells[cursor].z < z))) {
+	    ++cursor;
+	}
+
+	if(cursor < layer.cells.size() && layer.cells[cursor].y == y && layer.cells[cursor].z == z)
+	    return &layer.cells[cursor];
+	else
+	    return NULL;
+    }
 
-		smoothedDensityValues[XyzToId(C, resolution)] = sum / 125.0f;
+    // look for the twin of h among the half-edges of a cell of a layer.
+    bool PairWithCell(GLuint h, const Layer& layer, const Cell* cell) {
 
+	if(!cell)
+	    return false;
 
+	for(GLuint k = cell->begin; k < cell->end; ++k) {
+	    GLuint g = layer.halfEdges[k];
+
+	    if(twins[g] == INVALID_HANDLE && Origin(g) == Target(h) && Target(g) == Origin(h)) {
+		twins[g] = h;
+		twins[h] = g;
+		return true;
 	    }
-*/
+	}
 
-    //  int F[3];
+	return false;
+    }
 
-    for(C[0] = 1; C[0] < (resolution-1); ++C[0])
-	for(C[1] = 1; C[1] < (resolution-1); ++C[1])
-	    for(C[2] = 1; C[2] < (resolution-1); ++C[2]) {
+    void StartLayer(int x) {
 
+	int next = current == -1 ? 0 : (current == 1 ? 2 : 1);
+	previous = (current != -1 && layers[current].x == x-1) ? current : -1;
+	current = next;
 
+	layers[current].x = x;
+	layers[current].cells.clear();
+	layers[current].halfEdges.clear();
 
-		for(int j = 0; j < 3; ++j) {
+	currentCursor = 0;
+	previousCursor = 0;
+    }
 
-		    int* offsets = offsetTable[j];
+    void EndCell(const int* C) {
 
-		    A[0] = C[0] + offsets[0];
-		    A[1] = C[1] + offsets[1];
-		    A[2] = C[2] + offsets[2];
+	if(current == -1 || layers[current].x != C[0]) {
+	    StartLayer(C[0]);
+	}
 
-		    B[0] = C[0] - offsets[0];
-		    B[1] = C[1] - offsets[1];
-		    B[2] = C[2] - offsets[2];
+	const GLuint first = (GLuint)(3 * cellFaces);
+	const GLuint last = (GLuint)(3 * (faces - firstFace));
 
-		    float a = densityValues[XyzToId(A, resolution)];
+	cellFaces = faces - firstFace;
 
-		    float b = densityValues[XyzToId(B, resolution)];
+	// first pair up the half-edges inside of the cell.
+	for(GLuint h = first; h < last; ++h) {
+	    for(GLuint g = h+1; g < last && twins[h] == INVALID_HANDLE; ++g) {
+		if(twins[g] == INVALID_HANDLE && Origin(g) == Target(h) && Target(g) == Origin(h)) {
+		    twins[g] = h;
+		    twins[h] = g;
+		}
+	    }
+	}
 
-		    float g = 0.5f * (a - b);
+	Layer& layer = layers[current];
 
-		    //	    printf(": %f\n", g);
+	// the neighbours at -x, -y and -z.
+	const Cell* xNeighbour = previous == -1 ? NULL : FindCell(layers[previous], previousCursor, C[1], C[2]);
+	const Cell* yNeighbour = FindCell(layer, currentCursor, C[1]-1, C[2]);
+	const Cell* zNeighbour =
+	    (!layer.cells.empty() && layer.cells.back().y == C[1] && layer.cells.back().z == C[2]-1) ?
+	    &layer.cells.back() : NULL;
 
-		    normals[XyzToId(C, resolution)][j] = g;
+	Cell cell;
+	cell.y = C[1];
+	cell.z = C[2];
+	cell.begin = (GLuint)layer.halfEdges.size();
 
-		}
+	for(GLuint h = first; h < last; ++h) {
+
+	    if(twins[h] != INVALID_HANDLE)
+		continue;
+
+	    if(PairWithCell(h, previous == -1 ? layer : layers[previous], xNeighbour) ||
+	       PairWithCell(h, layer, yNeighbour) ||
+	       PairWithCell(h, layer, zNeighbour))
+		continue;
+
+	    // the neighbours that come later will look for it.
+	    layer.halfEdges.push_back(h);
+	}
+
+	cell.end = (GLuint)layer.halfEdges.size();
+
+	if(cell.end > cell.begin) {
+	    layer.cells.push_back(cell);
+	}
+    }
+};
+
+/*
+  Like MarchingCubes(), and with the same arguments, but the result is a
+  HalfEdgeMesh. The twins of the half-edges are found while the cells are
+  being created, from the structure of the grid, so HalfEdgeMesh never has
+  to search for them.
+*/
+template<typename F>
+HalfEdgeMesh MarchingCubesHalfEdge(
+    const F& density,
+    const int resolution,
+    const float xMin, const float xMax,
+    const float yMin, const float yMax,
+    const float zMin, const float zMax,
+    const int numThreads = 1,
+    const float lipschitz = 0.0f
+    ) {
 
+    float bounds[2][3] = {
+	{ xMin, yMin, zMin },
+	{ xMax, yMax, zMax },
+    };
 
+    // the sizes of the cells.
+    float cellSizes[3];
 
+    for(int i = 0; i < 3; ++i) {
+	cellSizes[i] = (bounds[1][i] - bounds[0][i]) / (float)(resolution-1);
+    }
 
-		normals[XyzToId(C, resolution)] = glm::normalize(normals[XyzToId(C, resolution)]);
+    McBrickLayout layout(resolution);
+    float* densityValues = new float[layout.Size()];
 
-		glm::vec3 n0 = normals[XyzToId(C, resolution)];
+    McEvalDensity(density, resolution, bounds, cellSizes, numThreads, lipschitz, layout, densityValues);
 
-		//	printf("n0: %f, %f, %f\n",  n0[0], n0[1], n0[2]);
+    McDensityGrid<F> grid = { density, layout, densityValues, resolution, bounds, cellSizes };
 
+    // the same passes as McMeshSlabs(), the slabs just write the twins as well.
+    McSlabCounts counts = McCountSlabs(grid, resolution, numThreads);
 
+    Mesh mesh;
+    mesh.vertices.resize(counts.vertexOffsets.back());
+    mesh.normals.resize(counts.vertexOffsets.back());
+    mesh.faces.resize(counts.faceOffsets.back());
 
-	    }
+    std::vector<HalfEdgeHandle> twins(3 * counts.faceOffsets.back(), INVALID_HANDLE);
 
+    std::vector<McHalfEdgeSlab> slabs;
+    McPlaceSlabs(mesh, counts, slabs);
 
+    const int numSlabs = counts.numSlabs;
 
+    for(int k = 0; k < numSlabs; ++k) {
+	slabs[k].firstFace = slabs[k].faces;
+	slabs[k].twins = twins.data() + 3 * counts.faceOffsets[k];
+    }
 
-    // we iterate through all the cells, and create geometry for them, one by one.
-    for(C[0] = 0; C[0] < (resolution-1); ++C[0])
-	for(C[1] = 0; C[1] < (resolution-1); ++C[1])
-	    for(C[2] = 0; C[2] < (resolution-1); ++C[2]) {
+    McFillSlabs(grid, resolution, bounds, cellSizes, numThreads, counts, slabs);
 
-		int cellIndex = 0;
+    delete[] densityValues;
 
-		// compute the values at the cell vertices, and create the cell index.
-		for(int i = 0; i < 8; ++i) {
+    McGlobalFaces(mesh.faces.data(), counts, slabs, numThreads);
 
-		    gridCellValues[i] = densityValues[XyzToId(C, i, resolution)];
+    // and the twins refer to the half-edges of the whole mesh.
+    if(numSlabs > 1) {
+	ParallelFor(0, numSlabs, numThreads, [&](int k) {
+		const GLuint offset = (GLuint)(3 * counts.faceOffsets[k]);
 
-		    if( gridCellValues[i] > 0 ) {
-			cellIndex |= ( 1 << i );
+		for(size_t h = 3 * counts.faceOffsets[k]; h < 3 * counts.faceOffsets[k+1]; ++h) {
+		    if(twins[h] != INVALID_HANDLE) {
+			twins[h] += offset;
 		    }
 		}
+	    });
+    }
 
-		int edgeTableMask = edgeTable[cellIndex];
+    // the origin and target of a half-edge of the whole mesh.
+    auto origin = [&](GLuint h) { return mesh.faces[h / 3].i[h % 3]; };
+    auto target = [&](GLuint h) { return mesh.faces[h / 3].i[(h % 3 + 1) % 3]; };
 
-		if(edgeTableMask == 0)
-		    continue; // no geometry in this cell!
+    /*
+      Pair up the half-edges between the last layer of every slab and the first
+      layer of the next one.
+    */
+    for(int k = 1; k < numSlabs; ++k) {
 
+	const McHalfEdgeSlab& lower = slabs[k-1];
+	const McHalfEdgeSlab& upper = slabs[k];
 
-		//  for all edges where the surface passes through, we create vertices.
-		// and we keep track of the indices for the vertices through the
-		// array edgeIndices
-		for(int i = 0; i < 12; ++i) {
+	if(!lower.UpperLayer() || !upper.LowerLayer() || upper.LowerLayer()->x != lower.UpperLayer()->x + 1)
+	    continue;
 
-		    if(  ((1 << i) & edgeTableMask) == 0 )
-			continue; // no geometry!
+	const McHalfEdgeSlab::Layer& lowerLayer = *lower.UpperLayer();
+	const McHalfEdgeSlab::Layer& upperLayer = *upper.LowerLayer();
 
-		    int* e = edges[i];
+	size_t cursor = 0;
 
+	for(const McHalfEdgeSlab::Cell& cell : upperLayer.cells) {
 
-		    /*
-		      Only one interpolated vertex between every edge is necessary.
-		      Once we have interpolated and computed one such vertex,
-		      we save its index in the hashmap edgeIndicesCache.
+	    const McHalfEdgeSlab::Cell* below = McHalfEdgeSlab::FindCell(lowerLayer, cursor, cell.y, cell.z);
+	    if(!below)
+		continue;
 
-		      By doing this, the vertexcount of the created geometry is
-		      MUCH lowered.
-		     */
-		    int i0 = XyzToId(C, e[0], resolution);
-		    int i1 = XyzToId(C, e[1], resolution);
-		    std::pair<int,int> pair = sort(i0, i1);
-		    auto value = edgeIndicesCache.find(pair);
+	    for(GLuint i = cell.begin; i < cell.end; ++i) {
 
-		    if(value !=  edgeIndicesCache.end() ) {
-			// we have already computed the vertex between this edge.
-			// so reuse it.
+		GLuint h = (GLuint)(3 * counts.faceOffsets[k]) + upperLayer.halfEdges[i];
 
-			edgeIndices[i] = value->second;
+		for(GLuint j = below->begin; j < below->end && twins[h] == INVALID_HANDLE; ++j) {
 
-		    } else {
+		    GLuint g = (GLuint)(3 * counts.faceOffsets[k-1]) + lowerLayer.halfEdges[j];
 
-			// compute the lerp-factor t.
-			float v0 = gridCellValues[e[0]];
-			float v1 = gridCellValues[e[1]];
-			float d = v0 - v1;
-			float t = 0.0;
-			if(fabs(d) > 0.00001) {
-			    t =v0 / d;
-			}
+		    if(twins[g] == INVALID_HANDLE && origin(g) == target(h) && target(g) == origin(h)) {
+			twins[g] = h;
+			twins[h] = g;
+		    }
+		}
+	    }
+	}
+    }
 
-			float p[3];
+    return HalfEdgeMesh(mesh.vertices, mesh.faces, twins, numThreads);
+}
 
-			// to compute the vertex, we interpolate between the vertices at the edge-point.
 
-			for(int j = 0; j < 3; ++j) {
-			    float e0 = bounds[0][j] + (C[j] + cubeVerticesTable[ e[0]  ][j]) * cellSizes[j];
-			    float e1 = bounds[0][j] + (C[j] + cubeVerticesTable[ e[1]  ][j]) * cellSizes[j];
-			    p[j] = (e1-e0)*t + e0;
-			}
+/*
+  The part of the grid that the streaming marching cubes needs at any one time.
+
+  To create the cells at x, we need the density values of the planes x and x+1.
+  The normals at those planes are found when they are needed, just like for
+  the whole grid. If they are central differences, they need the planes x-1
+  and x+2 as well. So we keep a ring of four density slices.
+*/
+template<typename F>
+class McSliceGrid {
 
+private:
 
-			glm::vec3 n0 = normals[i0];
-			glm::vec3 n1 = normals[i1];
+    const F& m_density;
+    int m_resolution;
+    const float (*m_bounds)[3];
+    const float* m_cellSizes;
 
-			//printf("n0: %f, %f, %f\n",  n0[0], n0[1], n0[2]);
+    // m_values[x % 4] is the density slice at x.
+    std::vector<float> m_values[4];
 
-			glm::vec3 n = glm::normalize((n1-n0)*t + n0);
+public:
 
+    McSliceGrid(const F& density, int resolution, const float bounds[2][3], const float cellSizes[3]):
+	m_density(density), m_resolution(resolution), m_bounds(bounds), m_cellSizes(cellSizes) {
 
-			// now add the interpolated vertex.
-			edgeIndices[i] = index++;
-			mesh.vertices.push_back( glm::vec3(p[0], p[1], p[2])  );
-			mesh.normals.push_back( n  );
+	for(int i = 0; i < 4; ++i) {
+	    m_values[i].resize(resolution*resolution);
+	}
+    }
 
-			edgeIndicesCache[pair] = edgeIndices[i];
+    float Value(int* P)const { return m_values[P[0] % 4][P[1]*m_resolution + P[2]]; }
 
-		    }
+    glm::vec3 Normal(int* P)const {
+	return McDensityNormal(m_density, *this, P, m_resolution, m_bounds, m_cellSizes, 0);
+    }
 
+    // evaluate the density slice at x, overwriting the slice at x-4.
+    void EvalSlice(int x, int numThreads) {
 
+	std::vector<float>& slice = m_values[x % 4];
 
-		}
+	ParallelFor(0, m_resolution, numThreads, [&](int y) {
+
+		std::vector<float> xs, ys, zs;
+
+		EvalDensityRow(
+		    m_density, x, y, m_resolution, m_bounds, m_cellSizes,
+		    xs, ys, zs,
+		    &slice[y*m_resolution]);
+	    });
+    }
+};
+
+/*
+  A sink for MarchingCubesStreaming() that collects the geometry in a mesh.
+*/
+struct McMeshSink {
+    Mesh& mesh;
+
+    McMeshSink(Mesh& mesh): mesh(mesh) {}
 
-		int* tri = triTable[cellIndex];
+    void AddVertex(const glm::vec3& p, const glm::vec3& n) {
+	mesh.vertices.push_back(p);
+	mesh.normals.push_back(n);
+    }
 
-		// finally, we now create all the triangle faces.
-		for(int i = 0; i < 16; i+=3) {
+    void AddFace(GLuint i0, GLuint i1, GLuint i2) {
+	mesh.faces.emplace_back(i0, i1, i2);
+    }
 
-		    if(tri[i] == -1)
-			break; // no more triangles!
+    void EndCell(const int* /* C */) {}
+};
 
-		    int i0 = edgeIndices[ tri[i+0] ];
-		    int i1 = edgeIndices[ tri[i+1] ];
-		    int i2 = edgeIndices[ tri[i+2] ];
+/*
+  A sink for MarchingCubesStreaming() that writes the geometry straight to
+  an OBJ-file, so that it never has to be held in memory. Check IsOpen()
+  before meshing into it, and Close() afterwards, to find out whether the file
+  could be written.
+*/
+class McObjFileSink {
 
-		    mesh.faces.emplace_back(i0, i1, i2);
+private:
 
+    FILE* m_file;
 
-		}
-	    }
+    size_t m_numVertices;
+    size_t m_numFaces;
 
+public:
 
-    printf("vertices: %ld\n", mesh.vertices.size() );
+    McObjFileSink(const char* path): m_numVertices(0), m_numFaces(0) {
+	m_file = fopen(path, "w");
+    }
 
-    printf("normals: %ld\n", mesh.normals.size() );
+    ~McObjFileSink() {
+	Close();
+    }
+
+    bool IsOpen()const { return m_file != nullptr; }
+
+    // returns false if the file was not opened, or if writing it failed.
+    bool Close() {
+	if(!m_file)
+	    return false;
+
+	bool ok = !ferror(m_file);
+	ok = fclose(m_file) == 0 && ok;
+	m_file = nullptr;
+	return ok;
+    }
+
+    size_t NumVertices()const { return m_numVertices; }
+    size_t NumFaces()const { return m_numFaces; }
+
+    void AddVertex(const glm::vec3& p, const glm::vec3& n) {
+	fprintf(m_file, "v %f %f %f\n", p.x, p.y, p.z);
+	fprintf(m_file, "vn %f %f %f\n", n.x, n.y, n.z);
+	++m_numVertices;
+    }
+
+    void AddFace(GLuint i0, GLuint i1, GLuint i2) {
+	// OBJ indices start at 1.
+	fprintf(m_file, "f %u//%u %u//%u %u//%u\n", i0+1, i0+1, i1+1, i1+1, i2+1, i2+1);
+	++m_numFaces;
+    }
+
+    void EndCell(const int* /* C */) {}
+};
 
 /*
-  for(const glm::vec3& p : mesh.vertices ) {
-  printf("p: %f, %f, %f\n", p.x, p.y, p.z );
-  }
+  Like MarchingCubes(), but the density is evaluated one x-slice at a time, and the
+  geometry is handed to the sink S as soon as it is created, rather than collected
+  in a mesh. S has the methods AddVertex(p, n), AddFace(i0, i1, i2) and EndCell(C),
+  just like for MarchingCubesLayer().
+
+  Only a few slices are kept in memory, so the memory use is O(resolution^2) instead
+  of O(resolution^3). The geometry is the same as what MarchingCubes() creates, and
+  it is created in the same order.
+
+  numThreads is the number of threads used to evaluate every slice.
 */
+template<typename F, typename S>
+void MarchingCubesStreaming(
+    const F& density,
 
-//    printf("faces: %ld\n", mesh.faces.size() );
-    printf("faces: %ld\n", mesh.faces.size() );
+    const int resolution,
 
-    delete[] densityValues;
+    const float xMin, const float xMax,
+    const float yMin, const float yMax,
+    const float zMin, const float zMax,
 
-    return mesh;
+    S& sink,
+
+    const int numThreads = 1
+    ) {
+
+    float bounds[2][3] = {
+	{ xMin, yMin, zMin },
+	{ xMax, yMax, zMax },
+    };
+
+    // the sizes of the cells.
+    float cellSizes[3];
+
+    for(int i = 0; i < 3; ++i) {
+	cellSizes[i] = (bounds[1][i] - bounds[0][i]) / (float)(resolution-1);
+    }
+
+    McSliceGrid<F> grid(density, resolution, bounds, cellSizes);
+    EdgeVertexCache edgeIndicesCache(resolution);
+
+    GLuint index = 0;
+
+    // the next density slice to compute.
+    int nextSlice = 0;
+
+    for(int x = 0; x < (resolution-1); ++x) {
+
+	// the normals at x+1 need the density values at x+2.
+	for(; nextSlice <= std::min(x+2, resolution-1); ++nextSlice) {
+	    grid.EvalSlice(nextSlice, numThreads);
+	}
+
+	MarchingCubesLayer(
+	    grid, resolution, bounds, cellSizes,
+	    x, false,
+	    edgeIndicesCache, index, sink);
+
+	edgeIndicesCache.Advance();
+    }
 }
@@ -1,10 +1,12 @@
+#pragma once
 
+#include "mesh.hpp"
 
-#include "gl_common.hpp"
+// The tables are const, so that every file that includes them gets its own copy.
 
 // Thank you Paul Bourke!
 // http://paulbourke.net/geometry/polygonise/
-int edgeTable[256]={
+const int edgeTable[256]={
 0x0  , 0x109, 0x203, 0x30a, 0x406, 0x50f, 0x605, 0x70c,
 0x80c, 0x905, 0xa0f, 0xb06, 0xc0a, 0xd03, 0xe09, 0xf00,
 0x190, 0x99 , 0x393, 0x29a, 0x596, 0x49f, 0x795, 0x69c,
@@ -40,7 +42,7 @@ int edgeTable[256]={
 
 // Thank you Paul Bourke!
 // http://paulbourke.net/geometry/polygonise/
-int triTable[256][16] =
+const int triTable[256][16] =
 {{-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
 {0, 8, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
 {0, 1, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
@@ -299,7 +301,7 @@ int triTable[256][16] =
 {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1}};
 
 
-int cubeVerticesTable[8][3] =
+const int cubeVerticesTable[8][3] =
 {
     {0,0,0},
     {1,0,0},
@@ -312,7 +314,7 @@ int cubeVerticesTable[8][3] =
     {0,1,1},
 };
 
-int edges[12][2] = {
+const int edges[12][2] = {
     {0,1},
     {1,2},
     {2,3},
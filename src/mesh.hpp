@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include "glm/gtx/string_cast.hpp"
+
+/*
+  The meshes, and everything that makes and changes them, do not need OpenGL,
+  so that they can also be built without it, see sculpt-cli. GLuint is the same
+  type that glad declares, so this is fine to include next to glad.h.
+*/
+typedef unsigned int GLuint;
+
+struct Tri {
+
+public:
+    GLuint i[3];
+
+    Tri(GLuint i0, GLuint i1, GLuint i2):
+	i{i0,i1,i2}{
+    }
+
+    Tri() {}
+};
+
+class VertexFaces;
+
+struct Mesh {
+
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::vec3> normals;
+    std::vector<Tri> faces;
+
+    /*
+      Whether the normals are the ones that ComputeNormals() gathers from the
+      faces. Only then can they be updated for just the vertices that moved,
+      marching cubes for one gives the gradients of the density instead.
+    */
+    bool normalsFromFaces = false;
+
+    /*
+      The faces around every vertex, kept with the mesh so that they only have to
+      be found once for every topology, see Sweep(). Whatever changes the faces
+      must reset it.
+    */
+    std::shared_ptr<const VertexFaces> vertexFaces;
+
+    GLuint indexVbo;
+    GLuint vertexVbo;
+    GLuint normalVbo;
+
+    void Print() {
+
+	for(const glm::vec3& v: vertices ) {
+	    printf("vertex: %s\n",  glm::to_string(v).c_str() );
+	}
+
+	printf("\n");
+	for(const glm::vec3& n: normals ) {
+	    printf("normals: %s\n",  glm::to_string(n).c_str() );
+	}
+
+	printf("\n");
+	for(Tri t: faces ) {
+	    printf("indices: %d, %d, %d\n",  t.i[0], t.i[1], t.i[2] );
+	}
+
+    }
+
+};
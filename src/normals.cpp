@@ -0,0 +1,226 @@
+#include "normals.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <atomic>
+
+// the number of items that a thread grabs at a time.
+const size_t NORMALS_BLOCK_SIZE = 1 << 12;
+
+/*
+  Like when building a HalfEdgeMesh: count the faces of every vertex, scan the
+  counts to find where every vertex starts, and then put the faces in place.
+  The faces land in the rows in whatever order the threads got to them, so
+  every row is sorted afterwards. That way, the normals are summed in the same
+  order whatever the number of threads is, and come out exactly the same.
+*/
+VertexFaces::VertexFaces(const Mesh& mesh, int numThreads) {
+
+    const size_t numVertices = mesh.vertices.size();
+    const size_t numFaces = mesh.faces.size();
+
+    if(NumThreads(numThreads) == 1) {
+	// on one thread, there is no need for the atomics, and the faces land in the rows in increasing order.
+	m_start.assign(numVertices + 1, 0);
+
+	for(size_t f = 0; f < numFaces; ++f) {
+	    for(int i = 0; i < 3; ++i) {
+		++m_start[mesh.faces[f].i[i] + 1];
+	    }
+	}
+
+	for(size_t v = 0; v < numVertices; ++v) {
+	    m_start[v + 1] += m_start[v];
+	}
+
+	m_faces.resize(m_start[numVertices]);
+
+	std::vector<GLuint> cursor(m_start.begin(), m_start.end() - 1);
+
+	for(size_t f = 0; f < numFaces; ++f) {
+	    for(int i = 0; i < 3; ++i) {
+		m_faces[cursor[mesh.faces[f].i[i]]++] = (GLuint)f;
+	    }
+	}
+
+	return;
+    }
+
+    std::vector<std::atomic<GLuint> > cursor(numVertices);
+
+    ParallelForBlocks(0, numVertices, NORMALS_BLOCK_SIZE, numThreads, [&](size_t begin, size_t end) {
+	    for(size_t v = begin; v < end; ++v) {
+		cursor[v].store(0, std::memory_order_relaxed);
+	    }
+	});
+
+    ParallelForBlocks(0, numFaces, NORMALS_BLOCK_SIZE, numThreads, [&](size_t begin, size_t end) {
+	    for(size_t f = begin; f < end; ++f) {
+		for(int i = 0; i < 3; ++i) {
+		    cursor[mesh.faces[f].i[i]].fetch_add(1, std::memory_order_relaxed);
+		}
+	    }
+	});
+
+    m_start.resize(numVertices + 1);
+
+    ParallelForBlocks(0, numVertices, NORMALS_BLOCK_SIZE, numThreads, [&](size_t begin, size_t end) {
+	    for(size_t v = begin; v < end; ++v) {
+		m_start[v] = cursor[v].load(std::memory_order_relaxed);
+	    }
+	});
+    m_start[numVertices] = 0;
+
+    m_faces.resize(ExclusiveScan(m_start, NORMALS_BLOCK_SIZE, numThreads));
+
+    ParallelForBlocks(0, numVertices, NORMALS_BLOCK_SIZE, numThreads, [&](size_t begin, size_t end) {
+	    for(size_t v = begin; v < end; ++v) {
+		cursor[v].store(m_start[v], std::memory_order_relaxed);
+	    }
+	});
+
+    ParallelForBlocks(0, numFaces, NORMALS_BLOCK_SIZE, numThreads, [&](size_t begin, size_t end) {
+	    for(size_t f = begin; f < end; ++f) {
+		for(int i = 0; i < 3; ++i) {
+		    m_faces[cursor[mesh.faces[f].i[i]].fetch_add(1, std::memory_order_relaxed)] = (GLuint)f;
+		}
+	    }
+	});
+
+    ParallelForBlocks(0, numVertices, NORMALS_BLOCK_SIZE, numThreads, [&](size_t begin, size_t end) {
+	    for(size_t v = begin; v < end; ++v) {
+		auto first = m_faces.begin() + m_start[v];
+		auto last = m_faces.begin() + m_start[v + 1];
+		if(!std::is_sorted(first, last))
+		    std::sort(first, last);
+	    }
+	});
+}
+
+static glm::vec3 FaceNormal(const Mesh& mesh, GLuint f) {
+
+    const Tri& tri = mesh.faces[f];
+
+    glm::vec3 p0 = mesh.vertices[tri.i[0]];
+    glm::vec3 p1 = mesh.vertices[tri.i[1]];
+    glm::vec3 p2 = mesh.vertices[tri.i[2]];
+
+    glm::vec3 n = glm::cross(p2 - p0, p1 - p0);
+    float lengthSquared = glm::dot(n, n);
+
+    // a degenerate face has no normal, leave it out rather than making the sum NaN.
+    return lengthSquared > 0.0f ? n * glm::inversesqrt(lengthSquared) : glm::vec3(0.0f);
+}
+
+static glm::vec3 Normalize(const glm::vec3& sum) {
+    float lengthSquared = glm::dot(sum, sum);
+    return lengthSquared > 0.0f ? sum * glm::inversesqrt(lengthSquared) : sum;
+}
+
+static std::vector<glm::vec3> FaceNormals(const Mesh& mesh, int numThreads) {
+
+    std::vector<glm::vec3> faceNormals(mesh.faces.size());
+
+    ParallelForBlocks(0, mesh.faces.size(), NORMALS_BLOCK_SIZE, numThreads, [&](size_t begin, size_t end) {
+	    for(size_t f = begin; f < end; ++f) {
+		faceNormals[f] = FaceNormal(mesh, (GLuint)f);
+	    }
+	});
+
+    return faceNormals;
+}
+
+/*
+  Every face normal is found once, and then summed by the vertices. The faces of
+  a vertex are summed in increasing order, just like the other ComputeNormals
+  does, so they give exactly the same normals.
+*/
+void ComputeNormals(Mesh& mesh, const VertexFaces& vertexFaces, int numThreads) {
+
+    std::vector<glm::vec3> faceNormals = FaceNormals(mesh, numThreads);
+
+    mesh.normals.resize(mesh.vertices.size());
+
+    ParallelForBlocks(0, mesh.vertices.size(), NORMALS_BLOCK_SIZE, numThreads, [&](size_t begin, size_t end) {
+	    for(size_t v = begin; v < end; ++v) {
+		glm::vec3 sum(0.0f);
+		for(const GLuint* f = vertexFaces.FacesBegin((GLuint)v); f != vertexFaces.FacesEnd((GLuint)v); ++f) {
+		    sum += faceNormals[*f];
+		}
+		mesh.normals[v] = Normalize(sum);
+	    }
+	});
+
+    mesh.normalsFromFaces = true;
+}
+
+/*
+  On one thread, building the VertexFaces does not pay off when it is only used
+  once, and the face normals are scattered to their corners instead. With more
+  threads, it is built so that the normals can be gathered in parallel.
+*/
+void ComputeNormals(Mesh& mesh, int numThreads) {
+
+    if(mesh.vertexFaces && mesh.vertexFaces->Matches(mesh)) {
+	ComputeNormals(mesh, *mesh.vertexFaces, numThreads);
+	return;
+    }
+
+    if(NumThreads(numThreads) > 1) {
+	std::shared_ptr<const VertexFaces> vertexFaces = std::make_shared<VertexFaces>(mesh, numThreads);
+	ComputeNormals(mesh, *vertexFaces, numThreads);
+	mesh.vertexFaces = vertexFaces;
+	return;
+    }
+
+    std::vector<glm::vec3> faceNormals = FaceNormals(mesh, numThreads);
+
+    mesh.normals.assign(mesh.vertices.size(), glm::vec3(0.0f));
+
+    for(size_t f = 0; f < mesh.faces.size(); ++f) {
+	for(int i = 0; i < 3; ++i) {
+	    mesh.normals[mesh.faces[f].i[i]] += faceNormals[f];
+	}
+    }
+
+    ParallelForBlocks(0, mesh.vertices.size(), NORMALS_BLOCK_SIZE, numThreads, [&](size_t begin, size_t end) {
+	    for(size_t v = begin; v < end; ++v) {
+		mesh.normals[v] = Normalize(mesh.normals[v]);
+	    }
+	});
+
+    mesh.normalsFromFaces = true;
+}
+
+void UpdateNormals(Mesh& mesh, const VertexFaces& vertexFaces, const std::vector<GLuint>& moved, int numThreads) {
+
+    /*
+      The faces around a moved vertex turned, and so did the normals of all their
+      corners. Those are marked as they are found, rather than collected and
+      sorted, which was most of the time of an update.
+    */
+    std::vector<char> marked(mesh.vertices.size(), 0);
+    std::vector<GLuint> changed;
+
+    for(GLuint v : moved) {
+	for(const GLuint* f = vertexFaces.FacesBegin(v); f != vertexFaces.FacesEnd(v); ++f) {
+	    for(GLuint corner : mesh.faces[*f].i) {
+		if(!marked[corner]) {
+		    marked[corner] = 1;
+		    changed.push_back(corner);
+		}
+	    }
+	}
+    }
+
+    ParallelForBlocks(0, changed.size(), NORMALS_BLOCK_SIZE, numThreads, [&](size_t begin, size_t end) {
+	    for(size_t i = begin; i < end; ++i) {
+		GLuint v = changed[i];
+		glm::vec3 sum(0.0f);
+		for(const GLuint* f = vertexFaces.FacesBegin(v); f != vertexFaces.FacesEnd(v); ++f) {
+		    sum += FaceNormal(mesh, *f);
+		}
+		mesh.normals[v] = Normalize(sum);
+	    }
+	});
+}
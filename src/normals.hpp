@@ -0,0 +1,66 @@
+#pragma once
+
+#include "mesh.hpp"
+
+/*
+  The faces around every vertex of a Mesh, stored back to back: the faces of
+  vertex v are m_faces[m_start[v]] to m_faces[m_start[v+1]-1], in increasing
+  order. This is only built once for every topology, and then a normal can be
+  gathered from the faces around its vertex, so that the normals can be found
+  in parallel, without two threads ever writing to the same normal.
+
+  When the faces of the mesh change, it must be built again. Moving the
+  vertices is fine. Matches() catches a mesh that got more or fewer of them.
+*/
+class VertexFaces {
+
+private:
+
+    std::vector<GLuint> m_start;
+    std::vector<GLuint> m_faces;
+
+public:
+
+    VertexFaces(const Mesh& mesh, int numThreads = 1);
+
+    size_t NumVertices()const {
+	return m_start.size() - 1;
+    }
+
+    size_t NumFaces()const {
+	return m_faces.size() / 3;
+    }
+
+    bool Matches(const Mesh& mesh)const {
+	return NumVertices() == mesh.vertices.size() && NumFaces() == mesh.faces.size();
+    }
+
+    const GLuint* FacesBegin(GLuint v)const {
+	return m_faces.data() + m_start[v];
+    }
+
+    const GLuint* FacesEnd(GLuint v)const {
+	return m_faces.data() + m_start[v + 1];
+    }
+};
+
+/*
+  The normal of a vertex is the normalized sum of the unit normals of the
+  faces around it. This computes all of them, and replaces mesh.normals. 0
+  threads means one per hardware thread.
+*/
+void ComputeNormals(Mesh& mesh, const VertexFaces& vertexFaces, int numThreads = 1);
+
+/*
+  The same, for when there is no VertexFaces. If one is built to do it, it is
+  kept in mesh.vertexFaces.
+*/
+void ComputeNormals(Mesh& mesh, int numThreads = 1);
+
+/*
+  After the vertices in moved have been moved, only the normals of those
+  vertices and of their neighbours have changed. This recomputes only those,
+  so the cost depends on how many vertices were moved, not on the size of the
+  mesh. mesh.normals must already hold the normals from before the move.
+*/
+void UpdateNormals(Mesh& mesh, const VertexFaces& vertexFaces, const std::vector<GLuint>& moved, int numThreads = 1);
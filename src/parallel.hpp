@@ -0,0 +1,229 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+/*
+  Resolve a thread count knob. 0 means one thread per hardware thread.
+*/
+inline int NumThreads(int numThreads) {
+
+    if(numThreads > 0)
+	return numThreads;
+
+    int n = (int)std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+/*
+  The threads that ParallelFor() runs on. They are started the first time they
+  are needed, and then wait for the next job, so that a loop that calls
+  ParallelFor() for every step, like the sweep, does not start and join new
+  threads every step.
+
+  Run(numThreads, job) calls job on the calling thread and on numThreads-1 of
+  the pool threads, and returns when they are all done. One job runs at a
+  time. A ParallelFor() inside of a job is run on the thread that calls it.
+*/
+class ThreadPool {
+
+private:
+
+    std::mutex m_runMutex; // held for the whole of a Run().
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+
+    std::vector<std::thread> m_threads;
+
+    const std::function<void()>* m_job;
+    unsigned long m_generation; // counts the jobs, so that a thread joins every job at most once.
+    int m_wanted; // the number of threads that still have to join the job.
+    int m_running; // the number of threads that have not finished the job yet.
+    bool m_stop;
+
+    static bool& InJobFlag() {
+	static thread_local bool inJob = false;
+	return inJob;
+    }
+
+    void Work() {
+	InJobFlag() = true;
+
+	unsigned long seen = 0;
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	for(;;) {
+	    m_wake.wait(lock, [&]() { return m_stop || (m_wanted > 0 && m_generation != seen); });
+
+	    if(m_stop)
+		return;
+
+	    seen = m_generation;
+	    --m_wanted;
+	    const std::function<void()>* job = m_job;
+
+	    lock.unlock();
+	    (*job)();
+	    lock.lock();
+
+	    if(--m_running == 0)
+		m_done.notify_one();
+	}
+    }
+
+    ThreadPool(): m_job(nullptr), m_generation(0), m_wanted(0), m_running(0), m_stop(false) {}
+
+public:
+
+    ~ThreadPool() {
+	{
+	    std::lock_guard<std::mutex> lock(m_mutex);
+	    m_stop = true;
+	}
+	m_wake.notify_all();
+
+	for(std::thread& thread : m_threads) {
+	    thread.join();
+	}
+    }
+
+    static ThreadPool& Get() {
+	static ThreadPool pool;
+	return pool;
+    }
+
+    // whether the calling thread is running a job.
+    static bool InJob() {
+	return InJobFlag();
+    }
+
+    void Run(int numThreads, const std::function<void()>& job) {
+
+	std::lock_guard<std::mutex> runLock(m_runMutex);
+
+	{
+	    std::lock_guard<std::mutex> lock(m_mutex);
+
+	    while((int)m_threads.size() < numThreads - 1) {
+		m_threads.emplace_back([this]() { Work(); });
+	    }
+
+	    m_job = &job;
+	    ++m_generation;
+	    m_wanted = numThreads - 1;
+	    m_running = numThreads - 1;
+	}
+	m_wake.notify_all();
+
+	// the calling thread does its share too.
+	InJobFlag() = true;
+	job();
+	InJobFlag() = false;
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_done.wait(lock, [&]() { return m_running == 0; });
+	m_job = nullptr;
+    }
+};
+
+/*
+  Call f(i) for every i in [begin, end), using numThreads threads of the
+  ThreadPool.
+
+  The items are not split up front. Instead, every thread grabs the next
+  unprocessed item from a shared counter, so a thread that got cheap items
+  (say, empty slabs of a grid) simply goes on to steal more of the work,
+  and the load stays balanced even when the cost of the items varies a lot.
+  The items are coarse, slabs or blocks of thousands of elements, so the
+  counter is not contended, and per-thread queues to steal from would not
+  gain anything over it.
+
+  f must be safe to call concurrently for different i.
+*/
+template<typename F>
+void ParallelFor(int begin, int end, int numThreads, const F& f) {
+
+    numThreads = std::min(NumThreads(numThreads), end - begin);
+
+    if(numThreads <= 1 || ThreadPool::InJob()) {
+	for(int i = begin; i < end; ++i) {
+	    f(i);
+	}
+	return;
+    }
+
+    std::atomic<int> next(begin);
+
+    std::function<void()> worker = [&]() {
+	for(int i = next++; i < end; i = next++) {
+	    f(i);
+	}
+    };
+
+    ThreadPool::Get().Run(numThreads, worker);
+}
+
+/*
+  Call f(blockBegin, blockEnd) for consecutive blocks of blockSize items that
+  cover [begin, end). Useful when the work per item is too small to be worth
+  grabbing items one by one.
+*/
+template<typename F>
+void ParallelForBlocks(size_t begin, size_t end, size_t blockSize, int numThreads, const F& f) {
+
+    if(end <= begin)
+	return;
+
+    int numBlocks = (int)((end - begin + blockSize - 1) / blockSize);
+
+    ParallelFor(0, numBlocks, numThreads, [&](int block) {
+	    size_t blockBegin = begin + (size_t)block * blockSize;
+	    f(blockBegin, std::min(blockBegin + blockSize, end));
+	});
+}
+
+/*
+  Replace every value by the sum of the values before it, and return the total.
+  The sums of the blocks are found in parallel, then the blocks are scanned in
+  parallel, each starting from the sum of the blocks before it.
+*/
+template<typename T>
+T ExclusiveScan(std::vector<T>& values, size_t blockSize, int numThreads) {
+
+    const size_t n = values.size();
+    std::vector<T> blockSums((n + blockSize - 1) / blockSize);
+
+    ParallelForBlocks(0, n, blockSize, numThreads, [&](size_t begin, size_t end) {
+	    T sum = 0;
+	    for(size_t i = begin; i < end; ++i) {
+		sum += values[i];
+	    }
+	    blockSums[begin / blockSize] = sum;
+	});
+
+    T total = 0;
+    for(T& sum : blockSums) {
+	T blockSum = sum;
+	sum = total;
+	total += blockSum;
+    }
+
+    ParallelForBlocks(0, n, blockSize, numThreads, [&](size_t begin, size_t end) {
+	    T sum = blockSums[begin / blockSize];
+	    for(size_t i = begin; i < end; ++i) {
+		T value = values[i];
+		values[i] = sum;
+		sum += value;
+	    }
+	});
+
+    return total;
+}
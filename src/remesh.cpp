@@ -0,0 +1,515 @@
+#include "remesh.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+
+// the number of items that a thread grabs at a time.
+const size_t REMESH_BLOCK_SIZE = 1 << 12;
+
+static float Length(const HalfEdgeMesh& mesh, EdgeHandle e) {
+    glm::vec3 a;
+    glm::vec3 b;
+    mesh.GetEdgePoints(e, a, b);
+    return glm::length(a - b);
+}
+
+// the two ends a and b of the edge, and the vertices c and d opposite to it.
+static void EdgeQuad(const HalfEdgeMesh& mesh, EdgeHandle e, VertexHandle* quad) {
+    const HalfEdge& h0 = mesh.GetHalfEdge(mesh.GetEdge(e).halfEdge);
+    const HalfEdge& h3 = mesh.GetHalfEdge(h0.twin);
+
+    quad[0] = h0.vertex;
+    quad[1] = h3.vertex;
+    quad[2] = mesh.GetHalfEdge(mesh.GetHalfEdge(h0.next).next).vertex;
+    quad[3] = mesh.GetHalfEdge(mesh.GetHalfEdge(h3.next).next).vertex;
+}
+
+bool LongestEdge(const HalfEdgeMesh& mesh, EdgeHandle e) {
+
+    VertexHandle quad[4];
+    EdgeQuad(mesh, e, quad);
+
+    glm::vec3 pa = mesh.GetVertex(quad[0]).p;
+    glm::vec3 pb = mesh.GetVertex(quad[1]).p;
+
+    float length = glm::length(pa - pb);
+
+    for(int i = 2; i < 4; ++i) {
+	glm::vec3 p = mesh.GetVertex(quad[i]).p;
+
+	if(glm::length(p - pa) > length || glm::length(p - pb) > length)
+	    return false;
+    }
+
+    return true;
+}
+
+bool GoodCollapse(const HalfEdgeMesh& mesh, EdgeHandle e, float maxLength) {
+
+    const HalfEdge& h0 = mesh.GetHalfEdge(mesh.GetEdge(e).halfEdge);
+
+    glm::vec3 m = (mesh.GetVertex(h0.vertex).p + mesh.GetVertex(mesh.GetHalfEdge(h0.twin).vertex).p) * 0.5f;
+
+    return GoodCollapse(mesh, e, m, maxLength);
+}
+
+bool GoodCollapse(const HalfEdgeMesh& mesh, EdgeHandle e, const glm::vec3& m, float maxLength) {
+
+    const HalfEdge& h0 = mesh.GetHalfEdge(mesh.GetEdge(e).halfEdge);
+    VertexHandle ends[2] = { h0.vertex, mesh.GetHalfEdge(h0.twin).vertex };
+
+    for(VertexHandle v : ends) {
+
+	glm::vec3 p = mesh.GetVertex(v).p;
+
+	for(HalfEdgeHandle h : mesh.Outgoing(v)) {
+	    // the triangle (v, b, c).
+	    const HalfEdge& next = mesh.GetHalfEdge(mesh.GetHalfEdge(h).next);
+	    VertexHandle b = next.vertex;
+	    VertexHandle c = mesh.GetHalfEdge(next.next).vertex;
+
+	    if(b == ends[0] || b == ends[1] || c == ends[0] || c == ends[1])
+		continue; // removed by the collapse.
+
+	    glm::vec3 pb = mesh.GetVertex(b).p;
+	    glm::vec3 pc = mesh.GetVertex(c).p;
+
+	    if(glm::length(pb - m) > maxLength)
+		return false;
+
+	    // a triangle that is already degenerate, like the slivers of marching cubes, may go anywhere.
+	    glm::vec3 before = glm::cross(pb - p, pc - p);
+	    glm::vec3 after = glm::cross(pb - m, pc - m);
+
+	    if(glm::dot(before, after) <= 0.0f && glm::dot(before, before) > 0.0f)
+		return false;
+	}
+    }
+
+    return true;
+}
+
+int FlipGain(const HalfEdgeMesh& mesh, EdgeHandle e) {
+
+    VertexHandle quad[4];
+    EdgeQuad(mesh, e, quad);
+
+    // a and b lose an edge, and c and d get one.
+    int before = 0;
+    int after = 0;
+
+    for(int i = 0; i < 4; ++i) {
+	int degree = mesh.Degree(quad[i]);
+	before += std::abs(degree - 6);
+	after += std::abs(degree + (i < 2 ? -1 : +1) - 6);
+    }
+
+    if(after >= before)
+	return 0;
+
+    glm::vec3 pa = mesh.GetVertex(quad[0]).p;
+    glm::vec3 pb = mesh.GetVertex(quad[1]).p;
+    glm::vec3 pc = mesh.GetVertex(quad[2]).p;
+    glm::vec3 pd = mesh.GetVertex(quad[3]).p;
+
+    // the new triangles (c, a, d) and (d, b, c) must face the same way as the old ones.
+    glm::vec3 n = glm::cross(pb - pa, pc - pa) + glm::cross(pa - pb, pd - pb);
+
+    if(glm::dot(glm::cross(pa - pc, pd - pc), n) <= 0.0f ||
+       glm::dot(glm::cross(pb - pd, pc - pd), n) <= 0.0f)
+	return 0;
+
+    return before - after;
+}
+
+float MeanEdgeLength(const HalfEdgeMesh& mesh) {
+
+    double sum = 0.0;
+
+    for(EdgeIter it = mesh.beginEdges(); it != mesh.endEdges(); ++it) {
+	sum += Length(mesh, *it);
+    }
+
+    return mesh.NumEdges() > 0 ? (float)(sum / mesh.NumEdges()) : 0.0f;
+}
+
+/*
+  A priority that orders by level first, from 0 to 255, and among the edges of
+  the same level, in an order scrambled by a hash of the edge. Neighbouring
+  edges have about the same level, and if they were ordered by it exactly, a
+  chain of them could only be done one at a time, one per round. The hash
+  breaks such chains up.
+*/
+static GLuint HashPriority(GLuint level, EdgeHandle e) {
+    return (level << 24) | ((e * 2654435761u) >> 8);
+}
+
+// the level of an edge of the length, in steps of 1/16 of the target edge length.
+static GLuint LengthLevel(float length, float edgeLength) {
+    return (GLuint)std::min(length / edgeLength * 16.0f, 255.0f);
+}
+
+/*
+  Add the edges of all the triangles around the vertex to edges. Unlike
+  GetOutgoing(), this also works for a vertex on the boundary.
+*/
+static void AddEdgesAround(const HalfEdgeMesh& mesh, VertexHandle v, std::vector<EdgeHandle>& edges) {
+
+    const HalfEdgeHandle start = mesh.GetVertex(v).halfEdge;
+    HalfEdgeHandle h = start;
+
+    // turn one way, until we are back at the start, or hit the boundary.
+    bool boundary = false;
+    do {
+	const HalfEdge& halfEdge = mesh.GetHalfEdge(h);
+	edges.push_back(halfEdge.edge);
+	edges.push_back(mesh.GetHalfEdge(halfEdge.next).edge);
+
+	if(halfEdge.twin == INVALID_HANDLE) {
+	    boundary = true;
+	    break;
+	}
+	h = mesh.GetHalfEdge(halfEdge.twin).next;
+
+    } while(h != start);
+
+    if(!boundary)
+	return;
+
+    // on the boundary, also turn the other way from the start.
+    h = start;
+    for(;;) {
+	// the half-edge going into v in the same triangle.
+	HalfEdgeHandle in = mesh.GetHalfEdge(mesh.GetHalfEdge(h).next).next;
+	HalfEdgeHandle twin = mesh.GetHalfEdge(in).twin;
+
+	if(twin == INVALID_HANDLE)
+	    break;
+
+	h = twin;
+	edges.push_back(mesh.GetHalfEdge(h).edge);
+	edges.push_back(mesh.GetHalfEdge(mesh.GetHalfEdge(h).next).edge);
+    }
+}
+
+/*
+  Do an operation on edges, in rounds, until no edge wants it anymore.
+
+  candidate(e, priority) says whether the edge e wants the operation, and with
+  what priority. lock(e, vertices) adds the vertices that doing the operation on
+  e reads or changes, which must include the vertices of the two triangles of
+  e. Both only read the mesh, and are called in parallel.
+
+  Every candidate tries to grab its vertices, by putting its key, the priority
+  and the edge, in them, if it is larger than the key there. The candidates that
+  got all of their vertices touch no other candidate that did, so
+  apply(edges) can do the operation on them all in parallel.
+
+  The candidate with the largest key always gets all of its vertices, so every
+  round makes progress. Returns the number of operations.
+
+  The first round looks at all the edges. After that, only the edges whose
+  triangles have a grabbed vertex are looked at again. That is enough if an
+  operation only changes the triangles around, and the positions of, the
+  vertices it grabbed, and candidate() and lock() only read the triangles
+  around the vertices of the two triangles of the edge. The other candidates
+  that lost go on to the next round as they are, with the same key and
+  vertices.
+*/
+template<typename Candidate, typename Lock, typename Apply>
+static int Rounds(
+    HalfEdgeMesh& mesh, int numThreads,
+    const Candidate& candidate, const Lock& lock, const Apply& apply) {
+
+    int total = 0;
+
+    // the edges to look at, in increasing order.
+    std::vector<EdgeHandle> scan(mesh.NumEdgeHandles());
+    for(GLuint e = 0; e < scan.size(); ++e) {
+	scan[e] = e;
+    }
+
+    /*
+      The keys of the candidates. The edge is stored plus one, so that no key is
+      0. The vertices of keys[i] are vertices[offsets[i]] up to
+      vertices[offsets[i + 1]].
+    */
+    std::vector<unsigned long long> keys;
+    std::vector<VertexHandle> vertices;
+    std::vector<size_t> offsets(1, 0);
+
+    auto Edge = [&](unsigned long long key) { return (EdgeHandle)((key & 0xffffffff) - 1); };
+
+    for(;;) {
+
+	struct Block {
+	    std::vector<unsigned long long> keys;
+	    std::vector<VertexHandle> vertices;
+	    std::vector<size_t> ends;
+	};
+	std::vector<Block> blocks((scan.size() + REMESH_BLOCK_SIZE - 1) / REMESH_BLOCK_SIZE);
+
+	ParallelForBlocks(0, scan.size(), REMESH_BLOCK_SIZE, numThreads, [&](size_t begin, size_t end) {
+		Block& block = blocks[begin / REMESH_BLOCK_SIZE];
+
+		for(size_t i = begin; i < end; ++i) {
+		    EdgeHandle e = scan[i];
+		    GLuint priority;
+
+		    if(!mesh.GetEdge(e).Removed() && candidate(e, priority)) {
+			block.keys.push_back(((unsigned long long)priority << 32) | (e + 1));
+			lock(e, block.vertices);
+			block.ends.push_back(block.vertices.size());
+		    }
+		}
+	    });
+
+	for(const Block& block : blocks) {
+	    size_t base = vertices.size();
+
+	    keys.insert(keys.end(), block.keys.begin(), block.keys.end());
+	    vertices.insert(vertices.end(), block.vertices.begin(), block.vertices.end());
+	    for(size_t end : block.ends) {
+		offsets.push_back(base + end);
+	    }
+	}
+
+	if(keys.empty())
+	    break;
+
+	std::vector<std::atomic<unsigned long long> > locks(mesh.NumVertexHandles());
+
+	ParallelForBlocks(0, locks.size(), REMESH_BLOCK_SIZE, numThreads, [&](size_t begin, size_t end) {
+		for(size_t v = begin; v < end; ++v) {
+		    locks[v].store(0, std::memory_order_relaxed);
+		}
+	    });
+
+	ParallelForBlocks(0, keys.size(), REMESH_BLOCK_SIZE, numThreads, [&](size_t begin, size_t end) {
+		for(size_t i = begin; i < end; ++i) {
+		    for(size_t j = offsets[i]; j < offsets[i + 1]; ++j) {
+			std::atomic<unsigned long long>& vertexLock = locks[vertices[j]];
+			unsigned long long current = vertexLock.load(std::memory_order_relaxed);
+			while(current < keys[i] && !vertexLock.compare_exchange_weak(current, keys[i], std::memory_order_relaxed)) {
+			}
+		    }
+		}
+	    });
+
+	std::vector<GLuint> won(keys.size());
+
+	ParallelForBlocks(0, keys.size(), REMESH_BLOCK_SIZE, numThreads, [&](size_t begin, size_t end) {
+		for(size_t i = begin; i < end; ++i) {
+		    won[i] = 1;
+		    for(size_t j = offsets[i]; j < offsets[i + 1]; ++j) {
+			if(locks[vertices[j]].load(std::memory_order_relaxed) != keys[i])
+			    won[i] = 0;
+		    }
+		}
+	    });
+
+	std::vector<EdgeHandle> edges;
+
+	// the vertices whose triangles, or positions, the operations may change.
+	std::vector<char> grabbed(mesh.NumVertexHandles(), 0);
+
+	for(size_t i = 0; i < keys.size(); ++i) {
+	    if(won[i]) {
+		edges.push_back(Edge(keys[i]));
+		for(size_t j = offsets[i]; j < offsets[i + 1]; ++j) {
+		    grabbed[vertices[j]] = 1;
+		}
+	    }
+	}
+
+	std::vector<unsigned long long> nextKeys;
+	std::vector<VertexHandle> nextVertices;
+	std::vector<size_t> nextOffsets(1, 0);
+	scan.clear();
+
+	for(size_t i = 0; i < keys.size(); ++i) {
+	    if(won[i])
+		continue;
+
+	    VertexHandle quad[4];
+	    EdgeQuad(mesh, Edge(keys[i]), quad);
+
+	    if(grabbed[quad[0]] || grabbed[quad[1]] || grabbed[quad[2]] || grabbed[quad[3]]) {
+		scan.push_back(Edge(keys[i]));
+	    } else {
+		nextKeys.push_back(keys[i]);
+		nextVertices.insert(nextVertices.end(), vertices.begin() + offsets[i], vertices.begin() + offsets[i + 1]);
+		nextOffsets.push_back(nextVertices.size());
+	    }
+	}
+
+	apply(edges);
+	total += (int)edges.size();
+
+	for(size_t v = 0; v < grabbed.size(); ++v) {
+	    if(grabbed[v] && !mesh.GetVertex((VertexHandle)v).Removed())
+		AddEdgesAround(mesh, (VertexHandle)v, scan);
+	}
+
+	std::sort(scan.begin(), scan.end());
+	scan.erase(std::unique(scan.begin(), scan.end()), scan.end());
+
+	keys.swap(nextKeys);
+	vertices.swap(nextVertices);
+	offsets.swap(nextOffsets);
+    }
+
+    return total;
+}
+
+// the vertices of the two triangles of the edge.
+static void LockQuad(const HalfEdgeMesh& mesh, EdgeHandle e, std::vector<VertexHandle>& vertices) {
+    VertexHandle quad[4];
+    EdgeQuad(mesh, e, quad);
+    vertices.insert(vertices.end(), quad, quad + 4);
+}
+
+/*
+  A collapse changes all the triangles around both ends of the edge, and the
+  degrees, and the neighbours, of all the vertices of those triangles.
+*/
+static void LockCollapse(const HalfEdgeMesh& mesh, EdgeHandle e, std::vector<VertexHandle>& vertices) {
+    const HalfEdge& h0 = mesh.GetHalfEdge(mesh.GetEdge(e).halfEdge);
+    VertexHandle ends[2] = { h0.vertex, mesh.GetHalfEdge(h0.twin).vertex };
+
+    for(VertexHandle v : ends) {
+	vertices.push_back(v);
+	for(VertexHandle neighbour : mesh.Neighbours(v)) {
+	    vertices.push_back(neighbour);
+	}
+    }
+}
+
+/*
+  Move every inner vertex to the centroid of its neighbours, but only in the
+  tangent plane, so that the surface keeps its shape. All the vertices are
+  moved at once, from their old positions.
+*/
+static void Relax(HalfEdgeMesh& mesh, int numThreads) {
+
+    const GLuint numVertices = mesh.NumVertexHandles();
+    std::vector<glm::vec3> positions(numVertices);
+
+    ParallelForBlocks(0, numVertices, REMESH_BLOCK_SIZE, numThreads, [&](size_t begin, size_t end) {
+	    for(size_t i = begin; i < end; ++i) {
+		VertexHandle v = (VertexHandle)i;
+		glm::vec3 p = mesh.GetVertex(v).p;
+
+		positions[v] = p;
+
+		if(mesh.GetVertex(v).Removed() || mesh.IsBoundary(v))
+		    continue;
+
+		glm::vec3 centroid(0.0f);
+		glm::vec3 normal(0.0f);
+		int degree = 0;
+
+		for(HalfEdgeHandle h : mesh.Outgoing(v)) {
+		    const HalfEdge& next = mesh.GetHalfEdge(mesh.GetHalfEdge(h).next);
+		    glm::vec3 pb = mesh.GetVertex(next.vertex).p;
+		    glm::vec3 pc = mesh.GetVertex(mesh.GetHalfEdge(next.next).vertex).p;
+
+		    centroid += pb;
+		    normal += glm::cross(pb - p, pc - p);
+		    ++degree;
+		}
+
+		centroid /= (float)degree;
+
+		float length = glm::length(normal);
+		if(length == 0.0f)
+		    continue;
+		normal /= length;
+
+		glm::vec3 d = centroid - p;
+		positions[v] = p + d - normal * glm::dot(normal, d);
+	    }
+	});
+
+    ParallelForBlocks(0, numVertices, REMESH_BLOCK_SIZE, numThreads, [&](size_t begin, size_t end) {
+	    for(size_t v = begin; v < end; ++v) {
+		mesh.GetVertex((VertexHandle)v).p = positions[v];
+	    }
+	});
+}
+
+RemeshStats IsotropicRemesh(HalfEdgeMesh& mesh, float edgeLength, int iterations, int numThreads) {
+
+    RemeshStats stats;
+
+    const float maxLength = edgeLength * 4.0f / 3.0f;
+    const float minLength = edgeLength * 4.0f / 5.0f;
+
+    for(int iteration = 0; iteration < iterations; ++iteration) {
+
+	int numSplits = Rounds(
+	    mesh, numThreads,
+	    [&](EdgeHandle e, GLuint& priority) {
+		float length = Length(mesh, e);
+		priority = HashPriority(LengthLevel(length, edgeLength), e);
+		return length > maxLength && mesh.CanSplit(e) && LongestEdge(mesh, e);
+	    },
+	    [&](EdgeHandle e, std::vector<VertexHandle>& vertices) { LockQuad(mesh, e, vertices); },
+	    [&](const std::vector<EdgeHandle>& edges) {
+		mesh.ReserveSplits(edges.size());
+		ParallelForBlocks(0, edges.size(), REMESH_BLOCK_SIZE, numThreads, [&](size_t begin, size_t end) {
+			for(size_t i = begin; i < end; ++i) {
+			    mesh.SplitReserved(edges[i], i);
+			}
+		    });
+	    });
+
+	int numCollapses = Rounds(
+	    mesh, numThreads,
+	    [&](EdgeHandle e, GLuint& priority) {
+		float length = Length(mesh, e);
+		priority = HashPriority(255 - LengthLevel(length, edgeLength), e); // the shortest first.
+		return length < minLength && mesh.CanCollapse(e) && GoodCollapse(mesh, e, maxLength);
+	    },
+	    [&](EdgeHandle e, std::vector<VertexHandle>& vertices) { LockCollapse(mesh, e, vertices); },
+	    [&](const std::vector<EdgeHandle>& edges) {
+		ParallelForBlocks(0, edges.size(), REMESH_BLOCK_SIZE, numThreads, [&](size_t begin, size_t end) {
+			for(size_t i = begin; i < end; ++i) {
+			    mesh.Collapse(edges[i], false);
+			}
+		    });
+		mesh.RebuildFreeLists();
+	    });
+
+	int numFlips = Rounds(
+	    mesh, numThreads,
+	    [&](EdgeHandle e, GLuint& priority) {
+		if(!mesh.CanFlip(e))
+		    return false;
+
+		int gain = FlipGain(mesh, e);
+
+		// the biggest gains first.
+		priority = HashPriority((GLuint)gain, e);
+		return gain > 0;
+	    },
+	    [&](EdgeHandle e, std::vector<VertexHandle>& vertices) { LockQuad(mesh, e, vertices); },
+	    [&](const std::vector<EdgeHandle>& edges) {
+		ParallelForBlocks(0, edges.size(), REMESH_BLOCK_SIZE, numThreads, [&](size_t begin, size_t end) {
+			for(size_t i = begin; i < end; ++i) {
+			    mesh.Flip(edges[i]);
+			}
+		    });
+	    });
+
+	Relax(mesh, numThreads);
+
+	stats.numSplits += numSplits;
+	stats.numCollapses += numCollapses;
+	stats.numFlips += numFlips;
+    }
+
+    return stats;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "half_edge_mesh.hpp"
+
+#include <cfloat>
+
+/*
+  Isotropic remeshing, like in
+
+  Botsch and Kobbelt, "A Remeshing Approach to Multiresolution Modeling"
+
+  Every iteration splits the edges longer than 4/3 of the target edge length,
+  collapses the edges shorter than 4/5 of it, flips edges to bring the degrees
+  of the vertices closer to 6, and then moves every vertex towards the centroid
+  of its neighbours, in the tangent plane. After a few iterations, the triangles
+  are all about equilateral, and of about the target size.
+
+  The splits, collapses and flips run in parallel, in rounds. Every round, the
+  edges that want the operation grab the vertices that the operation touches,
+  and an edge that got all of them is done in this round. So the edges of a
+  round never touch each other. When edges compete, the longest edge is split
+  first, and the shortest edge is collapsed first, up to 1/16 of the target
+  edge length.
+
+  The result does not depend on numThreads. Edges on the boundary of the mesh are
+  left as they are. 0 threads means one per hardware thread.
+*/
+struct RemeshStats {
+    // the operations, summed over all the iterations.
+    int numSplits = 0;
+    int numCollapses = 0;
+    int numFlips = 0;
+};
+
+RemeshStats IsotropicRemesh(HalfEdgeMesh& mesh, float edgeLength, int iterations = 5, int numThreads = 1);
+
+float MeanEdgeLength(const HalfEdgeMesh& mesh);
+
+/*
+  Whether the edge is at least as long as the other edges of its two triangles.
+  Only such edges are split: splitting a shorter edge leaves the longest edge
+  of the triangle in place, and along a strip of slivers, that can go on
+  forever. The edge must be one that CanSplit().
+*/
+bool LongestEdge(const HalfEdgeMesh& mesh, EdgeHandle e);
+
+/*
+  Whether collapsing the edge into its midpoint keeps the mesh nice: it must
+  not create edges longer than maxLength, that would be split again right away,
+  and it must not turn any of the remaining triangles around.
+*/
+bool GoodCollapse(const HalfEdgeMesh& mesh, EdgeHandle e, float maxLength);
+
+// the same, for collapsing the edge into the point m.
+bool GoodCollapse(const HalfEdgeMesh& mesh, EdgeHandle e, const glm::vec3& m, float maxLength = FLT_MAX);
+
+/*
+  How much flipping the edge would reduce the sum of how far the degrees of
+  its four vertices are from 6. It is 0 if the flip would fold the surface over,
+  where it bends sharply. The edge must be one that CanFlip().
+*/
+int FlipGain(const HalfEdgeMesh& mesh, EdgeHandle e);
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+/*
+  Signed distance functions that the sculptures are built out of.
+
+  Every function has a scalar version, and a batch version that evaluates it
+  for n points at once, given as separate x, y and z arrays(SoA). A density
+  functor can use the batch versions to implement evalBatch(), which
+  MarchingCubes() calls for whole rows of the grid at once.
+
+  The batch versions use AVX or SSE, if the compiler targets them, and do the
+  exact same float operations as the scalar versions, so they give the same values.
+*/
+
+#if defined(__AVX__)
+
+#include <immintrin.h>
+
+typedef __m256 SdfFloats;
+const int SDF_WIDTH = 8;
+
+inline SdfFloats SdfLoad(const float* p) { return _mm256_loadu_ps(p); }
+inline void SdfStore(float* p, SdfFloats a) { _mm256_storeu_ps(p, a); }
+// p[indices[0]], p[indices[1]], ...
+#if defined(__AVX2__)
+inline SdfFloats SdfGather(const float* p, const uint32_t* indices) {
+    return _mm256_i32gather_ps(p, _mm256_loadu_si256((const __m256i*)indices), 4);
+}
+#else
+inline SdfFloats SdfGather(const float* p, const uint32_t* indices) {
+    return _mm256_setr_ps(
+	p[indices[0]], p[indices[1]], p[indices[2]], p[indices[3]],
+	p[indices[4]], p[indices[5]], p[indices[6]], p[indices[7]]);
+}
+#endif
+inline SdfFloats SdfSet(float a) { return _mm256_set1_ps(a); }
+inline SdfFloats SdfAdd(SdfFloats a, SdfFloats b) { return _mm256_add_ps(a, b); }
+inline SdfFloats SdfSub(SdfFloats a, SdfFloats b) { return _mm256_sub_ps(a, b); }
+inline SdfFloats SdfMul(SdfFloats a, SdfFloats b) { return _mm256_mul_ps(a, b); }
+inline SdfFloats SdfDiv(SdfFloats a, SdfFloats b) { return _mm256_div_ps(a, b); }
+inline SdfFloats SdfSqrt(SdfFloats a) { return _mm256_sqrt_ps(a); }
+// a < b ? a : b, just like std::min(b, a).
+inline SdfFloats SdfMin(SdfFloats a, SdfFloats b) { return _mm256_min_ps(a, b); }
+// a > b ? a : b, just like std::max(b, a).
+inline SdfFloats SdfMax(SdfFloats a, SdfFloats b) { return _mm256_max_ps(a, b); }
+// comparisons give a mask, that is all ones where they are true.
+inline SdfFloats SdfLess(SdfFloats a, SdfFloats b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline SdfFloats SdfLessEqual(SdfFloats a, SdfFloats b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+// mask ? a : b
+inline SdfFloats SdfSelect(SdfFloats mask, SdfFloats a, SdfFloats b) { return _mm256_blendv_ps(b, a, mask); }
+inline bool SdfAny(SdfFloats mask) { return _mm256_movemask_ps(mask) != 0; }
+
+#define SDF_SIMD
+
+#elif defined(__SSE2__)
+
+#include <emmintrin.h>
+
+typedef __m128 SdfFloats;
+const int SDF_WIDTH = 4;
+
+inline SdfFloats SdfLoad(const float* p) { return _mm_loadu_ps(p); }
+inline void SdfStore(float* p, SdfFloats a) { _mm_storeu_ps(p, a); }
+// p[indices[0]], p[indices[1]], ...
+inline SdfFloats SdfGather(const float* p, const uint32_t* indices) {
+    return _mm_setr_ps(p[indices[0]], p[indices[1]], p[indices[2]], p[indices[3]]);
+}
+inline SdfFloats SdfSet(float a) { return _mm_set1_ps(a); }
+inline SdfFloats SdfAdd(SdfFloats a, SdfFloats b) { return _mm_add_ps(a, b); }
+inline SdfFloats SdfSub(SdfFloats a, SdfFloats b) { return _mm_sub_ps(a, b); }
+inline SdfFloats SdfMul(SdfFloats a, SdfFloats b) { return _mm_mul_ps(a, b); }
+inline SdfFloats SdfDiv(SdfFloats a, SdfFloats b) { return _mm_div_ps(a, b); }
+inline SdfFloats SdfSqrt(SdfFloats a) { return _mm_sqrt_ps(a); }
+// a < b ? a : b, just like std::min(b, a).
+inline SdfFloats SdfMin(SdfFloats a, SdfFloats b) { return _mm_min_ps(a, b); }
+// a > b ? a : b, just like std::max(b, a).
+inline SdfFloats SdfMax(SdfFloats a, SdfFloats b) { return _mm_max_ps(a, b); }
+// comparisons give a mask, that is all ones where they are true.
+inline SdfFloats SdfLess(SdfFloats a, SdfFloats b) { return _mm_cmplt_ps(a, b); }
+inline SdfFloats SdfLessEqual(SdfFloats a, SdfFloats b) { return _mm_cmple_ps(a, b); }
+// mask ? a : b
+inline SdfFloats SdfSelect(SdfFloats mask, SdfFloats a, SdfFloats b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+inline bool SdfAny(SdfFloats mask) { return _mm_movemask_ps(mask) != 0; }
+
+#define SDF_SIMD
+
+#endif
+
+
+inline float Capsule(float x_, float y_, float z_, glm::vec3 p0, glm::vec3 p1, float r) {
+
+    // Source of the below formula:
+    // see equation (4.40) of http://image.diku.dk/projects/media/kelager.06.pdf
+
+    glm::vec3 x(x_,y_,z_);
+
+    float t = - glm::dot(p0 - x, p1 - p0) / glm::dot(p1 - p0, p1 - p0);
+    t = std::min(1.0f, std::max(0.0f,t));
+
+    glm::vec3 q = p0 + t * (p1-p0);
+
+    return glm::length(q - x) - r;
+}
+
+/*
+  The gradient of Capsule(), which does not depend on the radius. It points away
+  from the closest point on the segment, and is zero on the segment itself.
+*/
+inline glm::vec3 CapsuleGradient(float x_, float y_, float z_, glm::vec3 p0, glm::vec3 p1) {
+
+    glm::vec3 x(x_,y_,z_);
+
+    float t = - glm::dot(p0 - x, p1 - p0) / glm::dot(p1 - p0, p1 - p0);
+    t = std::min(1.0f, std::max(0.0f,t));
+
+    glm::vec3 q = p0 + t * (p1-p0);
+
+    float length = glm::length(x - q);
+    return length > 0.0f ? (x - q) / length : glm::vec3(0.0f);
+}
+
+inline float Torus(float x, float y, float z, float R, float r) {
+
+    // std::sqrt, so that this is done in float, just like TorusBatch().
+    float a = R - std::sqrt(x*x + y*y);
+
+    return a*a + z*z - r*r;
+
+}
+
+inline float Union(float v1, float v2) {
+    return std::min(v1,v2);
+}
+
+
+inline void CapsuleBatch(
+    const float* xs, const float* ys, const float* zs, float* out, size_t n,
+    glm::vec3 p0, glm::vec3 p1, float r) {
+
+    size_t i = 0;
+
+#ifdef SDF_SIMD
+    const glm::vec3 d = p1 - p0;
+    const float dd = glm::dot(d, d);
+
+    const SdfFloats zero = SdfSet(0.0f);
+    const SdfFloats one = SdfSet(1.0f);
+
+    for(; i + SDF_WIDTH <= n; i += SDF_WIDTH) {
+
+	SdfFloats x = SdfLoad(xs + i);
+	SdfFloats y = SdfLoad(ys + i);
+	SdfFloats z = SdfLoad(zs + i);
+
+	// a = p0 - x
+	SdfFloats ax = SdfSub(SdfSet(p0.x), x);
+	SdfFloats ay = SdfSub(SdfSet(p0.y), y);
+	SdfFloats az = SdfSub(SdfSet(p0.z), z);
+
+	// t = -dot(a, d) / dot(d, d), clamped to [0,1].
+	SdfFloats dot = SdfAdd(SdfAdd(SdfMul(ax, SdfSet(d.x)), SdfMul(ay, SdfSet(d.y))), SdfMul(az, SdfSet(d.z)));
+	SdfFloats t = SdfDiv(SdfSub(zero, dot), SdfSet(dd));
+	t = SdfMin(SdfMax(t, zero), one);
+
+	// q - x, where q = p0 + t*d
+	SdfFloats qx = SdfSub(SdfAdd(SdfSet(p0.x), SdfMul(t, SdfSet(d.x))), x);
+	SdfFloats qy = SdfSub(SdfAdd(SdfSet(p0.y), SdfMul(t, SdfSet(d.y))), y);
+	SdfFloats qz = SdfSub(SdfAdd(SdfSet(p0.z), SdfMul(t, SdfSet(d.z))), z);
+
+	SdfFloats len = SdfSqrt(SdfAdd(SdfAdd(SdfMul(qx, qx), SdfMul(qy, qy)), SdfMul(qz, qz)));
+
+	SdfStore(out + i, SdfSub(len, SdfSet(r)));
+    }
+#endif
+
+    for(; i < n; ++i) {
+	out[i] = Capsule(xs[i], ys[i], zs[i], p0, p1, r);
+    }
+}
+
+inline void TorusBatch(
+    const float* xs, const float* ys, const float* zs, float* out, size_t n,
+    float R, float r) {
+
+    size_t i = 0;
+
+#ifdef SDF_SIMD
+    for(; i + SDF_WIDTH <= n; i += SDF_WIDTH) {
+
+	SdfFloats x = SdfLoad(xs + i);
+	SdfFloats y = SdfLoad(ys + i);
+	SdfFloats z = SdfLoad(zs + i);
+
+	SdfFloats a = SdfSub(SdfSet(R), SdfSqrt(SdfAdd(SdfMul(x, x), SdfMul(y, y))));
+
+	SdfStore(out + i, SdfSub(SdfAdd(SdfMul(a, a), SdfMul(z, z)), SdfSet(r*r)));
+    }
+#endif
+
+    for(; i < n; ++i) {
+	out[i] = Torus(xs[i], ys[i], zs[i], R, r);
+    }
+}
+
+// out = Union(out, vs), for every element.
+inline void UnionBatch(float* out, const float* vs, size_t n) {
+
+    size_t i = 0;
+
+#ifdef SDF_SIMD
+    for(; i + SDF_WIDTH <= n; i += SDF_WIDTH) {
+	SdfStore(out + i, SdfMin(SdfLoad(vs + i), SdfLoad(out + i)));
+    }
+#endif
+
+    for(; i < n; ++i) {
+	out[i] = Union(out[i], vs[i]);
+    }
+}
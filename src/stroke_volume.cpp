@@ -0,0 +1,386 @@
+#include "stroke_volume.hpp"
+
+#include "marching_cubes.hpp"
+#include "parallel.hpp"
+
+#include <cfloat>
+
+// the number of cells per axis in a chunk.
+const int CHUNK_SIZE = 16;
+
+StrokeVolume::StrokeVolume(
+    int resolution,
+    float xMin, float xMax,
+    float yMin, float yMax,
+    float zMin, float zMax,
+    int numThreads):
+    m_resolution(resolution),
+    m_numThreads(numThreads),
+    m_dirty(true) {
+
+    m_bounds[0][0] = xMin; m_bounds[0][1] = yMin; m_bounds[0][2] = zMin;
+    m_bounds[1][0] = xMax; m_bounds[1][1] = yMax; m_bounds[1][2] = zMax;
+
+    for(int i = 0; i < 3; ++i) {
+	m_cellSizes[i] = (m_bounds[1][i] - m_bounds[0][i]) / (float)(resolution-1);
+    }
+
+    // there are no strokes, so the volume is empty.
+    m_values.assign((size_t)resolution*resolution*resolution, FLT_MAX);
+
+    for(int i = 0; i < 3; ++i) {
+	m_numChunks[i] = (resolution - 1 + CHUNK_SIZE-1) / CHUNK_SIZE;
+    }
+
+    m_chunks.resize(m_numChunks[0]*m_numChunks[1]*m_numChunks[2]);
+
+    int c[3];
+    for(c[0] = 0; c[0] < m_numChunks[0]; ++c[0])
+	for(c[1] = 0; c[1] < m_numChunks[1]; ++c[1])
+	    for(c[2] = 0; c[2] < m_numChunks[2]; ++c[2]) {
+
+		Chunk& chunk = m_chunks[ChunkIndex(c)];
+
+		for(int j = 0; j < 3; ++j) {
+		    chunk.lo[j] = c[j] * CHUNK_SIZE;
+		    chunk.hi[j] = std::min(chunk.lo[j] + CHUNK_SIZE, resolution-1);
+		}
+
+		chunk.dirtyVertices = true;
+		chunk.dirtyFaces = true;
+	    }
+}
+
+int StrokeVolume::ChunkIndex(const int* chunk)const {
+    return (chunk[0]*m_numChunks[1] + chunk[1])*m_numChunks[2] + chunk[2];
+}
+
+int StrokeVolume::EdgeOwner(const int* base)const {
+    int c[3];
+    for(int j = 0; j < 3; ++j) {
+	// the grid points on the upper boundary of the grid go to the last chunk.
+	c[j] = std::min(base[j] / CHUNK_SIZE, m_numChunks[j]-1);
+    }
+    return ChunkIndex(c);
+}
+
+void StrokeVolume::StrokeRegion(const Stroke& stroke, int* lo, int* hi)const {
+
+    /*
+      Outside of this margin, the stroke can not change the sign of the density. And
+      the only values that matter other than the sign, are the ones within two cells
+      of the surface(at the edges that the surface crosses, and their neighbours, for the normals).
+    */
+    float margin = stroke.r + 2.0f * glm::length(glm::vec3(m_cellSizes[0], m_cellSizes[1], m_cellSizes[2]));
+
+    glm::vec3 boxMin = glm::min(stroke.p0, stroke.p1) - glm::vec3(margin);
+    glm::vec3 boxMax = glm::max(stroke.p0, stroke.p1) + glm::vec3(margin);
+
+    for(int j = 0; j < 3; ++j) {
+	lo[j] = (int)floor((boxMin[j] - m_bounds[0][j]) / m_cellSizes[j]);
+	hi[j] = (int)ceil ((boxMax[j] - m_bounds[0][j]) / m_cellSizes[j]);
+
+	lo[j] = std::max(lo[j], 0);
+	hi[j] = std::min(hi[j], m_resolution-1);
+    }
+}
+
+void StrokeVolume::MarkDirty(const int* lo, const int* hi) {
+
+    /*
+      A vertex depends on the values at the ends of its edge, and on their neighbours. So
+      the vertices of the chunks that own the edges starting within two points of [lo, hi]
+      may change. And the faces of those chunks, and of the chunks right below them,
+      that refer to their vertices.
+    */
+    int cLo[3];
+    int cHi[3];
+    for(int j = 0; j < 3; ++j) {
+	cLo[j] = std::max(lo[j] - 2, 0) / CHUNK_SIZE;
+	cHi[j] = std::min(std::min(hi[j] + 2, m_resolution-1) / CHUNK_SIZE, m_numChunks[j]-1);
+    }
+
+    int c[3];
+    int n[3];
+    for(c[0] = cLo[0]; c[0] <= cHi[0]; ++c[0])
+	for(c[1] = cLo[1]; c[1] <= cHi[1]; ++c[1])
+	    for(c[2] = cLo[2]; c[2] <= cHi[2]; ++c[2]) {
+
+		m_chunks[ChunkIndex(c)].dirtyVertices = true;
+
+		for(int i = 0; i < 8; ++i) {
+		    for(int j = 0; j < 3; ++j) {
+			n[j] = c[j] - cubeVerticesTable[i][j];
+		    }
+
+		    if(n[0] >= 0 && n[1] >= 0 && n[2] >= 0) {
+			m_chunks[ChunkIndex(n)].dirtyFaces = true;
+		    }
+		}
+	    }
+
+    m_dirty = true;
+}
+
+int StrokeVolume::AddStroke(const glm::vec3& p0, const glm::vec3& p1, float r) {
+
+    Stroke stroke;
+    stroke.p0 = p0;
+    stroke.p1 = p1;
+    stroke.r = r;
+    stroke.removed = false;
+
+    m_strokes.push_back(stroke);
+
+    int lo[3];
+    int hi[3];
+    StrokeRegion(stroke, lo, hi);
+
+    // the new density is just the union of the old one and the stroke.
+    ParallelFor(lo[0], hi[0]+1, m_numThreads, [&](int x) {
+
+	    int n = hi[2] - lo[2] + 1;
+	    std::vector<float> xs(n), ys(n), zs(n), v(n);
+
+	    int C[3] = { x, 0, lo[2] };
+
+	    for(C[1] = lo[1]; C[1] <= hi[1]; ++C[1]) {
+
+		for(int i = 0; i < n; ++i) {
+		    xs[i] = m_bounds[0][0] + C[0] * m_cellSizes[0];
+		    ys[i] = m_bounds[0][1] + C[1] * m_cellSizes[1];
+		    zs[i] = m_bounds[0][2] + (C[2] + i) * m_cellSizes[2];
+		}
+
+		CapsuleBatch(xs.data(), ys.data(), zs.data(), v.data(), n, p0, p1, r);
+		UnionBatch(&m_values[XyzToId(C, m_resolution)], v.data(), n);
+	    }
+	});
+
+    MarkDirty(lo, hi);
+
+    return (int)m_strokes.size() - 1;
+}
+
+void StrokeVolume::RemoveStroke(int stroke) {
+
+    if(m_strokes[stroke].removed)
+	return;
+
+    m_strokes[stroke].removed = true;
+
+    // the strokes that are left.
+    CapsuleSet capsules;
+    for(const Stroke& s : m_strokes) {
+	if(!s.removed) {
+	    capsules.Add(s.p0, s.p1, s.r);
+	}
+    }
+    capsules.Build();
+
+    int lo[3];
+    int hi[3];
+    StrokeRegion(m_strokes[stroke], lo, hi);
+
+    // we can't take the stroke out of a min, so evaluate the remaining strokes in the region.
+    ParallelFor(lo[0], hi[0]+1, m_numThreads, [&](int x) {
+
+	    int n = hi[2] - lo[2] + 1;
+	    std::vector<float> xs(n), ys(n), zs(n);
+
+	    int C[3] = { x, 0, lo[2] };
+
+	    for(C[1] = lo[1]; C[1] <= hi[1]; ++C[1]) {
+
+		for(int i = 0; i < n; ++i) {
+		    xs[i] = m_bounds[0][0] + C[0] * m_cellSizes[0];
+		    ys[i] = m_bounds[0][1] + C[1] * m_cellSizes[1];
+		    zs[i] = m_bounds[0][2] + (C[2] + i) * m_cellSizes[2];
+		}
+
+		capsules.EvalBatch(xs.data(), ys.data(), zs.data(), &m_values[XyzToId(C, m_resolution)], n);
+	    }
+	});
+
+    MarkDirty(lo, hi);
+}
+
+void StrokeVolume::MeshVertices(Chunk& chunk) {
+
+    chunk.vertices.clear();
+    chunk.normals.clear();
+    chunk.edgeIds.clear();
+
+    McValueGrid grid = { m_values.data(), m_resolution };
+
+    // the grid points that the edges of the chunk start at. The chunks at the upper
+    // boundary of the grid also get the points on the boundary.
+    int bHi[3];
+    for(int j = 0; j < 3; ++j) {
+	bHi[j] = chunk.hi[j] == m_resolution-1 ? chunk.hi[j] : chunk.hi[j]-1;
+    }
+
+    int A[3];
+    int B[3];
+
+    // the edges are visited in the order of their ids.
+    for(A[0] = chunk.lo[0]; A[0] <= bHi[0]; ++A[0])
+	for(A[1] = chunk.lo[1]; A[1] <= bHi[1]; ++A[1])
+	    for(A[2] = chunk.lo[2]; A[2] <= bHi[2]; ++A[2]) {
+
+		float vA = grid.Value(A);
+
+		for(int axis = 0; axis < 3; ++axis) {
+
+		    if(A[axis] == m_resolution-1)
+			continue; // no edge leaves the grid.
+
+		    for(int j = 0; j < 3; ++j) {
+			B[j] = A[j] + (j == axis ? 1 : 0);
+		    }
+
+		    float vB = grid.Value(B);
+
+		    if((vA > 0) == (vB > 0))
+			continue; // the surface doesn't cross this edge.
+
+		    glm::vec3 p;
+		    glm::vec3 n;
+		    McEdgeVertex(grid, A, B, vA, vB, m_bounds, m_cellSizes, p, n);
+
+		    chunk.vertices.push_back(p);
+		    chunk.normals.push_back(n);
+		    chunk.edgeIds.push_back((long long)XyzToId(A, m_resolution) * 3 + axis);
+		}
+	    }
+}
+
+void StrokeVolume::MeshFaces(Chunk& chunk) {
+
+    chunk.faces.clear();
+
+    VertexRef edgeVertices[12];
+
+    int C[3];
+    int A[3];
+    int B[3];
+
+    for(C[0] = chunk.lo[0]; C[0] < chunk.hi[0]; ++C[0])
+	for(C[1] = chunk.lo[1]; C[1] < chunk.hi[1]; ++C[1])
+	    for(C[2] = chunk.lo[2]; C[2] < chunk.hi[2]; ++C[2]) {
+
+		int cellIndex = 0;
+
+		for(int i = 0; i < 8; ++i) {
+		    if( m_values[XyzToId(C, i, m_resolution)] > 0 ) {
+			cellIndex |= ( 1 << i );
+		    }
+		}
+
+		int edgeTableMask = edgeTable[cellIndex];
+
+		if(edgeTableMask == 0)
+		    continue; // no geometry in this cell!
+
+		// find the vertices of the edges, in the chunks that own them.
+		for(int i = 0; i < 12; ++i) {
+
+		    if(  ((1 << i) & edgeTableMask) == 0 )
+			continue;
+
+		    const int* e = edges[i];
+
+		    for(int j = 0; j < 3; ++j) {
+			A[j] = C[j] + cubeVerticesTable[e[0]][j];
+			B[j] = C[j] + cubeVerticesTable[e[1]][j];
+		    }
+		    const int* base;
+		    int axis = EdgeBase(A, B, base);
+
+		    int owner = EdgeOwner(base);
+		    long long edgeId = (long long)XyzToId(base, m_resolution) * 3 + axis;
+
+		    const std::vector<long long>& ids = m_chunks[owner].edgeIds;
+		    auto it = std::lower_bound(ids.begin(), ids.end(), edgeId);
+
+		    edgeVertices[i].chunk = owner;
+		    edgeVertices[i].index = (GLuint)(it - ids.begin());
+		}
+
+		const int* tri = triTable[cellIndex];
+
+		for(int i = 0; i < 16; i+=3) {
+
+		    if(tri[i] == -1)
+			break; // no more triangles!
+
+		    chunk.faces.push_back(edgeVertices[ tri[i+0] ]);
+		    chunk.faces.push_back(edgeVertices[ tri[i+1] ]);
+		    chunk.faces.push_back(edgeVertices[ tri[i+2] ]);
+		}
+	    }
+}
+
+const Mesh& StrokeVolume::GetMesh() {
+
+    if(!m_dirty)
+	return m_mesh;
+
+    std::vector<int> dirtyVertices;
+    std::vector<int> dirtyFaces;
+
+    for(int i = 0; i < (int)m_chunks.size(); ++i) {
+	if(m_chunks[i].dirtyVertices)
+	    dirtyVertices.push_back(i);
+	if(m_chunks[i].dirtyFaces)
+	    dirtyFaces.push_back(i);
+    }
+
+    // the faces refer to the vertices of the neighbouring chunks, so all the vertices must be done first.
+    ParallelFor(0, (int)dirtyVertices.size(), m_numThreads, [&](int i) {
+	    MeshVertices(m_chunks[dirtyVertices[i]]);
+	    m_chunks[dirtyVertices[i]].dirtyVertices = false;
+	});
+
+    ParallelFor(0, (int)dirtyFaces.size(), m_numThreads, [&](int i) {
+	    MeshFaces(m_chunks[dirtyFaces[i]]);
+	    m_chunks[dirtyFaces[i]].dirtyFaces = false;
+	});
+
+    /*
+      Now splice the geometry of all the chunks together.
+    */
+    std::vector<GLuint> vertexOffsets(m_chunks.size() + 1, 0);
+    std::vector<size_t> faceOffsets(m_chunks.size() + 1, 0);
+
+    for(size_t i = 0; i < m_chunks.size(); ++i) {
+	vertexOffsets[i+1] = vertexOffsets[i] + (GLuint)m_chunks[i].vertices.size();
+	faceOffsets[i+1] = faceOffsets[i] + m_chunks[i].faces.size() / 3;
+    }
+
+    m_mesh.vertices.resize(vertexOffsets.back());
+    m_mesh.normals.resize(vertexOffsets.back());
+    m_mesh.faces.resize(faceOffsets.back());
+
+    ParallelFor(0, (int)m_chunks.size(), m_numThreads, [&](int i) {
+
+	    const Chunk& chunk = m_chunks[i];
+
+	    std::copy(chunk.vertices.begin(), chunk.vertices.end(), m_mesh.vertices.begin() + vertexOffsets[i]);
+	    std::copy(chunk.normals.begin(), chunk.normals.end(), m_mesh.normals.begin() + vertexOffsets[i]);
+
+	    for(size_t f = 0; f < chunk.faces.size() / 3; ++f) {
+
+		Tri& tri = m_mesh.faces[faceOffsets[i] + f];
+
+		for(int k = 0; k < 3; ++k) {
+		    const VertexRef& ref = chunk.faces[3*f + k];
+		    tri.i[k] = vertexOffsets[ref.chunk] + ref.index;
+		}
+	    }
+	});
+
+    m_dirty = false;
+
+    return m_mesh;
+}
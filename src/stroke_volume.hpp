@@ -0,0 +1,107 @@
+#pragma once
+
+#include "mesh.hpp"
+#include "capsule_set.hpp"
+
+#include <vector>
+
+/*
+  A sculpture made out of capsule strokes, that is kept as a density volume
+  between edits, so that it can be remeshed incrementally.
+
+  Since the strokes are combined with Union(), which is a min, adding or
+  removing a stroke only changes the sign of the density, and the values close
+  to the surface, inside of the bounding box of the stroke. So that is the only
+  part of the volume that we need to update.
+
+  The cells are split into chunks, and every chunk keeps its own geometry.
+  When the volume has changed, only the chunks that the change touched are
+  remeshed, and the geometry of the other chunks is just spliced back in.
+
+  Every edge of the grid belongs to exactly one chunk, and the vertex on it is
+  only created by that chunk. So the mesh is watertight across the chunks.
+*/
+class StrokeVolume {
+
+private:
+
+    struct Stroke {
+	glm::vec3 p0;
+	glm::vec3 p1;
+	float r;
+
+	bool removed;
+    };
+
+    // a vertex, as the index of the chunk that created it, and its index in the chunk.
+    struct VertexRef {
+	int chunk;
+	GLuint index;
+    };
+
+    struct Chunk {
+	// the cells [lo, hi) of the chunk.
+	int lo[3];
+	int hi[3];
+
+	std::vector<glm::vec3> vertices;
+	std::vector<glm::vec3> normals;
+
+	// the ids of the grid edges that the vertices were created on, in increasing order.
+	std::vector<long long> edgeIds;
+
+	// three vertices per triangle.
+	std::vector<VertexRef> faces;
+
+	bool dirtyVertices;
+	bool dirtyFaces;
+    };
+
+    int m_resolution;
+    float m_bounds[2][3];
+    float m_cellSizes[3];
+
+    int m_numThreads;
+
+    std::vector<Stroke> m_strokes;
+
+    // the density at every grid point.
+    std::vector<float> m_values;
+
+    int m_numChunks[3];
+    std::vector<Chunk> m_chunks;
+
+    Mesh m_mesh;
+    bool m_dirty;
+
+    // find the grid points [lo, hi] where a stroke can change the geometry.
+    void StrokeRegion(const Stroke& stroke, int* lo, int* hi)const;
+
+    // the grid points [lo, hi] changed, so mark all the chunks that depend on them.
+    void MarkDirty(const int* lo, const int* hi);
+
+    int ChunkIndex(const int* chunk)const;
+
+    // the chunk that owns the edge starting at the grid point base.
+    int EdgeOwner(const int* base)const;
+
+    void MeshVertices(Chunk& chunk);
+    void MeshFaces(Chunk& chunk);
+
+public:
+
+    StrokeVolume(
+	int resolution,
+	float xMin, float xMax,
+	float yMin, float yMax,
+	float zMin, float zMax,
+	int numThreads = 1);
+
+    // returns the id of the stroke.
+    int AddStroke(const glm::vec3& p0, const glm::vec3& p1, float r);
+
+    void RemoveStroke(int stroke);
+
+    // remesh whatever changed since the last call, and get the mesh of the whole volume.
+    const Mesh& GetMesh();
+};
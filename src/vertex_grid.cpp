@@ -0,0 +1,105 @@
+#include "vertex_grid.hpp"
+
+#include <cmath>
+
+// the cell coordinates are stored in 21 bits each.
+const int CELL_BITS = 21;
+const long long CELL_MASK = (1LL << CELL_BITS) - 1;
+
+VertexGrid::VertexGrid(float cellSize): m_cellSize(cellSize) {
+}
+
+long long VertexGrid::CellKey(int x, int y, int z)const {
+    return
+	((x & CELL_MASK) << (2*CELL_BITS)) |
+	((y & CELL_MASK) << (1*CELL_BITS)) |
+	((z & CELL_MASK) << (0*CELL_BITS));
+}
+
+long long VertexGrid::CellKey(const glm::vec3& p)const {
+    return CellKey(
+	(int)floorf(p.x / m_cellSize),
+	(int)floorf(p.y / m_cellSize),
+	(int)floorf(p.z / m_cellSize));
+}
+
+void VertexGrid::Insert(GLuint vertex, long long key) {
+    std::vector<GLuint>& cell = m_cells[key];
+
+    m_vertexCells[vertex] = key;
+    m_vertexSlots[vertex] = (GLuint)cell.size();
+    cell.push_back(vertex);
+}
+
+void VertexGrid::Erase(GLuint vertex) {
+    auto it = m_cells.find(m_vertexCells[vertex]);
+    std::vector<GLuint>& cell = it->second;
+
+    // move the last vertex of the cell into the hole.
+    GLuint slot = m_vertexSlots[vertex];
+    cell[slot] = cell.back();
+    m_vertexSlots[cell[slot]] = slot;
+    cell.pop_back();
+
+    if(cell.empty()) {
+	m_cells.erase(it);
+    }
+}
+
+void VertexGrid::Build(const std::vector<glm::vec3>& vertices) {
+
+    m_cells.clear();
+    m_vertexCells.resize(vertices.size());
+    m_vertexSlots.resize(vertices.size());
+
+    for(GLuint i = 0; i < vertices.size(); ++i) {
+	Insert(i, CellKey(vertices[i]));
+    }
+}
+
+void VertexGrid::Move(GLuint vertex, const glm::vec3& p) {
+
+    long long key = CellKey(p);
+
+    if(key == m_vertexCells[vertex])
+	return; // still in the same cell.
+
+    Erase(vertex);
+    Insert(vertex, key);
+}
+
+void VertexGrid::Add(GLuint vertex, const glm::vec3& p) {
+
+    if(vertex >= m_vertexCells.size()) {
+	m_vertexCells.resize(vertex+1);
+	m_vertexSlots.resize(vertex+1);
+    }
+
+    Insert(vertex, CellKey(p));
+}
+
+void VertexGrid::Remove(GLuint vertex) {
+    Erase(vertex);
+}
+
+void VertexGrid::Query(const glm::vec3& center, float radius, std::vector<GLuint>& result)const {
+
+    int lo[3];
+    int hi[3];
+
+    for(int j = 0; j < 3; ++j) {
+	lo[j] = (int)floorf((center[j] - radius) / m_cellSize);
+	hi[j] = (int)floorf((center[j] + radius) / m_cellSize);
+    }
+
+    for(int x = lo[0]; x <= hi[0]; ++x)
+	for(int y = lo[1]; y <= hi[1]; ++y)
+	    for(int z = lo[2]; z <= hi[2]; ++z) {
+
+		auto it = m_cells.find(CellKey(x, y, z));
+
+		if(it != m_cells.end()) {
+		    result.insert(result.end(), it->second.begin(), it->second.end());
+		}
+	    }
+}
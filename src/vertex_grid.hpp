@@ -0,0 +1,57 @@
+#pragma once
+
+#include "mesh.hpp"
+
+#include <vector>
+#include <unordered_map>
+
+/*
+  A uniform hash grid over the vertices of a mesh, for finding the vertices
+  near some point without looking at all of them.
+
+  Only the cells that actually have vertices in them are stored, so the
+  memory use only depends on the number of vertices. When a vertex is moved,
+  Move() must be called, so that the vertex ends up in the right cell.
+*/
+class VertexGrid {
+
+private:
+
+    float m_cellSize;
+
+    // the vertices of every non-empty cell.
+    std::unordered_map<long long, std::vector<GLuint> > m_cells;
+
+    // for every vertex, its cell, and its index in the vertices of that cell.
+    std::vector<long long> m_vertexCells;
+    std::vector<GLuint> m_vertexSlots;
+
+    long long CellKey(int x, int y, int z)const;
+    long long CellKey(const glm::vec3& p)const;
+
+    void Insert(GLuint vertex, long long key);
+    void Erase(GLuint vertex);
+
+public:
+
+    VertexGrid(float cellSize);
+
+    // (re)build the grid from scratch.
+    void Build(const std::vector<glm::vec3>& vertices);
+
+    // the vertex was moved to p.
+    void Move(GLuint vertex, const glm::vec3& p);
+
+    // a vertex was added to the mesh. Its handle may be one that was removed before.
+    void Add(GLuint vertex, const glm::vec3& p);
+
+    // the vertex was removed from the mesh.
+    void Remove(GLuint vertex);
+
+    /*
+      Find all the vertices in the cells that overlap the sphere at center with
+      the given radius, and add them to result. This is a superset of the vertices
+      inside of the sphere.
+    */
+    void Query(const glm::vec3& center, float radius, std::vector<GLuint>& result)const;
+};